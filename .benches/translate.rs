@@ -0,0 +1,151 @@
+// Cost of getting at a large CMD tree from Rust:  walking the zero-copy view
+// versus building an owned copy of every node and string (as translate()
+// used to).  Run with:  cargo bench --bench translate [-- NODES]
+
+#![allow(non_snake_case)]
+
+use process::{RawCMD, CMD};
+use std::ffi::CString;
+use std::hint::black_box;
+use std::os::raw::c_char;
+use std::ptr;
+use std::sync::Arc;
+use std::time::Instant;
+
+const SIMPLE: i32 = 0;
+const SEP_END: i32 = 11;
+const RED_OUT: i32 = 3;
+
+// Owned copy of a node, as the old translate() built it
+#[allow(dead_code)]
+struct OwnedCMD {
+  node: u32,
+  argv: Vec<Option<String>>,
+  locVar: Vec<Option<String>>,
+  locVal: Vec<Option<String>>,
+  fromType: u32,
+  fromFile: Option<String>,
+  toType: u32,
+  toFile: Option<String>,
+  left: Option<Arc<OwnedCMD>>,
+  right: Option<Arc<OwnedCMD>>,
+}
+
+// Storage for a tree built in C layout
+struct Tree {
+  nodes: Vec<RawCMD>,
+  strings: Vec<CString>,
+  arrays: Vec<Vec<*mut c_char>>,
+}
+
+impl Tree {
+  fn string(&mut self, s: &str) -> *mut c_char {
+    self.strings.push(CString::new(s).unwrap());
+    self.strings.last().unwrap().as_ptr() as *mut c_char
+  }
+
+  fn array(&mut self, items: &[&str]) -> *mut *mut c_char {
+    let mut v: Vec<*mut c_char> = items.iter().map(|s| self.string(s)).collect();
+    v.push(ptr::null_mut());
+    let p = v.as_mut_ptr();
+    self.arrays.push(v);
+    p
+  }
+
+  fn node(&mut self, node: i32) -> RawCMD {
+    RawCMD {
+      node: node, argc: 0, argv: ptr::null_mut(), nLocal: 0,
+      locVar: ptr::null_mut(), locVal: ptr::null_mut(),
+      fromType: 0, fromFile: ptr::null_mut(), toType: 0, toFile: ptr::null_mut(),
+      errType: 0, errFile: ptr::null_mut(), left: ptr::null_mut(), right: ptr::null_mut(),
+    }
+  }
+}
+
+// Build a balanced tree of N simple commands joined by ;
+fn build(n: usize) -> (Tree, *const RawCMD) {
+  let mut t = Tree { nodes: Vec::with_capacity(2 * n), strings: Vec::new(), arrays: Vec::new() };
+  for i in 0..n {
+    let arg = format!("arg{}", i);
+    let mut c = t.node(SIMPLE);
+    c.argc = 4;
+    c.argv = t.array(&["/bin/echo", "-n", &arg, "more"]);
+    c.nLocal = 1;
+    c.locVar = t.array(&["VAR"]);
+    c.locVal = t.array(&["value"]);
+    c.toType = RED_OUT;
+    c.toFile = t.string("/dev/null");
+    t.nodes.push(c);
+  }
+
+  // Pair up the nodes level by level (nodes never moves:  capacity is 2N)
+  let mut level: Vec<usize> = (0..n).collect();
+  while level.len() > 1 {
+    let mut next = Vec::with_capacity((level.len() + 1) / 2);
+    for pair in level.chunks(2) {
+      if pair.len() == 1 {
+        next.push(pair[0]);
+        continue;
+      }
+      let mut c = t.node(SEP_END);
+      c.left = &mut t.nodes[pair[0]] as *mut RawCMD;
+      c.right = &mut t.nodes[pair[1]] as *mut RawCMD;
+      t.nodes.push(c);
+      next.push(t.nodes.len() - 1);
+    }
+    level = next;
+  }
+  let root = &t.nodes[level[0]] as *const RawCMD;
+  (t, root)
+}
+
+// Walk the view, touching every string
+fn walk(cmd: CMD) -> usize {
+  let mut n = cmd.node() as usize;
+  n += cmd.argv().bytes().map(|b| b.len()).sum::<usize>();
+  n += cmd.locals().map(|(v, x)| v.to_bytes().len() + x.to_bytes().len()).sum::<usize>();
+  n += cmd.fromFile().map_or(0, |s| s.to_bytes().len());
+  n += cmd.toFile().map_or(0, |s| s.to_bytes().len());
+  n += cmd.left().map_or(0, walk);
+  n += cmd.right().map_or(0, walk);
+  n
+}
+
+fn owned(s: Option<&std::ffi::CStr>) -> Option<String> {
+  s.map(|s| s.to_str().unwrap().to_owned())
+}
+
+// Copy the tree the way translate() did
+fn deep_copy(cmd: CMD) -> Arc<OwnedCMD> {
+  Arc::new(OwnedCMD {
+    node: cmd.node(),
+    argv: (0..cmd.argc()).map(|i| owned(cmd.argv().get(i))).collect(),
+    locVar: (0..cmd.nLocal()).map(|i| owned(cmd.locVar().get(i))).collect(),
+    locVal: (0..cmd.nLocal()).map(|i| owned(cmd.locVal().get(i))).collect(),
+    fromType: cmd.fromType(),
+    fromFile: owned(cmd.fromFile()),
+    toType: cmd.toType(),
+    toFile: owned(cmd.toFile()),
+    left: cmd.left().map(deep_copy),
+    right: cmd.right().map(deep_copy),
+  })
+}
+
+fn time<T>(what: &str, nodes: usize, reps: u32, mut f: impl FnMut() -> T) {
+  let start = Instant::now();
+  for _ in 0..reps {
+    black_box(f());
+  }
+  let ns = start.elapsed().as_nanos() as f64 / reps as f64;
+  println!("{:<10} {:>12.0} ns/tree {:>8.1} ns/node", what, ns, ns / nodes as f64);
+}
+
+fn main() {
+  let n: usize = std::env::args().skip(1).find_map(|a| a.parse().ok()).unwrap_or(100_000);
+  let (_tree, root) = build(n);
+  let nodes = 2 * n - 1;
+  let cmd = unsafe { CMD::from_ptr(root) }.unwrap();
+  println!("{} simple commands, {} nodes", n, nodes);
+  time("view", nodes, 20, || walk(cmd));
+  time("deep copy", nodes, 20, || deep_copy(cmd));
+}
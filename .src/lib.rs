@@ -4,10 +4,9 @@
 
 extern crate libc;
 
-use libc::c_char;
+use libc::{c_char, c_int};
 use std::ffi::CStr;
-use std::str;
-use std::sync::Arc;
+use std::slice;
 
 mod process;
 use process::r_process;
@@ -45,97 +44,104 @@ pub enum Type {
   SUBCMD            // Nontoken: CMD struct for subcommand
 }
 
-pub struct CMD {
-  pub node: u32,
-  pub argc: u32,
-  pub argv: Vec<Option<String>>,
-  pub nLocal: u32,
-  pub locVar: Vec<Option<String>>,
-  pub locVal: Vec<Option<String>>,
-  pub fromType: u32,
-  pub fromFile: Option<String>,
-  pub toType: u32,
-  pub toFile: Option<String>,
-  pub errType: u32,
-  pub errFile: Option<String>,
-  pub left: Option<Arc<CMD>>,
-  pub right: Option<Arc<CMD>>,
+// The C struct cmd of parse.h, field for field
+#[repr(C)]
+pub struct RawCMD {
+  pub node: c_int,
+  pub argc: c_int,
+  pub argv: *mut *mut c_char,
+  pub nLocal: c_int,
+  pub locVar: *mut *mut c_char,
+  pub locVal: *mut *mut c_char,
+  pub fromType: c_int,
+  pub fromFile: *mut c_char,
+  pub toType: c_int,
+  pub toFile: *mut c_char,
+  pub errType: c_int,
+  pub errFile: *mut c_char,
+  pub left: *mut RawCMD,
+  pub right: *mut RawCMD,
 }
 
-extern {
-  fn get_type(addr: u64) -> u32;
-  fn get_argc(addr: u64) -> u32;
-  fn get_argv(addr: u64) -> u64;
-  fn get_nLocal(addr: u64) -> u32;
-  fn get_locVar(addr: u64) -> u64;
-  fn get_locVal(addr: u64) -> u64;
-  fn get_fromType(addr: u64) -> u32;
-  fn get_fromFile(addr: u64) -> u64;
-  fn get_toType(addr: u64) -> u32;
-  fn get_toFile(addr: u64) -> u64;
-  fn get_errType(addr: u64) -> u32;
-  fn get_errFile(addr: u64) -> u64;
-  fn get_left(addr: u64) -> u64;
-  fn get_right(addr: u64) -> u64;
-  fn get_cstr(addr: u64, idx: u32) -> u64;
+// Borrowed view of a C CMD tree:  nothing is copied or allocated, and the
+// strings are handed out as the C strings they are (not necessarily UTF-8)
+#[derive(Clone, Copy)]
+pub struct CMD<'a> {
+  raw: &'a RawCMD,
 }
 
-fn cstr2String(addr: u64) -> Option<String> {
-  if addr == 0 { return None; }
-  let c_buf: *const c_char = addr as *const c_char;
-  let c_str: &CStr = unsafe { CStr::from_ptr(c_buf) };
-  let str_slice: &str = c_str.to_str().unwrap();
-  Some(str_slice.to_owned())
+// Borrowed view of a C array of strings such as argv
+#[derive(Clone, Copy)]
+pub struct CStrArray<'a> {
+  ptrs: &'a [*mut c_char],
 }
 
-fn get_cstr_array(n: u32, addr: u64) -> Vec<Option<String>> {
-  let mut vec: Vec<Option<String>> = Vec::with_capacity(n as usize);
-  for i in 0..n {
-    vec.push(cstr2String(unsafe { get_cstr(addr, i) }));
+fn opt_cstr<'a>(p: *const c_char) -> Option<&'a CStr> {
+  if p.is_null() { None } else { Some(unsafe { CStr::from_ptr(p) }) }
+}
+
+impl<'a> CStrArray<'a> {
+  // The N strings at P (none if P is NULL)
+  unsafe fn new(p: *mut *mut c_char, n: c_int) -> CStrArray<'a> {
+    let ptrs: &'a [*mut c_char] =
+      if p.is_null() || n <= 0 { &[] } else { slice::from_raw_parts(p, n as usize) };
+    CStrArray { ptrs: ptrs }
+  }
+
+  pub fn len(&self) -> usize { self.ptrs.len() }
+  pub fn is_empty(&self) -> bool { self.ptrs.is_empty() }
+
+  // String I (None if it is out of range or NULL)
+  pub fn get(&self, i: usize) -> Option<&'a CStr> {
+    self.ptrs.get(i).and_then(|&p| opt_cstr(p))
+  }
+
+  pub fn iter(&self) -> impl Iterator<Item = &'a CStr> + 'a {
+    self.ptrs.iter().filter_map(|&p| opt_cstr(p))
+  }
+
+  // The strings as byte slices (without their NULs)
+  pub fn bytes(&self) -> impl Iterator<Item = &'a [u8]> + 'a {
+    self.iter().map(|s| s.to_bytes())
   }
-  vec
 }
 
-fn translate(raw_CMD: u64) -> Option<Arc<CMD>> {
-  if raw_CMD == 0 { return None; }
-  let node = unsafe { get_type(raw_CMD) };
-  let argc = unsafe { get_argc(raw_CMD) };
-  let argv = get_cstr_array(argc, unsafe { get_argv(raw_CMD) });
-  let nLocal = unsafe { get_nLocal(raw_CMD) };
-  let locVar = get_cstr_array(nLocal, unsafe { get_locVar(raw_CMD) });
-  let locVal = get_cstr_array(nLocal, unsafe { get_locVal(raw_CMD) });
-  let fromType = unsafe { get_fromType(raw_CMD) };
-  let fromFile = cstr2String(unsafe { get_fromFile(raw_CMD) });
-  let toType = unsafe { get_toType(raw_CMD) };
-  let toFile = cstr2String(unsafe { get_toFile(raw_CMD) });
-  let errType = unsafe { get_errType(raw_CMD) };
-  let errFile = cstr2String(unsafe { get_errFile(raw_CMD) });
-  let left = translate(unsafe { get_left(raw_CMD) });
-  let right = translate(unsafe { get_right(raw_CMD) });
-  Some(Arc::new(CMD {
-    node: node,
-    argc: argc,
-    argv: argv,
-    nLocal: nLocal,
-    locVar: locVar,
-    locVal: locVal,
-    fromType: fromType,
-    fromFile: fromFile,
-    toType: toType,
-    toFile: toFile,
-    errType: errType,
-    errFile: errFile,
-    left: left,
-    right: right,
-  }))
+impl<'a> CMD<'a> {
+  // View of the tree at P (None if P is NULL).  The tree must stay alive and
+  // unchanged for 'a, as it does for the duration of process().
+  pub unsafe fn from_ptr(p: *const RawCMD) -> Option<CMD<'a>> {
+    p.as_ref().map(|raw| CMD { raw: raw })
+  }
+
+  pub fn node(&self) -> u32 { self.raw.node as u32 }
+  pub fn argc(&self) -> usize { self.argv().len() }
+  pub fn argv(&self) -> CStrArray<'a> { unsafe { CStrArray::new(self.raw.argv, self.raw.argc) } }
+  pub fn nLocal(&self) -> usize { self.locVar().len() }
+  pub fn locVar(&self) -> CStrArray<'a> { unsafe { CStrArray::new(self.raw.locVar, self.raw.nLocal) } }
+  pub fn locVal(&self) -> CStrArray<'a> { unsafe { CStrArray::new(self.raw.locVal, self.raw.nLocal) } }
+
+  // The local assignments as (name, value) pairs
+  pub fn locals(&self) -> impl Iterator<Item = (&'a CStr, &'a CStr)> + 'a {
+    self.locVar().iter().zip(self.locVal().iter())
+  }
+
+  pub fn fromType(&self) -> u32 { self.raw.fromType as u32 }
+  pub fn fromFile(&self) -> Option<&'a CStr> { opt_cstr(self.raw.fromFile) }
+  pub fn toType(&self) -> u32 { self.raw.toType as u32 }
+  pub fn toFile(&self) -> Option<&'a CStr> { opt_cstr(self.raw.toFile) }
+  pub fn errType(&self) -> u32 { self.raw.errType as u32 }
+  pub fn errFile(&self) -> Option<&'a CStr> { opt_cstr(self.raw.errFile) }
+  pub fn left(&self) -> Option<CMD<'a>> { unsafe { CMD::from_ptr(self.raw.left) } }
+  pub fn right(&self) -> Option<CMD<'a>> { unsafe { CMD::from_ptr(self.raw.right) } }
+
+  // The C struct itself, e.g. to pass back to C
+  pub fn as_ptr(&self) -> *const RawCMD { self.raw }
 }
 
 #[no_mangle]
-pub extern fn process(raw_CMD: u64) -> u32 {
-  if let Some(CMD) = translate(raw_CMD) {
-    r_process(CMD)
-  }
-  else {
-    0
+pub extern "C" fn process(raw_CMD: *const RawCMD) -> c_int {
+  match unsafe { CMD::from_ptr(raw_CMD) } {
+    Some(cmd) => r_process(cmd) as c_int,
+    None => 0,
   }
 }
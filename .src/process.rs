@@ -1,6 +1,6 @@
 use crate::*;
 
-pub fn r_process(_cmdList: Arc<CMD>) -> u32 {
+pub fn r_process(_cmdList: CMD) -> u32 {
     println!("enter r_process");        // please remove this line and write your code here
     0
 }
@@ -0,0 +1,348 @@
+// admit.c
+//
+// Pressure-aware admission of background jobs.
+#include "process.h"
+#include "admit.h"
+#include "dirstack.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
+
+// How often the shell looks at the pressure while jobs are queued
+#define ADMIT_POLL_MS 100
+
+// Structure for a job waiting in the queue, with the state of the shell
+// when it was queued, in which it runs
+typedef struct Queued {
+    CMD *cmd;                   // Its command (a copy)
+    char *text;                 // What jobs shows for it
+    int64_t since;              // When it was queued
+    int cwd;                    // Open on the working directory (or -1)
+    char **env;                 // Copy of the environment
+    int status;                 // $?
+} Queued;
+
+// The queue, oldest job first; it lives in the shell, which forks a job
+// only once it is admitted
+static Queued *queue = NULL;
+static int nqueued = 0;
+static int queue_cap = 0;
+static bool queue_off = false;          // In a child of the shell
+
+// Statistics
+static int64_t last_start = 0;          // When a queued job last started
+static unsigned long started = 0;       // Jobs started
+static unsigned long delayed = 0;       // Jobs that had to wait
+static unsigned long forced = 0;        // Jobs started at the wait limit
+static int64_t wait_total = 0;          // Time spent waiting
+static int64_t wait_max = 0;            // Longest wait
+
+// Thresholds (0 if off); set by admit_prepare()
+static double cpu_limit = 80;
+static double mem_limit = 20;
+static double load_limit = 2;
+static int64_t interval_ns = 1000000000;
+static int64_t max_wait_ns = 0;
+
+// Function to return the current CLOCK_MONOTONIC time in nanoseconds
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Function to set *VALUE from environment variable NAME if it is a number
+// that is not negative
+static void env_number(const char *name, double *value)
+{
+    const char *s = getenv(name);
+    if (s && *s)
+    {
+        char *end;
+        double v = strtod(s, &end);
+        if (*end == '\0' && v >= 0)
+        {
+            *value = v;
+        }
+    }
+}
+
+// Function to read the thresholds
+void admit_prepare(void)
+{
+    double cpu = 80, mem = 20, load = 2, interval = 1000, max_wait = 0;
+    env_number("BSH_ADMIT_CPU", &cpu);
+    env_number("BSH_ADMIT_MEM", &mem);
+    env_number("BSH_ADMIT_LOAD", &load);
+    env_number("BSH_ADMIT_INTERVAL", &interval);
+    env_number("BSH_ADMIT_MAX_WAIT", &max_wait);
+    cpu_limit = cpu;
+    mem_limit = mem;
+    load_limit = load;
+    interval_ns = (int64_t) (interval * 1e6);
+    max_wait_ns = (int64_t) (max_wait * 1e9);
+}
+
+// Function to return the "some avg10" value in PSI file PATH (-1 if there
+// is none, as on a kernel without PSI)
+static double psi_some(const char *path)
+{
+    FILE *fp = fopen(path, "re");
+    if (!fp)
+    {
+        return -1;
+    }
+    double avg10 = -1;
+    if (fscanf(fp, "some avg10=%lf", &avg10) != 1)
+    {
+        avg10 = -1;
+    }
+    fclose(fp);
+    return avg10;
+}
+
+// Function to return the 1-minute load average per CPU (-1 if unknown)
+static double load_per_cpu(void)
+{
+    double load[1];
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (getloadavg(load, 1) != 1 || ncpu < 1)
+    {
+        return -1;
+    }
+    return load[0] / ncpu;
+}
+
+// Function to check whether the host is below every threshold
+static bool admit_room(void)
+{
+    return (cpu_limit <= 0 || psi_some("/proc/pressure/cpu") < cpu_limit)
+        && (mem_limit <= 0 || psi_some("/proc/pressure/memory") < mem_limit)
+        && (load_limit <= 0 || load_per_cpu() < load_limit);
+}
+
+// Function to check whether admission control is on
+static bool admit_on(void)
+{
+    return cpu_limit > 0 || mem_limit > 0 || load_limit > 0;
+}
+
+// Function to return a copy of the environment (NULL on error)
+static char **env_save(void)
+{
+    size_t n = 0;
+    while (environ[n])
+    {
+        n++;
+    }
+    char **env = calloc(n + 1, sizeof(*env));
+    for (size_t i = 0; env && i < n; i++)
+    {
+        if (!(env[i] = strdup(environ[i])))
+        {
+            while (i > 0)
+            {
+                free(env[--i]);
+            }
+            free(env);
+            env = NULL;
+        }
+    }
+    return env;
+}
+
+// Function to free queued job Q
+static void queued_free(Queued *q)
+{
+    freeCMD(q->cmd);
+    free(q->text);
+    if (q->cwd >= 0)
+    {
+        close(q->cwd);
+    }
+    for (char **e = q->env; e && *e; e++)
+    {
+        free(*e);
+    }
+    free(q->env);
+}
+
+// Function to run queued job ARG (in its child), first putting back the
+// working directory, environment and $? that the shell had when it was
+// queued
+static int admit_run(const void *arg)
+{
+    const Queued *q = arg;
+    if (q->cwd >= 0 && fchdir(q->cwd) < 0)
+    {
+        perror("fchdir");
+        return errno;
+    }
+    environ = q->env;
+    dirstack_swap(NULL);                // Set up again from $PWD
+    update_status(q->status);
+    return process(q->cmd);
+}
+
+// Function to start or queue job CMD
+pid_t admit_start(const CMD *cmd, const char *text, int *position)
+{
+    if (queue_off || !admit_on() || (nqueued == 0 && admit_room()))
+    {
+        started++;
+        return fork_background(run_process, cmd, text);
+    }
+
+    if (nqueued == queue_cap)
+    {
+        int cap = queue_cap ? 2 * queue_cap : 16;
+        Queued *q = realloc(queue, cap * sizeof(*q));
+        if (!q)
+        {
+            return -1;
+        }
+        queue = q;
+        queue_cap = cap;
+    }
+    Queued *q = &queue[nqueued];
+    q->cmd = copyCMD(cmd);
+    q->text = strdup(text);
+    q->since = now_ns();
+    q->cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    q->env = env_save();
+    q->status = last_status();
+    if (!q->cmd || !q->text || !q->env)
+    {
+        queued_free(q);
+        errno = ENOMEM;
+        return -1;
+    }
+    delayed++;
+    *position = ++nqueued;
+    return 0;
+}
+
+// Function to start the queued jobs that the host has room for
+int admit_poll(void)
+{
+    while (nqueued > 0 && !queue_off)
+    {
+        // Only the first job in the queue is considered, and only one per
+        // interval, so that the pressure that one adds shows before the
+        // next is let in
+        Queued *q = &queue[0];
+        int64_t now = now_ns();
+        bool force = max_wait_ns > 0 && now - q->since >= max_wait_ns;
+        if (!force && (now - last_start < interval_ns || !admit_room()))
+        {
+            return ADMIT_POLL_MS;
+        }
+
+        forced += force;
+        last_start = now;
+        int64_t waited = now - q->since;
+        wait_total += waited;
+        if (waited > wait_max)
+        {
+            wait_max = waited;
+        }
+
+        Queued job = *q;
+        memmove(queue, queue + 1, --nqueued * sizeof(*queue));
+        started++;
+        pid_t pid = fork_background(admit_run, &job, job.text);
+        if (pid > 0)
+        {
+            fprintf(stderr, "Backgrounded: %d\n", pid);
+        }
+        queued_free(&job);
+    }
+    return -1;
+}
+
+// Function to wait until FD is readable, starting queued jobs meanwhile
+void admit_idle(int fd)
+{
+    int ms;
+    while ((ms = admit_poll()) >= 0)
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, ms) > 0)
+        {
+            return;
+        }
+    }
+}
+
+// Function to start every queued job before the shell exits
+void admit_drain(void)
+{
+    int ms;
+    while ((ms = admit_poll()) >= 0)
+    {
+        poll(NULL, 0, ms);
+    }
+}
+
+// Function to leave the queue to the shell in a child of it
+void admit_child(void)
+{
+    queue_off = true;
+}
+
+// Function to list the queued jobs
+void admit_list(void)
+{
+    for (int i = 0; i < nqueued && !queue_off; i++)
+    {
+        char state[32];
+        snprintf(state, sizeof(state), "Queued(%d)", i + 1);
+        fprintf(BSTDOUT, "[-]   %-22s  %s\n", state, queue[i].text);
+    }
+}
+
+// Function to print threshold NAME, LIMIT and the current VALUE
+static void print_limit(const char *name, double limit, double value)
+{
+    fprintf(BSTDOUT, "%-7s", name);
+    if (value < 0)
+    {
+        fprintf(BSTDOUT, " %8s", "n/a");
+    }
+    else
+    {
+        fprintf(BSTDOUT, " %8.2f", value);
+    }
+    if (limit > 0)
+    {
+        fprintf(BSTDOUT, "  limit %g\n", limit);
+    }
+    else
+    {
+        fprintf(BSTDOUT, "  %s\n", "off");
+    }
+}
+
+// Function to handle admit
+int builtin_admit(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        WARN("%s\n", "admit: usage: admit");
+        return 1;
+    }
+
+    admit_prepare();
+    print_limit("cpu", cpu_limit, psi_some("/proc/pressure/cpu"));
+    print_limit("memory", mem_limit, psi_some("/proc/pressure/memory"));
+    print_limit("load", load_limit, load_per_cpu());
+
+    fprintf(BSTDOUT, "queued %d  started %lu  delayed %lu  forced %lu"
+            "  wait avg/max %.3f/%.3f s\n",
+            queue_off ? 0 : nqueued, started, delayed, forced,
+            delayed ? wait_total / 1e9 / delayed : 0.0, wait_max / 1e9);
+    fflush(BSTDOUT);
+    return 0;
+}
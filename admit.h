@@ -0,0 +1,62 @@
+// admit.h
+//
+// Admission control for background jobs.  A job started with & runs only
+// when the host has room for it:  while CPU or memory pressure (Linux PSI,
+// the "some avg10" line of /proc/pressure/cpu and /proc/pressure/memory) or
+// the 1-minute load average per CPU is above its threshold, the job waits
+// in a queue in the shell, which forks it once it is admitted.  Queued jobs
+// start in the order they were queued, one per interval, so that the
+// pressure that each one adds shows before the next is let in.  A queued
+// job runs in the working directory and with the environment and $? that
+// the shell had at the &, not at its start (its directory stack holds just
+// that directory).
+//
+//   $BSH_ADMIT_CPU       CPU pressure threshold in percent (default 80)
+//   $BSH_ADMIT_MEM       Memory pressure threshold in percent (default 20)
+//   $BSH_ADMIT_LOAD      Load average per CPU threshold (default 2)
+//   $BSH_ADMIT_INTERVAL  Least time between queued starts (default 1000 ms)
+//   $BSH_ADMIT_MAX_WAIT  Start a queued job anyway after this long (in
+//                        seconds; default 0, no limit)
+//
+// A threshold of 0 turns its check off.  A job that finds no job queued and
+// the host below every threshold starts without delay.  The shell looks at
+// the pressure every 100 ms while it waits for input or for a foreground
+// job, jobs lists the queued jobs by their place in the queue, and the
+// shell starts any that are left before it exits.  A subshell starts its
+// own background jobs at once.
+
+#ifndef ADMIT_INCLUDED
+#define ADMIT_INCLUDED
+
+#include <sys/types.h>
+
+// Read the thresholds; called by the shell before it starts a job with &
+void admit_prepare(void);
+
+// Start job CMD, which jobs lists as TEXT, in the background or queue it;
+// returns its pid, 0 if it was queued (with its place in the queue in
+// *POSITION), or -1 on error
+pid_t admit_start(const CMD *cmd, const char *text, int *position);
+
+// Start the queued jobs that the host has room for; returns how long (in
+// ms) to wait before calling again, or -1 if no job is queued
+int admit_poll(void);
+
+// Wait until descriptor FD is readable, starting queued jobs meanwhile
+void admit_idle(int fd);
+
+// Start all queued jobs as the host has room for them
+void admit_drain(void);
+
+// In a child of the shell:  leave the queue to the shell
+void admit_child(void);
+
+// List the queued jobs as jobs does
+void admit_list(void);
+
+// Handle the admit builtin:  admit
+// List the thresholds, the current pressure, and the queued and started
+// counts
+int builtin_admit(int argc, char **argv);
+
+#endif
@@ -0,0 +1,305 @@
+// ahead.c
+//
+// Read-ahead thread for scripts.
+#include "process.h"
+#include "ahead.h"
+#include "expand.h"
+#include "capture.h"
+#include "prefetch.h"
+#include <pthread.h>
+#include <sys/stat.h>
+
+// Default number of lines to read ahead
+#define AHEAD_LINES 8
+
+// Size of the blocks read by the thread
+#define AHEAD_BLOCK 65536
+
+// Structure for a line that has been read ahead
+typedef struct AheadLine {
+    char *line;             // The line (with its newline)
+    size_t len;             // Its length
+    off_t end;              // Offset of the next line
+    CMD *tree;              // Its parsed tree (NULL if not parsed)
+} AheadLine;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t more;    // Signalled when a line has been added
+    pthread_cond_t room;    // Signalled when the thread may read on
+    AheadLine *queue;       // Lines read ahead (a ring)
+    int size;               // Size of the ring
+    int head;               // Index of the oldest line
+    int count;              // Number of lines in the ring
+    off_t next;             // Offset where the thread reads the next line
+    off_t expect;           // Offset of stdin after the last line returned
+    unsigned long gen;      // Incremented when the read-ahead restarts
+    bool eof;               // The thread has reached end of file
+    bool failed;            // or could not read on (lines are read directly)
+    bool paused;            // The thread waits for a here document to run
+} ahead = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+            PTHREAD_COND_INITIALIZER };
+
+// Structure for the block of the script that the thread has read
+typedef struct Block {
+    char *buf;              // Its contents
+    off_t off;              // Offset of buf[0]
+    size_t len;             // Bytes in buf
+    size_t cap;             // Allocated size
+} Block;
+
+// Function to copy the LEN bytes at S into a new string *LINE; returns LEN or
+// -1 if out of memory
+static ssize_t copy_line(const char *s, size_t len, char **line)
+{
+    *line = malloc(len + 1);
+    if (!*line)
+    {
+        return -1;
+    }
+    memcpy(*line, s, len);
+    (*line)[len] = '\0';
+    return len;
+}
+
+// Function to read the line at offset OFF into a new string through block
+// B; returns its length (0 at end of file) or -1 on error
+static ssize_t read_line(Block *b, off_t off, char **line)
+{
+    // Keep the block only if it contains OFF
+    if (off < b->off || off > b->off + (off_t) b->len)
+    {
+        b->off = off;
+        b->len = 0;
+    }
+
+    for (;;)
+    {
+        size_t start = off - b->off;
+        char *nl = (b->len > start) ? memchr(b->buf + start, '\n', b->len - start) : NULL;
+        if (nl)
+        {
+            return copy_line(b->buf + start, nl + 1 - (b->buf + start), line);
+        }
+
+        // Drop what has been used and read another block after the rest
+        memmove(b->buf, b->buf + start, b->len - start);
+        b->len -= start;
+        b->off = off;
+        if (b->cap - b->len < AHEAD_BLOCK)
+        {
+            char *buf = realloc(b->buf, b->len + 2 * AHEAD_BLOCK);
+            if (!buf)
+            {
+                return -1;
+            }
+            b->buf = buf;
+            b->cap = b->len + 2 * AHEAD_BLOCK;
+        }
+        ssize_t r = pread(STDIN_FILENO, b->buf + b->len, b->cap - b->len,
+                          b->off + b->len);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r < 0)
+        {
+            return -1;
+        }
+        if (r == 0)
+        {
+            // The last line may lack a newline
+            return copy_line(b->buf, b->len, line);
+        }
+        b->len += r;
+    }
+}
+
+// Function to return true if LINE may have a here document
+static bool has_here(const char *line)
+{
+    return strstr(line, "<<") != NULL;
+}
+
+// Function to parse LINE, returning NULL if it fails; the diagnostics are
+// dropped, since the line is parsed again when it is reached
+static CMD *parse_ahead(char *line)
+{
+    capture_start();
+    token *list = tokenize(line);
+    CMD *cmd = list ? parse(list) : NULL;
+    freeList(list);
+    size_t len;
+    capture_stop(&len);
+    if (cmd && len > 0)
+    {
+        freeCMD(cmd);
+        cmd = NULL;
+    }
+    return cmd;
+}
+
+// Function to run the read-ahead thread
+static void *ahead_main(void *arg)
+{
+    Block block = { NULL, 0, 0, 0 };
+
+    for (;;)
+    {
+        pthread_mutex_lock(&ahead.lock);
+        while (ahead.count == ahead.size || ahead.eof || ahead.paused)
+        {
+            pthread_cond_wait(&ahead.room, &ahead.lock);
+        }
+        unsigned long gen = ahead.gen;
+        off_t off = ahead.next;
+        pthread_mutex_unlock(&ahead.lock);
+
+        char *line = NULL;
+        ssize_t len = read_line(&block, off, &line);
+        bool here = len > 0 && has_here(line);
+        CMD *tree = (len > 0 && !here && expand_static(line)) ? parse_ahead(line) : NULL;
+        if (tree)
+        {
+            prefetch_command(tree);
+        }
+
+        pthread_mutex_lock(&ahead.lock);
+        if (gen != ahead.gen)
+        {
+            // Restarted meanwhile:  the line may not be the right one
+            pthread_mutex_unlock(&ahead.lock);
+            free(line);
+            if (tree)
+            {
+                freeCMD(tree);
+            }
+            continue;
+        }
+        if (len <= 0)
+        {
+            free(line);
+            ahead.eof = true;
+            ahead.failed = (len < 0);
+        }
+        else
+        {
+            int tail = (ahead.head + ahead.count) % ahead.size;
+            ahead.queue[tail] = (AheadLine) { line, len, off + len, tree };
+            ahead.count++;
+            ahead.next = off + len;
+            ahead.paused = here;
+        }
+        pthread_cond_signal(&ahead.more);
+        pthread_mutex_unlock(&ahead.lock);
+    }
+    return NULL;
+}
+
+// Function to start reading ahead
+bool ahead_start(void)
+{
+    const char *env = getenv("BSH_PARSE_AHEAD");
+    int size = env ? atoi(env) : AHEAD_LINES;
+    struct stat st;
+    if (size <= 0 || fstat(STDIN_FILENO, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        return false;
+    }
+    if (capture_install() < 0)
+    {
+        return false;
+    }
+
+    off_t off = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    ahead.queue = calloc(size, sizeof(*ahead.queue));
+    ahead.size = size;
+    ahead.next = ahead.expect = off;
+
+    prefetch_start();
+
+    // The thread takes no signals; they belong to the main thread
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+    pthread_t thread;
+    int rc = pthread_create(&thread, NULL, ahead_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (rc != 0)
+    {
+        free(ahead.queue);
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+// Function to return the next line
+ssize_t ahead_getline(char **line, size_t *n, CMD **cmd)
+{
+    *cmd = NULL;
+    off_t off = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    clearerr(stdin);
+
+    pthread_mutex_lock(&ahead.lock);
+
+    // If the last line (or parse() reading its here document) moved stdin,
+    // what was read ahead is not what comes next
+    if (off != ahead.expect)
+    {
+        for ( ; ahead.count > 0; ahead.count--)
+        {
+            AheadLine *l = &ahead.queue[ahead.head];
+            free(l->line);
+            if (l->tree)
+            {
+                freeCMD(l->tree);
+            }
+            ahead.head = (ahead.head + 1) % ahead.size;
+        }
+        ahead.next = ahead.expect = off;
+        ahead.gen++;
+        ahead.eof = ahead.failed = false;
+    }
+
+    // Any here document has been read by now
+    ahead.paused = false;
+    pthread_cond_signal(&ahead.room);
+
+    while (ahead.count == 0 && !ahead.eof)
+    {
+        pthread_cond_wait(&ahead.more, &ahead.lock);
+    }
+    if (ahead.count == 0)
+    {
+        // After an error, stdin is still just past the last line returned
+        bool failed = ahead.failed;
+        pthread_mutex_unlock(&ahead.lock);
+        return failed ? getline(line, n, stdin) : -1;
+    }
+
+    AheadLine l = ahead.queue[ahead.head];
+    ahead.head = (ahead.head + 1) % ahead.size;
+    ahead.count--;
+    ahead.expect = l.end;
+    pthread_cond_signal(&ahead.room);
+    pthread_mutex_unlock(&ahead.lock);
+
+    // The line's commands see stdin just past it
+    lseek(STDIN_FILENO, l.end, SEEK_SET);
+
+    if (*n < l.len + 1)
+    {
+        // Hand over the thread's copy rather than grow the caller's
+        free(*line);
+        *line = l.line;
+        *n = l.len + 1;
+    }
+    else
+    {
+        memcpy(*line, l.line, l.len + 1);
+        free(l.line);
+    }
+    *cmd = l.tree;
+    return l.len;
+}
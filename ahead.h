@@ -0,0 +1,33 @@
+// ahead.h
+//
+// Parse-ahead for scripts.  When the shell reads its commands from a regular
+// file on stdin, a thread reads the next lines ($BSH_PARSE_AHEAD, default 8)
+// and tokenizes and parses those whose parse cannot depend on what earlier
+// lines do, while the shell runs the current line.  A line that contains an
+// expansion is only read ahead; it is expanded and parsed when it is reached.
+// A line with a here document stops the read-ahead until it has run, since
+// parse() reads the body from stdin.
+//
+// The read-ahead uses pread(), and the offset of stdin is set to the end of
+// each line before it runs, so commands that read stdin see the rest of the
+// script just as they would without it.  If one of them reads some of it,
+// the lines read ahead are discarded and the read-ahead starts again from
+// where the command stopped.  If the thread fails to read a line (e.g., out
+// of memory), the line is read directly instead.
+
+#ifndef AHEAD_INCLUDED
+#define AHEAD_INCLUDED
+
+#include <sys/types.h>
+
+// Start reading ahead if stdin is a regular file and $BSH_PARSE_AHEAD is not
+// 0; returns true if it was started
+bool ahead_start(void);
+
+// Like getline(LINE, N, stdin):  store the next line of the script in *LINE
+// (reallocated as needed to *N bytes) and return its length (-1 at end of
+// file).  *CMD is set to its parsed tree (which the caller frees), or to NULL
+// if the line still has to be expanded and parsed.
+ssize_t ahead_getline(char **line, size_t *n, CMD **cmd);
+
+#endif
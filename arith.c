@@ -0,0 +1,616 @@
+// arith.c
+//
+// Parser, evaluator and parse cache for shell arithmetic:  the C integer
+// operators (including ?:, the comma operator, ++/-- and the assignment
+// operators) plus ** for exponentiation, over 64-bit signed integers.
+#include "process.h"
+#include "arith.h"
+#include <ctype.h>
+
+// Number of slots in the direct-mapped parse cache
+#define ARITH_CACHE_SIZE 256
+
+// Maximum nesting of variables whose values are themselves expressions
+#define ARITH_MAX_DEPTH 32
+
+// Node types of an expression tree (binary operators use their token type)
+enum {
+    A_NUM, A_VAR, A_NEG, A_POS, A_NOT, A_BNOT,
+    A_PREINC, A_PREDEC, A_POSTINC, A_POSTDEC,
+    A_COND, A_ASSIGN, A_COMMA,
+
+    // Binary operators, also used as token types by the lexer
+    A_OR, A_AND, A_BOR, A_BXOR, A_BAND, A_EQ, A_NE, A_LT, A_LE, A_GT, A_GE,
+    A_SHL, A_SHR, A_ADD, A_SUB, A_MUL, A_DIV, A_MOD, A_POW,
+
+    // Other token types
+    T_END, T_NUM, T_IDENT, T_LPAR, T_RPAR, T_QUEST, T_COLON, T_COMMA,
+    T_NOT, T_BNOT, T_INC, T_DEC, T_ASSIGN
+};
+
+// Structure for one node of an expression tree
+typedef struct ArithNode {
+    int type;                   // A_NUM, A_VAR, operator, ...
+    int op;                     // Binary operator of A_ASSIGN (0 for =)
+    long long value;            // Value of A_NUM
+    char *name;                 // Variable name of A_VAR, ++/-- and A_ASSIGN
+    struct ArithNode *a, *b, *c;
+} ArithNode;
+
+// Structure for one operator recognized by the lexer
+typedef struct ArithOp {
+    const char *text;
+    int type;
+    int prec;                   // Binary precedence (0 if not binary)
+} ArithOp;
+
+// Longest operators first so that the lexer is greedy
+static const ArithOp arith_ops[] = {
+    { "<<=", T_ASSIGN, 0 }, { ">>=", T_ASSIGN, 0 },
+    { "**",  A_POW,   11 }, { "<<",  A_SHL,    8 }, { ">>",  A_SHR,    8 },
+    { "<=",  A_LE,     7 }, { ">=",  A_GE,     7 }, { "==",  A_EQ,     6 },
+    { "!=",  A_NE,     6 }, { "&&",  A_AND,    2 }, { "||",  A_OR,     1 },
+    { "++",  T_INC,    0 }, { "--",  T_DEC,    0 },
+    { "+=",  T_ASSIGN, 0 }, { "-=",  T_ASSIGN, 0 }, { "*=",  T_ASSIGN, 0 },
+    { "/=",  T_ASSIGN, 0 }, { "%=",  T_ASSIGN, 0 }, { "&=",  T_ASSIGN, 0 },
+    { "^=",  T_ASSIGN, 0 }, { "|=",  T_ASSIGN, 0 },
+    { "*",   A_MUL,   10 }, { "/",   A_DIV,   10 }, { "%",   A_MOD,   10 },
+    { "+",   A_ADD,    9 }, { "-",   A_SUB,    9 }, { "<",   A_LT,     7 },
+    { ">",   A_GT,     7 }, { "&",   A_BAND,   5 }, { "^",   A_BXOR,   4 },
+    { "|",   A_BOR,    3 }, { "=",   T_ASSIGN, 0 }, { "!",   T_NOT,    0 },
+    { "~",   T_BNOT,   0 }, { "(",   T_LPAR,   0 }, { ")",   T_RPAR,   0 },
+    { "?",   T_QUEST,  0 }, { ":",   T_COLON,  0 }, { ",",   T_COMMA,  0 },
+    { NULL,  0,        0 }
+};
+
+// State of the lexer and parser
+typedef struct ArithParser {
+    const char *expr;           // Whole expression (for diagnostics)
+    const char *p;              // Next unread character
+    int tok;                    // Type of current token
+    const ArithOp *op;          // Operator of current token (if any)
+    long long value;            // Value of current T_NUM
+    char *name;                 // Text of current T_IDENT
+    const char *error;          // First error found (NULL if none)
+} ArithParser;
+
+// Structure for one slot in the parse cache
+typedef struct ArithCache {
+    char *text;                 // Expression text (NULL if slot unused)
+    ArithNode *tree;            // Its parse tree
+} ArithCache;
+
+static ArithCache arith_cache[ARITH_CACHE_SIZE];
+
+static ArithNode *parse_comma(ArithParser *ap);
+static int eval_node(const ArithNode *n, long long *result, int depth);
+
+// Function to free expression tree N
+static void free_node(ArithNode *n)
+{
+    if (!n)
+    {
+        return;
+    }
+    free_node(n->a);
+    free_node(n->b);
+    free_node(n->c);
+    free(n->name);
+    free(n);
+}
+
+// Function to allocate a node of type TYPE with children A, B, C
+static ArithNode *new_node(int type, ArithNode *a, ArithNode *b, ArithNode *c)
+{
+    ArithNode *n = calloc(1, sizeof(*n));
+    if (!n)
+    {
+        perror("calloc");
+        exit(errno);
+    }
+    n->type = type;
+    n->a = a;
+    n->b = b;
+    n->c = c;
+    return n;
+}
+
+// Function to record the first syntax error MSG
+static void syntax_error(ArithParser *ap, const char *msg)
+{
+    if (!ap->error)
+    {
+        ap->error = msg;
+    }
+}
+
+// Function to read the next token into AP
+static void next_token(ArithParser *ap)
+{
+    free(ap->name);
+    ap->name = NULL;
+    ap->op = NULL;
+
+    while (isspace((unsigned char) *ap->p))
+    {
+        ap->p++;
+    }
+
+    const char *s = ap->p;
+    if (*s == '\0')
+    {
+        ap->tok = T_END;
+        return;
+    }
+
+    if (isdigit((unsigned char) *s))
+    {
+        char *end;
+        errno = 0;
+        ap->value = (long long) strtoull(s, &end, 0);
+        if (errno == ERANGE || isalnum((unsigned char) *end) || *end == '_')
+        {
+            syntax_error(ap, "invalid number");
+        }
+        ap->tok = T_NUM;
+        ap->p = end;
+        return;
+    }
+
+    if (isalpha((unsigned char) *s) || *s == '_')
+    {
+        size_t len = strspn(s, VARCHR);
+        ap->name = strndup(s, len);
+        ap->tok = T_IDENT;
+        ap->p = s + len;
+        return;
+    }
+
+    for (const ArithOp *op = arith_ops; op->text; op++)
+    {
+        size_t len = strlen(op->text);
+        if (strncmp(s, op->text, len) == 0)
+        {
+            ap->tok = op->type;
+            ap->op = op;
+            ap->p = s + len;
+            return;
+        }
+    }
+
+    syntax_error(ap, "invalid character");
+    ap->tok = T_END;
+}
+
+// Function to parse a primary:  number, variable (with postfix ++/--), or
+// parenthesized expression
+static ArithNode *parse_primary(ArithParser *ap)
+{
+    if (ap->tok == T_NUM)
+    {
+        ArithNode *n = new_node(A_NUM, NULL, NULL, NULL);
+        n->value = ap->value;
+        next_token(ap);
+        return n;
+    }
+
+    if (ap->tok == T_IDENT)
+    {
+        ArithNode *n = new_node(A_VAR, NULL, NULL, NULL);
+        n->name = ap->name;
+        ap->name = NULL;
+        next_token(ap);
+        if (ap->tok == T_INC || ap->tok == T_DEC)
+        {
+            n->type = (ap->tok == T_INC) ? A_POSTINC : A_POSTDEC;
+            next_token(ap);
+        }
+        return n;
+    }
+
+    if (ap->tok == T_LPAR)
+    {
+        next_token(ap);
+        ArithNode *n = parse_comma(ap);
+        if (ap->tok != T_RPAR)
+        {
+            syntax_error(ap, "missing `)'");
+        }
+        next_token(ap);
+        return n;
+    }
+
+    syntax_error(ap, "operand expected");
+    return new_node(A_NUM, NULL, NULL, NULL);
+}
+
+// Function to parse a unary expression
+static ArithNode *parse_unary(ArithParser *ap)
+{
+    int type;
+    switch (ap->tok)
+    {
+        case A_SUB:  type = A_NEG;  break;
+        case A_ADD:  type = A_POS;  break;
+        case T_NOT:  type = A_NOT;  break;
+        case T_BNOT: type = A_BNOT; break;
+        case T_INC:
+        case T_DEC:
+        {
+            type = (ap->tok == T_INC) ? A_PREINC : A_PREDEC;
+            next_token(ap);
+            if (ap->tok != T_IDENT)
+            {
+                syntax_error(ap, "identifier expected after ++ or --");
+                return new_node(A_NUM, NULL, NULL, NULL);
+            }
+            ArithNode *n = new_node(type, NULL, NULL, NULL);
+            n->name = ap->name;
+            ap->name = NULL;
+            next_token(ap);
+            return n;
+        }
+        default:
+            return parse_primary(ap);
+    }
+
+    next_token(ap);
+    return new_node(type, parse_unary(ap), NULL, NULL);
+}
+
+// Function to parse binary operators of precedence MIN_PREC or higher
+// (by precedence climbing; ** is right-associative, the rest left)
+static ArithNode *parse_binary(ArithParser *ap, int min_prec)
+{
+    ArithNode *lhs = parse_unary(ap);
+
+    while (ap->op && ap->op->prec >= min_prec && !ap->error)
+    {
+        int type = ap->tok;
+        int prec = ap->op->prec;
+        next_token(ap);
+        ArithNode *rhs = parse_binary(ap, type == A_POW ? prec : prec + 1);
+        lhs = new_node(type, lhs, rhs, NULL);
+    }
+    return lhs;
+}
+
+// Function to parse:  binary ? comma : conditional
+static ArithNode *parse_cond(ArithParser *ap)
+{
+    ArithNode *n = parse_binary(ap, 1);
+    if (ap->tok != T_QUEST)
+    {
+        return n;
+    }
+
+    next_token(ap);
+    ArithNode *then = parse_comma(ap);
+    if (ap->tok != T_COLON)
+    {
+        syntax_error(ap, "`:' expected for conditional expression");
+    }
+    next_token(ap);
+    return new_node(A_COND, n, then, parse_cond(ap));
+}
+
+// Function to parse:  IDENT assign-op assignment  or a conditional
+static ArithNode *parse_assign(ArithParser *ap)
+{
+    ArithNode *n = parse_cond(ap);
+    if (ap->tok != T_ASSIGN)
+    {
+        return n;
+    }
+
+    if (n->type != A_VAR)
+    {
+        syntax_error(ap, "attempted assignment to non-variable");
+        return n;
+    }
+
+    // Map "+=" etc. onto the binary operator that has the same prefix
+    int op = 0;
+    size_t len = strlen(ap->op->text) - 1;
+    for (const ArithOp *o = arith_ops; len > 0 && o->text; o++)
+    {
+        if (o->prec && strlen(o->text) == len
+            && strncmp(o->text, ap->op->text, len) == 0)
+        {
+            op = o->type;
+            break;
+        }
+    }
+
+    next_token(ap);
+    ArithNode *a = new_node(A_ASSIGN, parse_assign(ap), NULL, NULL);
+    a->op = op;
+    a->name = n->name;
+    n->name = NULL;
+    free_node(n);
+    return a;
+}
+
+// Function to parse:  assignment , assignment ...
+static ArithNode *parse_comma(ArithParser *ap)
+{
+    ArithNode *n = parse_assign(ap);
+    while (ap->tok == T_COMMA && !ap->error)
+    {
+        next_token(ap);
+        n = new_node(A_COMMA, n, parse_assign(ap), NULL);
+    }
+    return n;
+}
+
+// Function to parse EXPR into a tree; returns NULL after a diagnostic if it
+// contains a syntax error
+static ArithNode *arith_parse(const char *expr)
+{
+    ArithParser ap = { expr, expr, T_END, NULL, 0, NULL, NULL };
+
+    next_token(&ap);
+    if (ap.tok == T_END && !ap.error)
+    {
+        // The empty expression has value 0
+        return new_node(A_NUM, NULL, NULL, NULL);
+    }
+
+    ArithNode *n = parse_comma(&ap);
+    if (ap.tok != T_END)
+    {
+        syntax_error(&ap, "syntax error in expression");
+    }
+    free(ap.name);
+
+    if (ap.error)
+    {
+        WARN("%s: %s (error token is \"%s\")\n", expr, ap.error, ap.p);
+        free_node(n);
+        return NULL;
+    }
+    return n;
+}
+
+// Function to evaluate expression EXPR at variable nesting DEPTH, using the
+// cached tree for EXPR or parsing (and caching) it on a miss
+static int eval_expr(const char *expr, long long *result, int depth)
+{
+    if (depth > ARITH_MAX_DEPTH)
+    {
+        WARN("%s: expression recursion level exceeded\n", expr);
+        return -1;
+    }
+
+    unsigned long hash = 5381;
+    for (const char *s = expr; *s; s++)
+    {
+        hash = hash * 33 + (unsigned char) *s;
+    }
+
+    ArithCache *slot = &arith_cache[hash % ARITH_CACHE_SIZE];
+    if (slot->text && strcmp(slot->text, expr) == 0)
+    {
+        return eval_node(slot->tree, result, depth);
+    }
+
+    ArithNode *tree = arith_parse(expr);
+    if (!tree)
+    {
+        return -1;
+    }
+
+    // A variable's value is evaluated while an outer tree is still in use,
+    // so only the outermost expression may evict an occupied slot
+    if (slot->text && depth > 0)
+    {
+        int rc = eval_node(tree, result, depth);
+        free_node(tree);
+        return rc;
+    }
+
+    free(slot->text);
+    free_node(slot->tree);
+    slot->text = strdup(expr);
+    slot->tree = tree;
+    return eval_node(tree, result, depth);
+}
+
+// Function to read variable NAME as a number; unset and empty variables are
+// 0 and any other value is itself evaluated as an expression
+static int get_var(const char *name, long long *result, int depth)
+{
+    const char *value = getenv(name);
+    if (!value || !*value)
+    {
+        *result = 0;
+        return 0;
+    }
+    return eval_expr(value, result, depth + 1);
+}
+
+// Function to assign VALUE to variable NAME
+static int set_var(const char *name, long long value)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lld", value);
+    if (setenv(name, buf, 1) != 0)
+    {
+        perror("setenv");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to apply binary operator TYPE to X and Y; overflow wraps around
+// as in two's complement
+static int apply_binary(int type, long long x, long long y, long long *result)
+{
+    unsigned long long ux = x, uy = y;
+
+    switch (type)
+    {
+        case A_BOR:  *result = x | y;   break;
+        case A_BXOR: *result = x ^ y;   break;
+        case A_BAND: *result = x & y;   break;
+        case A_EQ:   *result = x == y;  break;
+        case A_NE:   *result = x != y;  break;
+        case A_LT:   *result = x < y;   break;
+        case A_LE:   *result = x <= y;  break;
+        case A_GT:   *result = x > y;   break;
+        case A_GE:   *result = x >= y;  break;
+        case A_SHL:  *result = (long long) (ux << (y & 63)); break;
+        case A_SHR:  *result = x >> (y & 63); break;
+        case A_ADD:  *result = (long long) (ux + uy); break;
+        case A_SUB:  *result = (long long) (ux - uy); break;
+        case A_MUL:  *result = (long long) (ux * uy); break;
+        case A_DIV:
+        case A_MOD:
+            if (y == 0)
+            {
+                WARN("%s\n", "division by 0");
+                return -1;
+            }
+            if (y == -1)
+            {
+                // Avoid the trap on LLONG_MIN / -1
+                *result = (type == A_DIV) ? (long long) (0 - ux) : 0;
+            }
+            else
+            {
+                *result = (type == A_DIV) ? x / y : x % y;
+            }
+            break;
+        case A_POW:
+        {
+            if (y < 0)
+            {
+                WARN("%s\n", "exponent less than 0");
+                return -1;
+            }
+            unsigned long long r = 1;
+            while (y)
+            {
+                if (y & 1)
+                {
+                    r *= ux;
+                }
+                ux *= ux;
+                y >>= 1;
+            }
+            *result = (long long) r;
+            break;
+        }
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+// Function to evaluate tree N at variable nesting DEPTH
+static int eval_node(const ArithNode *n, long long *result, int depth)
+{
+    long long x, y;
+
+    switch (n->type)
+    {
+        case A_NUM:
+            *result = n->value;
+            return 0;
+
+        case A_VAR:
+            return get_var(n->name, result, depth);
+
+        case A_NEG:
+        case A_POS:
+        case A_NOT:
+        case A_BNOT:
+            if (eval_node(n->a, &x, depth) != 0)
+            {
+                return -1;
+            }
+            *result = (n->type == A_NEG)  ? (long long) (0 - (unsigned long long) x)
+                    : (n->type == A_POS)  ? x
+                    : (n->type == A_NOT)  ? !x
+                    : ~x;
+            return 0;
+
+        case A_PREINC:
+        case A_PREDEC:
+        case A_POSTINC:
+        case A_POSTDEC:
+        {
+            if (get_var(n->name, &x, depth) != 0)
+            {
+                return -1;
+            }
+            bool inc = (n->type == A_PREINC || n->type == A_POSTINC);
+            y = (long long) ((unsigned long long) x + (inc ? 1 : -1));
+            *result = (n->type == A_PREINC || n->type == A_PREDEC) ? y : x;
+            return set_var(n->name, y);
+        }
+
+        case A_ASSIGN:
+            if (eval_node(n->a, &y, depth) != 0)
+            {
+                return -1;
+            }
+            if (n->op)
+            {
+                if (get_var(n->name, &x, depth) != 0
+                    || apply_binary(n->op, x, y, &y) != 0)
+                {
+                    return -1;
+                }
+            }
+            *result = y;
+            return set_var(n->name, y);
+
+        case A_COND:
+            if (eval_node(n->a, &x, depth) != 0)
+            {
+                return -1;
+            }
+            return eval_node(x ? n->b : n->c, result, depth);
+
+        case A_COMMA:
+            if (eval_node(n->a, &x, depth) != 0)
+            {
+                return -1;
+            }
+            return eval_node(n->b, result, depth);
+
+        case A_AND:
+        case A_OR:
+            // Short-circuit so that side effects on the right are skipped
+            if (eval_node(n->a, &x, depth) != 0)
+            {
+                return -1;
+            }
+            if ((n->type == A_AND) ? !x : x)
+            {
+                *result = (n->type == A_OR);
+                return 0;
+            }
+            if (eval_node(n->b, &y, depth) != 0)
+            {
+                return -1;
+            }
+            *result = (y != 0);
+            return 0;
+
+        default:
+            if (eval_node(n->a, &x, depth) != 0
+                || eval_node(n->b, &y, depth) != 0)
+            {
+                return -1;
+            }
+            return apply_binary(n->type, x, y, result);
+    }
+}
+
+// Function to evaluate arithmetic expression EXPR
+int arith_eval(const char *expr, long long *result)
+{
+    return eval_expr(expr, result, 0);
+}
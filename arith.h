@@ -0,0 +1,15 @@
+// arith.h
+//
+// 64-bit arithmetic evaluator used for $(( ... )) expansion.  Parsed
+// expressions are cached by their text, so a line that is evaluated over
+// and over is only parsed once.
+
+#ifndef ARITH_INCLUDED
+#define ARITH_INCLUDED
+
+// Evaluate arithmetic expression EXPR and store its value in *RESULT.
+// Variables are read from and assigned to the environment.  Return 0 on
+// success and -1 (after writing a diagnostic to stderr) on error.
+int arith_eval(const char *expr, long long *result);
+
+#endif
@@ -0,0 +1,799 @@
+// batch.c
+//
+// JSONL batch executor with a bounded pool of concurrent children.
+#include "process.h"
+#include "batch.h"
+#include "expand.h"
+#include "capture.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/signalfd.h>
+
+// Default limit on the output captured from each stream of a command
+#define BATCH_CAP 65536
+
+// Largest number of commands run at once
+#define BATCH_MAX_WIDTH 4096
+
+// Structure for the output captured from one stream of a command
+typedef struct Capture {
+    int fd;             // Read end of the pipe (-1 once closed)
+    char *buf;          // Captured bytes
+    size_t len;         // Number of bytes captured
+    size_t dropped;     // Number of bytes beyond the cap
+} Capture;
+
+// Structure for one record of the batch
+typedef struct BatchJob {
+    char *line;         // Command line (NULL if the record was invalid)
+    CMD *cmd;           // Parsed command (NULL on error)
+    const char *error;  // Why the record was not run (or NULL)
+    char *message;      // Diagnostics of a record that did not parse
+    pid_t pid;          // Child running the command (0 if none)
+    Capture out, err;   // Its stdout and stderr
+    struct timespec start;
+    double ms;          // Wall time in milliseconds
+    int status;
+    bool done;
+} BatchJob;
+
+static size_t batch_cap = BATCH_CAP;
+
+static BatchJob **active;       // Jobs started and not yet done
+static int nactive;             // Number of them
+static int chld_fd = -1;        // signalfd that reports their exits
+static sigset_t old_mask;       // Signal mask to restore in children
+
+// Function to append the N bytes at S to the string being built in *BUF
+// (of length *LEN and allocated size *CAP)
+static void str_putn(char **buf, size_t *len, size_t *cap, const char *s,
+                     size_t n)
+{
+    if (*len + n + 1 > *cap)
+    {
+        while (*len + n + 1 > *cap)
+        {
+            *cap = *cap ? 2 * *cap : 256;
+        }
+        REALLOC(*buf, *cap);
+        if (!*buf)
+        {
+            perror("realloc");
+            exit(errno);
+        }
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+}
+
+// Function to append the UTF-8 encoding of code point C
+static void str_put_utf8(char **buf, size_t *len, size_t *cap, unsigned c)
+{
+    char u[4];
+    size_t n;
+    if (c < 0x80)
+    {
+        u[0] = c;
+        n = 1;
+    }
+    else if (c < 0x800)
+    {
+        u[0] = 0xC0 | (c >> 6);
+        u[1] = 0x80 | (c & 0x3F);
+        n = 2;
+    }
+    else if (c < 0x10000)
+    {
+        u[0] = 0xE0 | (c >> 12);
+        u[1] = 0x80 | ((c >> 6) & 0x3F);
+        u[2] = 0x80 | (c & 0x3F);
+        n = 3;
+    }
+    else
+    {
+        u[0] = 0xF0 | (c >> 18);
+        u[1] = 0x80 | ((c >> 12) & 0x3F);
+        u[2] = 0x80 | ((c >> 6) & 0x3F);
+        u[3] = 0x80 | (c & 0x3F);
+        n = 4;
+    }
+    str_putn(buf, len, cap, u, n);
+}
+
+// Function to skip JSON whitespace
+static const char *json_space(const char *s)
+{
+    while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+    {
+        s++;
+    }
+    return s;
+}
+
+// Function to parse the JSON string at S (S[0] is '"'); returns the decoded
+// string and sets *END past it, or returns NULL if it is malformed
+static char *json_string(const char *s, const char **end)
+{
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+
+    str_putn(&buf, &len, &cap, "", 0);
+    for (s++; *s && *s != '"'; s++)
+    {
+        if (*s != '\\')
+        {
+            str_putn(&buf, &len, &cap, s, 1);
+            continue;
+        }
+        s++;
+        const char *esc = strchr("\"\\/bfnrt", *s);
+        if (*s && esc)
+        {
+            str_putn(&buf, &len, &cap, &"\"\\/\b\f\n\r\t"[esc - "\"\\/bfnrt"], 1);
+        }
+        else if (*s == 'u')
+        {
+            unsigned c;
+            if (sscanf(s + 1, "%4x", &c) != 1 || strspn(s + 1, "0123456789abcdefABCDEF") < 4)
+            {
+                break;
+            }
+            s += 4;
+            // Combine a surrogate pair
+            unsigned lo;
+            if (c >= 0xD800 && c < 0xDC00 && s[1] == '\\' && s[2] == 'u'
+                && sscanf(s + 3, "%4x", &lo) == 1 && lo >= 0xDC00 && lo < 0xE000)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+                s += 6;
+            }
+            str_put_utf8(&buf, &len, &cap, c);
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (*s != '"')
+    {
+        free(buf);
+        return NULL;
+    }
+    *end = s + 1;
+    return buf;
+}
+
+// Function to skip the JSON value at S; returns the end of the value or NULL
+// if it is malformed
+static const char *json_skip(const char *s)
+{
+    s = json_space(s);
+    if (*s == '"')
+    {
+        const char *end;
+        char *str = json_string(s, &end);
+        free(str);
+        return str ? end : NULL;
+    }
+    if (*s == '{' || *s == '[')
+    {
+        char close = (*s == '{') ? '}' : ']';
+        s = json_space(s + 1);
+        if (*s == close)
+        {
+            return s + 1;
+        }
+        for ( ; ; )
+        {
+            if (close == '}')
+            {
+                s = json_skip(s);
+                if (!s || *(s = json_space(s)) != ':')
+                {
+                    return NULL;
+                }
+                s++;
+            }
+            s = json_skip(s);
+            if (!s)
+            {
+                return NULL;
+            }
+            s = json_space(s);
+            if (*s == close)
+            {
+                return s + 1;
+            }
+            if (*s++ != ',')
+            {
+                return NULL;
+            }
+        }
+    }
+    size_t n = strspn(s, "-+.0123456789eEtruefalsn");
+    return n ? s + n : NULL;
+}
+
+// Function to extract the command line from JSON record REC; returns NULL
+// (with *ERROR set) if there is none
+static char *json_command(const char *rec, const char **error)
+{
+    const char *s = json_space(rec);
+    const char *end;
+
+    *error = "invalid JSON record";
+    if (*s == '"')
+    {
+        char *line = json_string(s, &end);
+        if (line && *json_space(end) == '\0')
+        {
+            return line;
+        }
+        free(line);
+        return NULL;
+    }
+    if (*s != '{')
+    {
+        return NULL;
+    }
+
+    char *line = NULL;
+    s = json_space(s + 1);
+    while (*s == '"')
+    {
+        char *key = json_string(s, &end);
+        if (!key)
+        {
+            break;
+        }
+        s = json_space(end);
+        if (*s++ != ':')
+        {
+            free(key);
+            break;
+        }
+        s = json_space(s);
+        if (!line && *s == '"'
+            && (strcmp(key, "cmd") == 0 || strcmp(key, "command") == 0))
+        {
+            line = json_string(s, &end);
+        }
+        else
+        {
+            end = json_skip(s);
+        }
+        free(key);
+        if (!end)
+        {
+            break;
+        }
+        s = json_space(end);
+        if (*s == ',')
+        {
+            s = json_space(s + 1);
+        }
+    }
+    if (!line)
+    {
+        *error = "record has no \"cmd\" string";
+    }
+    return line;
+}
+
+// Function to append the N bytes at S as a JSON string literal; bytes that
+// are not valid UTF-8 are written as \u00XX
+static void json_put_string(char **buf, size_t *len, size_t *cap,
+                            const char *s, size_t n)
+{
+    str_putn(buf, len, cap, "\"", 1);
+    for (size_t i = 0; i < n; )
+    {
+        unsigned char c = s[i];
+        char esc[8];
+
+        if (c == '"' || c == '\\')
+        {
+            esc[0] = '\\';
+            esc[1] = c;
+            str_putn(buf, len, cap, esc, 2);
+            i++;
+        }
+        else if (c < 0x20 || c == 0x7F)
+        {
+            const char *short_esc = (c == '\n') ? "\\n" : (c == '\t') ? "\\t"
+                                  : (c == '\r') ? "\\r" : NULL;
+            if (short_esc)
+            {
+                str_putn(buf, len, cap, short_esc, 2);
+            }
+            else
+            {
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                str_putn(buf, len, cap, esc, 6);
+            }
+            i++;
+        }
+        else if (c < 0x80)
+        {
+            str_putn(buf, len, cap, s + i, 1);
+            i++;
+        }
+        else
+        {
+            size_t need = (c >= 0xF0 && c < 0xF5) ? 4 : (c >= 0xE0) ? 3
+                        : (c >= 0xC2 && c < 0xE0) ? 2 : 0;
+            size_t k = 1;
+            while (need && k < need && i + k < n
+                   && ((unsigned char) s[i + k] & 0xC0) == 0x80)
+            {
+                k++;
+            }
+            if (need && k == need)
+            {
+                str_putn(buf, len, cap, s + i, need);
+                i += need;
+            }
+            else
+            {
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                str_putn(buf, len, cap, esc, 6);
+                i++;
+            }
+        }
+    }
+    str_putn(buf, len, cap, "\"", 1);
+}
+
+// Function to write the result for record INDEX
+static void batch_emit(BatchJob *job, int index)
+{
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    char num[128];
+
+    snprintf(num, sizeof(num), "{\"index\":%d,\"status\":%d,\"duration_ms\":%.3f",
+             index, job->status, job->ms);
+    str_putn(&buf, &len, &cap, num, strlen(num));
+    if (job->error)
+    {
+        str_putn(&buf, &len, &cap, ",\"error\":", 9);
+        json_put_string(&buf, &len, &cap, job->error, strlen(job->error));
+    }
+    str_putn(&buf, &len, &cap, ",\"stdout\":", 10);
+    json_put_string(&buf, &len, &cap, job->out.buf, job->out.len);
+    str_putn(&buf, &len, &cap, ",\"stderr\":", 10);
+    json_put_string(&buf, &len, &cap, job->err.buf, job->err.len);
+    snprintf(num, sizeof(num), ",\"stdout_dropped\":%zu,\"stderr_dropped\":%zu}\n",
+             job->out.dropped, job->err.dropped);
+    str_putn(&buf, &len, &cap, num, strlen(num));
+
+    fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+    free(buf);
+
+    free(job->out.buf);
+    free(job->err.buf);
+    job->out.buf = job->err.buf = NULL;
+}
+
+// Function to return the milliseconds elapsed since START
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3
+         + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Function to start a child running JOB and add it to the active jobs;
+// returns false if the job could not be started
+static bool batch_start(BatchJob *job)
+{
+    int out[2], err[2];
+    if (pipe(out) != 0)
+    {
+        job->error = strerror(errno);
+        return false;
+    }
+    if (pipe(err) != 0)
+    {
+        job->error = strerror(errno);
+        close(out[0]);
+        close(out[1]);
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        job->error = strerror(errno);
+        close(out[0]); close(out[1]);
+        close(err[0]); close(err[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        // The child reaps its own children as the shell normally does
+        close(chld_fd);
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        for (int i = 0; i < nactive; i++)
+        {
+            if (active[i]->out.fd >= 0)
+            {
+                close(active[i]->out.fd);
+            }
+            if (active[i]->err.fd >= 0)
+            {
+                close(active[i]->err.fd);
+            }
+        }
+        int null = open("/dev/null", O_RDONLY);
+        if (null >= 0)
+        {
+            dup2(null, STDIN_FILENO);
+            close(null);
+        }
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        close(out[0]); close(out[1]);
+        close(err[0]); close(err[1]);
+
+        int status = process(job->cmd);
+        fflush(stdout);
+        exit(status);
+    }
+
+    close(out[1]);
+    close(err[1]);
+    job->pid = pid;
+    job->out.fd = out[0];
+    job->err.fd = err[0];
+    active[nactive++] = job;
+    return true;
+}
+
+// Function to reap the active jobs that have exited, without waiting
+static void batch_reap(void)
+{
+    struct signalfd_siginfo si;
+    while (read(chld_fd, &si, sizeof(si)) == sizeof(si))
+        ;
+
+    for (int i = 0; i < nactive; i++)
+    {
+        BatchJob *job = active[i];
+        int status;
+        if (job->pid > 0 && waitpid(job->pid, &status, WNOHANG) == job->pid)
+        {
+            job->ms = elapsed_ms(&job->start);
+            job->status = STATUS(status);
+            job->pid = 0;
+        }
+    }
+}
+
+// Function to read what is available from capture C
+static void batch_drain(Capture *c)
+{
+    char buf[16384];
+    ssize_t n = read(c->fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
+
+    size_t keep = (c->len < batch_cap) ? batch_cap - c->len : 0;
+    if (keep > (size_t) n)
+    {
+        keep = n;
+    }
+    if (keep)
+    {
+        REALLOC(c->buf, c->len + keep);
+        if (!c->buf)
+        {
+            perror("realloc");
+            exit(errno);
+        }
+        memcpy(c->buf + c->len, buf, keep);
+        c->len += keep;
+    }
+    c->dropped += n - keep;
+}
+
+// Function to expand, tokenize and parse the command line of JOB.  Its
+// first line is the command line; the rest, if any, is what parse() reads as
+// the bodies of its here documents, in place of the batch's own stdin.
+// Diagnostics are captured as the job's error.
+static void batch_parse(BatchJob *job)
+{
+    const char *body = strchr(job->line, '\n');
+    char *first = body ? strndup(job->line, body - job->line)
+                       : strdup(job->line);
+    FILE *saved_stdin = stdin;
+    stdin = (body && body[1]) ? fmemopen((void *) (body + 1), strlen(body + 1), "r")
+                              : fopen("/dev/null", "r");
+    if (!first || !stdin)
+    {
+        job->error = strerror(errno);
+        free(first);
+        if (stdin)
+        {
+            fclose(stdin);
+        }
+        stdin = saved_stdin;
+        return;
+    }
+
+    capture_start();
+    char *text = expand(first);
+    token *list = text ? tokenize(text) : NULL;
+    free(text);
+    free(first);
+    if (list)
+    {
+        job->cmd = parse(list);
+        freeList(list);
+    }
+    size_t len;
+    const char *msg = capture_stop(&len);
+    fclose(stdin);
+    stdin = saved_stdin;
+
+    if (!job->cmd)
+    {
+        while (len > 0 && msg[len-1] == '\n')
+        {
+            len--;
+        }
+        job->message = len ? strndup(msg, len) : NULL;
+        job->error = job->message ? job->message : "syntax error";
+    }
+}
+
+// Function to read FILE and parse each of its records into a job; returns
+// the array of jobs and sets *NJOBS, or returns NULL on error
+static BatchJob *batch_load(const char *file, int *njobs)
+{
+    FILE *fp = fopen(file, "r");
+    if (!fp)
+    {
+        WARN("batch: %s: %s\n", file, strerror(errno));
+        return NULL;
+    }
+
+    BatchJob *jobs = NULL;
+    int n = 0, cap = 0;
+    char *rec = NULL;
+    size_t nrec = 0;
+
+    // Diagnostics from parse() go straight to stderr, so route stderr
+    // through a stream that can capture them
+    if (capture_install() < 0)
+    {
+        perror("fopencookie");
+    }
+
+    while (getline(&rec, &nrec, fp) > 0)
+    {
+        if (*json_space(rec) == '\0')
+        {
+            continue;                   // Blank lines are not records
+        }
+        if (n == cap)
+        {
+            cap = cap ? 2 * cap : 64;
+            REALLOC(jobs, cap);
+            if (!jobs)
+            {
+                perror("realloc");
+                exit(errno);
+            }
+        }
+        BatchJob *job = &jobs[n++];
+        memset(job, 0, sizeof(*job));
+        job->out.fd = job->err.fd = -1;
+
+        job->line = json_command(rec, &job->error);
+        if (!job->line)
+        {
+            continue;
+        }
+        job->error = NULL;
+        batch_parse(job);
+    }
+
+    free(rec);
+    fclose(fp);
+    *njobs = n;
+    return jobs;
+}
+
+// Function to run batch mode
+int batch(int argc, char **argv)
+{
+    long width = sysconf(_SC_NPROCESSORS_ONLN);
+    bool completion_order = false;
+    const char *file = NULL;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            char *end;
+            width = strtol(argv[++i], &end, 10);
+            width = (*end == '\0') ? width : 0;
+        }
+        else if (strcmp(argv[i], "--completion-order") == 0)
+        {
+            completion_order = true;
+        }
+        else if (!file && argv[i][0] != '-')
+        {
+            file = argv[i];
+        }
+        else
+        {
+            file = NULL;
+            break;
+        }
+    }
+    if (!file || width < 1 || width > BATCH_MAX_WIDTH)
+    {
+        WARN("%s\n", "usage: --batch FILE.jsonl [-j N] [--completion-order]");
+        return 2;
+    }
+
+    const char *cap = getenv("BSH_BATCH_CAP");
+    if (cap && *cap)
+    {
+        batch_cap = strtoul(cap, NULL, 10);
+    }
+
+    int njobs = -1;
+    BatchJob *jobs = batch_load(file, &njobs);
+    if (njobs < 0)
+    {
+        return 2;
+    }
+
+    // Exits are reported through a signalfd, so SIGCHLD stays blocked
+    // here; children restore the mask and keep the shell's handler
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old_mask);
+    chld_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    // Only the active jobs are polled:  two pipes each and the signalfd
+    struct pollfd *fds = malloc((2 * width + 1) * sizeof(*fds));
+    BatchJob **owner = malloc((2 * width + 1) * sizeof(*owner));
+    active = malloc(width * sizeof(*active));
+    if (chld_fd < 0 || !fds || !owner || !active)
+    {
+        perror("batch");
+        exit(errno);
+    }
+    nactive = 0;
+    int next = 0, emitted = 0;
+    bool failed = false;
+
+    while (emitted < njobs)
+    {
+        // Keep up to WIDTH commands in flight
+        while (nactive < width && next < njobs)
+        {
+            BatchJob *job = &jobs[next++];
+            if (!job->cmd || !batch_start(job))
+            {
+                job->status = 2;
+                job->done = true;
+                if (completion_order)
+                {
+                    failed = true;
+                    batch_emit(job, job - jobs);
+                    emitted++;
+                }
+            }
+        }
+
+        if (!completion_order)
+        {
+            while (emitted < njobs && jobs[emitted].done)
+            {
+                failed |= jobs[emitted].status != 0;
+                batch_emit(&jobs[emitted], emitted);
+                emitted++;
+            }
+        }
+        if (nactive == 0)
+        {
+            continue;
+        }
+
+        int nfds = 0;
+        fds[nfds].fd = chld_fd;
+        fds[nfds].events = POLLIN;
+        owner[nfds++] = NULL;
+        for (int i = 0; i < nactive; i++)
+        {
+            Capture *caps[2] = { &active[i]->out, &active[i]->err };
+            for (int k = 0; k < 2; k++)
+            {
+                if (caps[k]->fd >= 0)
+                {
+                    fds[nfds].fd = caps[k]->fd;
+                    fds[nfds].events = POLLIN;
+                    owner[nfds++] = active[i];
+                }
+            }
+        }
+        if (poll(fds, nfds, -1) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++)
+        {
+            if (!fds[i].revents)
+            {
+                continue;
+            }
+            if (!owner[i])
+            {
+                batch_reap();
+                continue;
+            }
+            BatchJob *job = owner[i];
+            batch_drain(job->out.fd == fds[i].fd ? &job->out : &job->err);
+        }
+
+        // A job is done once it has exited and both of its pipes are closed
+        for (int i = 0; i < nactive; )
+        {
+            BatchJob *job = active[i];
+            if (job->pid > 0 || job->out.fd >= 0 || job->err.fd >= 0)
+            {
+                i++;
+                continue;
+            }
+            active[i] = active[--nactive];
+            job->done = true;
+            if (completion_order)
+            {
+                failed |= job->status != 0;
+                batch_emit(job, job - jobs);
+                emitted++;
+            }
+        }
+    }
+
+    close(chld_fd);
+    chld_fd = -1;
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    for (int i = 0; i < njobs; i++)
+    {
+        free(jobs[i].line);
+        free(jobs[i].message);
+        freeCMD(jobs[i].cmd);
+    }
+    free(jobs);
+    free(fds);
+    free(owner);
+    free(active);
+    active = NULL;
+    return failed ? 1 : 0;
+}
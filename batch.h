@@ -0,0 +1,25 @@
+// batch.h
+//
+// Batch mode:  Bash --batch FILE.jsonl [-j N] [--completion-order]
+//
+// Each line of FILE is a JSON record holding one command line, either as a
+// string or as the "cmd" (or "command") member of an object.  Every line is
+// parsed before any is run; then the commands are executed by up to N
+// concurrent children (default one per CPU, at most 4096).  One JSON object
+// is written to stdout per record, in input order (or in completion order),
+// holding its index, status, duration, and up to $BSH_BATCH_CAP bytes
+// (default 65536) each of its stdout and stderr.  A record that cannot be
+// run instead has an "error" member, e.g., the parser's diagnostic.
+//
+// Only the first line of a command is a command line; the lines after it
+// are the bodies of its here documents ("cat <<EOF\nhello\nEOF").  Nothing
+// is read from the batch's own stdin.
+
+#ifndef BATCH_INCLUDED
+#define BATCH_INCLUDED
+
+// Run batch mode with the ARGC arguments in ARGV (ARGV[0] is the file name);
+// returns 0 if every command succeeded and 1 otherwise
+int batch(int argc, char **argv);
+
+#endif
@@ -0,0 +1,237 @@
+// bsh.c
+//
+// Contexts for the shell as a library.  The shell keeps its state in
+// globals (the environment, the working directory, the directory stack and
+// $?); a context holds a copy of that state, which bsh_eval() swaps in
+// while it runs a line and swaps out again afterwards.
+#include "process.h"
+#include "bsh.h"
+#include "eval.h"
+#include "dirstack.h"
+#include "jobs.h"
+#include "capture.h"
+#include "admit.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Structure for a context
+struct BshCtx {
+    char **vars;        // Its environment (NULL-terminated)
+    char **owned;       // Strings in VARS that it allocated (NULL-terminated)
+    int cwd;            // Open on its working directory
+    DirStack *dirs;     // Its directory stack (NULL until first used)
+    int status;         // Its $?
+};
+
+// One context runs at a time, since what it swaps in is process-wide
+static pthread_mutex_t bsh_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Environment array that bsh_eval() installed last (NULL if none); glibc
+// neither frees it nor reallocates it, so it is freed here once replaced
+static char **installed = NULL;
+
+// Function to return a copy of the pointer array ENV (NULL on error)
+static char **env_copy(char **env)
+{
+    size_t n = 0;
+    while (env && env[n])
+    {
+        n++;
+    }
+    char **copy = malloc((n + 1) * sizeof(*copy));
+    if (copy)
+    {
+        memcpy(copy, env, n * sizeof(*copy));
+        copy[n] = NULL;
+    }
+    return copy;
+}
+
+// Function to make VARS (from env_copy()) the environment
+static void env_install(char **vars)
+{
+    char **old = installed;
+
+    // clearenv() frees the array that setenv() made, if it is in use; the
+    // next setenv() then copies VARS into a new one instead of reallocating
+    clearenv();
+    environ = vars;
+    installed = vars;
+    free(old);
+}
+
+// Function to create a context
+BshCtx *bsh_ctx_new(void)
+{
+    BshCtx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&bsh_lock);
+    ctx->vars = env_copy(environ);
+    ctx->owned = env_copy(environ);
+    pthread_mutex_unlock(&bsh_lock);
+    ctx->cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ctx->status = 0;
+    if (!ctx->vars || !ctx->owned || ctx->cwd < 0)
+    {
+        int saved = errno;
+        bsh_ctx_free(ctx);
+        errno = saved;
+        return NULL;
+    }
+
+    // The context owns its strings, which the process may change or free
+    for (size_t i = 0; ctx->owned[i]; i++)
+    {
+        ctx->owned[i] = ctx->vars[i] = strdup(ctx->vars[i]);
+    }
+    return ctx;
+}
+
+// Function to return what was written to anonymous file FILE (with its
+// length in *LEN) and close it
+static char *capture_end(int file, size_t *len)
+{
+    struct stat st;
+    char *buf = NULL;
+    *len = 0;
+    if (file < 0)
+    {
+        return NULL;
+    }
+    if (fstat(file, &st) == 0 && (buf = malloc(st.st_size + 1)))
+    {
+        ssize_t n;
+        while (*len < (size_t) st.st_size
+               && (n = pread(file, buf + *len, st.st_size - *len, *len)) > 0)
+        {
+            *len += n;
+        }
+        buf[*len] = '\0';
+    }
+    close(file);
+    return buf;
+}
+
+// Function to run LINE in context CTX
+int bsh_eval(BshCtx *ctx, const char *line, BshResult *result)
+{
+    pthread_mutex_lock(&bsh_lock);
+
+    // Swap the context in
+    int host_cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (host_cwd < 0 || fchdir(ctx->cwd) < 0)
+    {
+        int saved = errno;
+        if (host_cwd >= 0)
+        {
+            close(host_cwd);
+        }
+        pthread_mutex_unlock(&bsh_lock);
+        errno = saved;
+        return -1;
+    }
+    char **host_vars = env_copy(environ);
+    env_install(ctx->vars);
+    ctx->vars = NULL;
+    DirStack *host_dirs = dirstack_swap(ctx->dirs);
+    int host_status = last_status();
+    update_status(ctx->status);
+
+    // The output is captured by thread (see capture.h):  builtins write to
+    // the files, and children point descriptors 1 and 2 at them, so the
+    // process's own descriptors are never touched
+    int out_file = -1, err_file = -1;
+    bool captured = true;
+    if (result)
+    {
+        *result = (BshResult) { 0 };
+        out_file = memfd_create("bsh-out", MFD_CLOEXEC);
+        err_file = (out_file < 0) ? -1 : memfd_create("bsh-err", MFD_CLOEXEC);
+        captured = err_file >= 0 && capture_output(out_file, err_file) == 0;
+    }
+
+    int status = -1;
+    int err = errno;
+    if (captured)
+    {
+        // A child would otherwise flush a copy of what is still buffered
+        fflush(stdout);
+        fflush(stderr);
+        jobs_reap();
+        status = eval_line(line);
+        jobs_reap();
+        admit_poll();
+        fflush(stdout);
+        fflush(stderr);
+    }
+    if (result)
+    {
+        capture_output(-1, -1);
+        capture_remove();
+        result->status = status;
+        result->out = capture_end(out_file, &result->out_len);
+        result->err = capture_end(err_file, &result->err_len);
+        if (!captured)
+        {
+            bsh_result_free(result);
+        }
+    }
+
+    // Swap the context out
+    ctx->status = last_status();
+    update_status(host_status);
+    ctx->dirs = dirstack_swap(host_dirs);
+    ctx->vars = env_copy(environ);
+    env_install(host_vars);
+    close(ctx->cwd);
+    ctx->cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fchdir(host_cwd) < 0)
+    {
+        perror("fchdir");
+    }
+    close(host_cwd);
+
+    pthread_mutex_unlock(&bsh_lock);
+    errno = err;
+    return status;
+}
+
+// Function to free the buffers in RESULT
+void bsh_result_free(BshResult *result)
+{
+    free(result->out);
+    free(result->err);
+    result->out = result->err = NULL;
+    result->out_len = result->err_len = 0;
+}
+
+// Function to free context CTX
+void bsh_ctx_free(BshCtx *ctx)
+{
+    if (!ctx)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bsh_lock);
+    jobs_reap();
+    pthread_mutex_unlock(&bsh_lock);
+
+    for (size_t i = 0; ctx->owned && ctx->owned[i]; i++)
+    {
+        free(ctx->owned[i]);
+    }
+    free(ctx->owned);
+    free(ctx->vars);
+    dirstack_free(ctx->dirs);
+    if (ctx->cwd >= 0)
+    {
+        close(ctx->cwd);
+    }
+    free(ctx);
+}
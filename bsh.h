@@ -0,0 +1,72 @@
+// bsh.h
+//
+// The shell as a library, for programs that would otherwise run command
+// lines with system() or popen().  Build it with  make lib  and link with
+//
+//     cc -no-pie prog.c libbsh.a -pthread -ldl
+//
+// A context is a shell session:  it has its own variables, $?, working
+// directory and directory stack, which start as copies of the process's.
+// Command lines run in the calling process (builtins) or in children that
+// it forks (other commands); no /bin/sh is started.
+//
+// The library is not reentrant.  A context's state is kept apart from the
+// process's only between calls:  bsh_eval() swaps it into the process for
+// the whole call, under one lock for the whole process.  So while any
+// bsh_eval() is running,
+//
+//   - environ is the context's:  other threads of the host must not call
+//     getenv(), setenv(), putenv() or unsetenv(), or start programs that
+//     inherit the environment;
+//   - the working directory is the context's:  other threads must not use
+//     relative paths (or the *at() calls with AT_FDCWD);
+//   - every other bsh_eval(), in any context, waits until it has finished.
+//
+// A line that runs for a long time, such as one that waits for a slow
+// command, therefore blocks every other context; a caller that needs lines
+// to overlap, or threads that need the environment meanwhile, must run the
+// lines in separate processes.  Output is captured by thread (see
+// capture.h), so the process's own descriptors 1 and 2 are left alone; while
+// a bsh_eval() with a RESULT runs, stderr is a stream of the library that
+// passes what other threads write on to the host's own stderr, which is put
+// back before bsh_eval() returns.
+//
+// The library installs no signal handlers; the background jobs that a line
+// starts are reaped by the next bsh_eval() in any context and by
+// bsh_ctx_free(), and  jobs  lists those of every context.  A process that
+// ignores SIGCHLD cannot collect statuses.
+
+#ifndef BSH_INCLUDED
+#define BSH_INCLUDED
+
+#include <stddef.h>
+
+// A shell session
+typedef struct BshCtx BshCtx;
+
+// What a command line did
+typedef struct BshResult {
+    int status;         // Its status, as $? would have it
+    char *out;          // What it wrote to stdout (null-terminated)
+    size_t out_len;     //   and its length
+    char *err;          // What it wrote to stderr (null-terminated)
+    size_t err_len;     //   and its length
+} BshResult;
+
+// Return a new context (NULL on error, with errno set)
+BshCtx *bsh_ctx_new(void);
+
+// Expand, parse and run command line LINE in context CTX and return its
+// status.  If RESULT is not NULL, stdout and stderr are captured into
+// buffers that belong to the caller (free them with bsh_result_free());
+// otherwise the line writes to the process's.  Returns -1 (with errno set)
+// if the line could not be run at all.
+int bsh_eval(BshCtx *ctx, const char *line, BshResult *result);
+
+// Free the buffers in RESULT
+void bsh_result_free(BshResult *result);
+
+// Free context CTX
+void bsh_ctx_free(BshCtx *ctx);
+
+#endif
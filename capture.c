@@ -0,0 +1,223 @@
+// capture.c
+//
+// Capture of stderr by thread.
+#include "process.h"
+#include "capture.h"
+#include <fcntl.h>
+
+// Structure for the text captured from one thread
+typedef struct Capture {
+    bool active;            // Capturing (otherwise stderr is written)
+    char *s;                // Text captured
+    size_t len;             // Its length
+    size_t cap;             // Allocated size
+} Capture;
+
+static _Thread_local Capture capture;
+static FILE *capture_stream = NULL;
+static FILE *capture_saved = NULL;      // stderr before capture_install()
+
+// Descriptors to which the output of the calling thread goes (-1 if none),
+// and the stream for its builtins that writes to the first
+static _Thread_local int output_out = -1, output_err = -1;
+static _Thread_local FILE *output_stream = NULL;
+
+// Function to write the N bytes at BUF written to stderr to the capture of
+// the calling thread, or to where its output goes, or to the stream that
+// stderr was before if it is not capturing
+static ssize_t capture_write(void *cookie, const char *buf, size_t n)
+{
+    if (capture.active)
+    {
+        if (capture.len + n + 1 > capture.cap)
+        {
+            // Out of memory, the text is dropped rather than the write failed
+            size_t cap = 2 * (capture.len + n + 1);
+            char *s = realloc(capture.s, cap);
+            if (!s)
+            {
+                return n;
+            }
+            capture.s = s;
+            capture.cap = cap;
+        }
+        memcpy(capture.s + capture.len, buf, n);
+        capture.len += n;
+        capture.s[capture.len] = '\0';
+        return n;
+    }
+
+    if (output_err < 0 && capture_saved)
+    {
+        size_t done = fwrite(buf, 1, n, capture_saved);
+        return done ? (ssize_t) done : -1;
+    }
+
+    int fd = (output_err >= 0) ? output_err : STDERR_FILENO;
+    size_t done = 0;
+    while (done < n)
+    {
+        ssize_t w = write(fd, buf + done, n - done);
+        if (w < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (w <= 0)
+        {
+            return done ? (ssize_t) done : -1;
+        }
+        done += w;
+    }
+    return done;
+}
+
+// Function to make stderr capturable
+int capture_install(void)
+{
+    if (capture_stream && stderr == capture_stream)
+    {
+        return 0;
+    }
+    if (!capture_stream)
+    {
+        cookie_io_functions_t io = { NULL, capture_write, NULL, NULL };
+        capture_stream = fopencookie(NULL, "w", io);
+        if (!capture_stream)
+        {
+            return -1;
+        }
+
+        // Unbuffered, so that each write lands in the thread that made it
+        setvbuf(capture_stream, NULL, _IONBF, 0);
+    }
+    fflush(stderr);
+    capture_saved = stderr;
+    stderr = capture_stream;
+    return 0;
+}
+
+// Function to give stderr back
+void capture_remove(void)
+{
+    // The stream is kept:  another thread may have fetched stderr before it
+    // was given back and still be writing to it
+    if (capture_stream && stderr == capture_stream)
+    {
+        stderr = capture_saved;
+    }
+}
+
+// Function to start capturing
+void capture_start(void)
+{
+    capture.active = true;
+    capture.len = 0;
+}
+
+// Function to stop capturing
+const char *capture_stop(size_t *len)
+{
+    capture.active = false;
+    *len = capture.len;
+    return capture.len ? capture.s : "";
+}
+
+// Function to send the output of the calling thread to OUT and ERR
+int capture_output(int out, int err)
+{
+    if (output_stream)
+    {
+        if (builtin_stdout == output_stream)
+        {
+            builtin_stdout = NULL;
+        }
+        fclose(output_stream);
+        output_stream = NULL;
+    }
+    output_out = output_err = -1;
+    if (out < 0 && err < 0)
+    {
+        return 0;
+    }
+    if (capture_install() < 0)
+    {
+        return -1;
+    }
+
+    if (out >= 0)
+    {
+        // Unbuffered, so that a fork leaves no copy of it to be flushed
+        int fd = fcntl(out, F_DUPFD_CLOEXEC, 3);
+        output_stream = (fd < 0) ? NULL : fdopen(fd, "w");
+        if (!output_stream)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return -1;
+        }
+        setvbuf(output_stream, NULL, _IONBF, 0);
+        builtin_stdout = output_stream;
+    }
+    output_out = out;
+    output_err = err;
+    return 0;
+}
+
+// Function to return the descriptors of the calling thread's output
+void capture_fds(int *out, int *err)
+{
+    *out = output_out;
+    *err = output_err;
+}
+
+// Function to give a child the output of the thread that forked it
+void capture_child(bool background)
+{
+    if (output_out < 0 && output_err < 0)
+    {
+        return;
+    }
+
+    // A background job would hold the output open until it exited, so its
+    // output is discarded instead (unless its job log takes it)
+    int null = background ? open("/dev/null", O_WRONLY) : -1;
+    if (output_out >= 0)
+    {
+        dup2(background ? null : output_out, STDOUT_FILENO);
+        builtin_stdout = NULL;
+    }
+    if (output_err >= 0)
+    {
+        dup2(background ? null : output_err, STDERR_FILENO);
+    }
+
+    // Nor may a child that does not exec keep other copies of it
+    if (null > STDERR_FILENO)
+    {
+        close(null);
+    }
+    if (output_out > STDERR_FILENO)
+    {
+        close(output_out);
+    }
+    if (output_err > STDERR_FILENO && output_err != output_out)
+    {
+        close(output_err);
+    }
+    if (output_stream)
+    {
+        fclose(output_stream);
+    }
+    output_out = output_err = -1;
+    output_stream = NULL;
+}
+
+// Function to free the capture buffer
+void capture_release(void)
+{
+    free(capture.s);
+    capture.s = NULL;
+    capture.len = capture.cap = 0;
+}
@@ -0,0 +1,48 @@
+// capture.h
+//
+// Per-thread capture of what is written to stderr.  parse() and tokenize()
+// write their diagnostics straight to stderr; a thread that parses a line
+// ahead of time or in parallel with others captures them instead, so that
+// they can be reported with the right line or not at all.
+//
+// A thread can also send all of its output elsewhere (as bsh_eval() does,
+// see bsh.h):  what it writes to stderr, what its builtins write to
+// BSTDOUT, and descriptors 1 and 2 of the children it forks, while the
+// process's own descriptors 1 and 2 are left alone.
+
+#ifndef CAPTURE_INCLUDED
+#define CAPTURE_INCLUDED
+
+// Replace stderr by a stream that writes to the old stderr except in threads
+// that are capturing; returns 0 on success and -1 on error
+int capture_install(void);
+
+// Undo capture_install(), making stderr what it was before (for a library,
+// which must leave the host's stderr alone outside its calls)
+void capture_remove(void);
+
+// Start capturing what the calling thread writes to stderr
+void capture_start(void);
+
+// Stop capturing and return what was captured (null-terminated, valid until
+// the thread next captures); its length is stored in *LEN
+const char *capture_stop(size_t *len);
+
+// Send the output of the calling thread to descriptors OUT and ERR (-1 to
+// leave it alone; both -1 to stop); returns 0 on success and -1 on error
+int capture_output(int out, int err);
+
+// Store the descriptors given to capture_output() by the calling thread (-1
+// if none) in *OUT and *ERR, for a thread that it starts to take over
+void capture_fds(int *out, int *err);
+
+// In a child just forked:  make the descriptors given to capture_output() by
+// the thread that forked it its descriptors 1 and 2, or /dev/null if it is a
+// BACKGROUND job, which must not keep them open; called before the child's
+// own redirections
+void capture_child(bool background);
+
+// Free the capture buffer of the calling thread
+void capture_release(void);
+
+#endif
@@ -0,0 +1,410 @@
+// check.c
+//
+// Multithreaded syntax check of a script.
+#include "process.h"
+#include "check.h"
+#include "eval.h"
+#include "expand.h"
+#include "test.h"
+#include "read.h"
+#include "capture.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Number of lines a worker takes at a time
+#define CHECK_CHUNK 256
+
+// Structure for one command line of the script
+typedef struct Unit {
+    const char *line;       // The line (with its newline)
+    size_t len;             // Its length
+    const char *here;       // Bodies of its here documents (NULL if none)
+    size_t hlen;            // Their length
+    long lineno;            // Line number of the line
+    CMD *tree;              // Parsed tree (kept only if it can be reused)
+    char *error;            // Diagnostics written while parsing (or NULL)
+} Unit;
+
+// Structure for the state shared by the workers
+typedef struct Check {
+    Unit *units;            // The lines of the script
+    long nunits;            // Number of lines
+    bool keep;              // Keep reusable trees for execution
+    atomic_long next;       // First line of the next chunk to take
+} Check;
+
+// Function to copy the word that starts at S (and ends by END at the latest)
+// into DELIM (of size N) as the tokenizer would see it, without its quotes;
+// returns the length of the copy
+static size_t here_delimiter(const char *s, const char *end, char *delim, size_t n)
+{
+    size_t len = 0;
+    char quote = 0;
+    for (const char *p = s; p < end; p++)
+    {
+        if (quote && *p == quote)
+        {
+            quote = 0;
+            continue;
+        }
+        if (!quote && (*p == '\'' || *p == '"'))
+        {
+            quote = *p;
+            continue;
+        }
+        if (!quote && strchr(" \t\n;&|<>()", *p))
+        {
+            break;
+        }
+        if (!quote && *p == '\\' && p + 1 < end)
+        {
+            p++;
+        }
+        if (len + 1 < n)
+        {
+            delim[len++] = *p;
+        }
+    }
+    delim[len] = '\0';
+    return len;
+}
+
+// Function to find the end of the here document bodies that follow the line
+// LINE (of length LEN) in the script, which ends at END; returns the start of
+// the next line, or LINE + LEN if the line has no here documents
+static const char *skip_here(const char *line, size_t len, const char *end)
+{
+    const char *next = line + len;
+    bool in_single = false, in_double = false;
+
+    for (const char *p = line; p < line + len; p++)
+    {
+        if (in_single)
+        {
+            in_single = (*p != '\'');
+            continue;
+        }
+        if (*p == '\\')
+        {
+            p++;
+            continue;
+        }
+        if (*p == '\'' && !in_double)
+        {
+            in_single = true;
+        }
+        else if (*p == '"')
+        {
+            in_double = !in_double;
+        }
+        else if (!in_double && *p == '<' && p + 1 < line + len && p[1] == '<')
+        {
+            // The body runs up to a line that is just the delimiter
+            p += 2;
+            while (p < line + len && (*p == ' ' || *p == '\t'))
+            {
+                p++;
+            }
+            char delim[PATH_MAX];
+            size_t dlen = here_delimiter(p, line + len, delim, sizeof(delim));
+            while (next < end)
+            {
+                const char *nl = memchr(next, '\n', end - next);
+                bool found = (size_t) ((nl ? nl : end) - next) == dlen
+                    && memcmp(next, delim, dlen) == 0;
+                next = nl ? nl + 1 : end;
+                if (found)
+                {
+                    break;
+                }
+            }
+            p--;
+        }
+    }
+    return next;
+}
+
+// Function to split script TEXT of length N into lines; returns the number
+// of lines and stores them in *UNITS
+static long split_script(const char *text, size_t n, Unit **units)
+{
+    const char *end = text + n;
+    long nunits = 0, cap = 0, lineno = 1;
+    *units = NULL;
+
+    for (const char *p = text; p < end; )
+    {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t len = (nl ? nl + 1 : end) - p;
+        const char *next = skip_here(p, len, end);
+
+        if (nunits == cap)
+        {
+            cap = cap ? 2 * cap : 1024;
+            REALLOC(*units, cap);
+        }
+        Unit *u = &(*units)[nunits++];
+        *u = (Unit) { p, len, NULL, 0, lineno, NULL, NULL };
+        if (next > p + len)
+        {
+            u->here = p + len;
+            u->hlen = next - (p + len);
+        }
+
+        for (const char *q = p; q < next; q++)
+        {
+            lineno += (*q == '\n');
+        }
+        p = next;
+    }
+    return nunits;
+}
+
+// Function to tokenize and parse unit U, capturing its diagnostics; trees
+// are kept if KEEP and they can be executed as they are
+static void parse_unit(Unit *u, bool keep)
+{
+    char *line = strndup(u->line, u->len);
+    capture_start();
+
+    // A here document body is read by parse() from stdin
+    FILE *saved_stdin = stdin;
+    if (u->here)
+    {
+        stdin = fmemopen((void *) u->here, u->hlen, "r");
+    }
+
+    token *list = tokenize(line);
+    CMD *cmd = list ? parse(list) : NULL;
+    freeList(list);
+    bool failed = list && !cmd;
+
+    if (u->here)
+    {
+        if (stdin)
+        {
+            fclose(stdin);
+        }
+        stdin = saved_stdin;
+    }
+    size_t len;
+    const char *msg = capture_stop(&len);
+    if (failed || len > 0)
+    {
+        u->error = strndup(msg, len);
+    }
+
+    // A here document has been expanded already, and other expansions have
+    // to be done when the line runs
+    if (cmd && keep && !u->here && expand_static(line))
+    {
+        u->tree = cmd;
+    }
+    else if (cmd)
+    {
+        freeCMD(cmd);
+    }
+    free(line);
+}
+
+// Function to parse chunks of lines without here documents (in a worker)
+static void *check_worker(void *arg)
+{
+    Check *c = arg;
+    long first;
+    while ((first = atomic_fetch_add(&c->next, CHECK_CHUNK)) < c->nunits)
+    {
+        long last = first + CHECK_CHUNK;
+        for (long i = first; i < last && i < c->nunits; i++)
+        {
+            if (!c->units[i].here)
+            {
+                parse_unit(&c->units[i], c->keep);
+            }
+        }
+    }
+    capture_release();
+    return NULL;
+}
+
+// Function to read all of FP into a new buffer; returns NULL on error
+static char *slurp(FILE *fp, size_t *n)
+{
+    char *text = NULL;
+    size_t cap = 0;
+    *n = 0;
+    for (;;)
+    {
+        if (*n == cap)
+        {
+            cap = cap ? 2 * cap : 65536;
+            REALLOC(text, cap);
+        }
+        size_t r = fread(text + *n, 1, cap - *n, fp);
+        *n += r;
+        if (r == 0)
+        {
+            break;
+        }
+    }
+    if (ferror(fp))
+    {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+// Function to execute the checked script
+static int run_script(Unit *units, long nunits)
+{
+    int status = 0;
+    for (long i = 0; i < nunits; i++)
+    {
+        Unit *u = &units[i];
+        if (u->tree)
+        {
+            status = process(u->tree);
+            stat_cache_invalidate();
+            read_buffer_release();
+            continue;
+        }
+
+        char *line = strndup(u->line, u->len);
+        FILE *saved_stdin = stdin;
+        if (u->here)
+        {
+            stdin = fmemopen((void *) u->here, u->hlen, "r");
+        }
+        if (stdin)
+        {
+            status = eval_line(line);
+        }
+        if (u->here)
+        {
+            if (stdin)
+            {
+                fclose(stdin);
+            }
+            stdin = saved_stdin;
+        }
+        free(line);
+    }
+    return status;
+}
+
+// Function to check script FILE
+int check_script(const char *file, bool run)
+{
+    FILE *fp = strcmp(file, "-") ? fopen(file, "r") : stdin;
+    if (!fp)
+    {
+        WARN("%s: %s\n", file, strerror(errno));
+        return 2;
+    }
+    size_t n;
+    char *text = slurp(fp, &n);
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+    if (!text)
+    {
+        WARN("%s: %s\n", file, strerror(errno));
+        return 2;
+    }
+
+    Check c;
+    c.nunits = split_script(text, n, &c.units);
+    c.keep = run;
+    atomic_init(&c.next, 0);
+
+    long nthreads = 0;
+    const char *env = getenv("BSH_PARSE_THREADS");
+    if (env)
+    {
+        nthreads = atol(env);
+    }
+    if (nthreads <= 0)
+    {
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    long useful = (c.nunits + CHECK_CHUNK - 1) / CHECK_CHUNK;
+    if (nthreads > useful)
+    {
+        nthreads = useful > 0 ? useful : 1;
+    }
+
+    // Diagnostics from parse() go straight to stderr, so route stderr
+    // through a stream that each thread can capture
+    if (capture_install() < 0)
+    {
+        perror("fopencookie");
+    }
+
+    // Lines with here documents swap stdin, so they are parsed here, one at
+    // a time, while the workers parse the others
+    pthread_t *threads = malloc((nthreads - 1) * sizeof(*threads) + 1);
+    long started = 0;
+    for ( ; started < nthreads - 1; started++)
+    {
+        if (pthread_create(&threads[started], NULL, check_worker, &c) != 0)
+        {
+            break;
+        }
+    }
+    for (long i = 0; i < c.nunits; i++)
+    {
+        if (c.units[i].here)
+        {
+            parse_unit(&c.units[i], run);
+        }
+    }
+    check_worker(&c);
+    for (long i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    // Report the errors in the order of the script
+    long nerrors = 0;
+    for (long i = 0; i < c.nunits; i++)
+    {
+        Unit *u = &c.units[i];
+        if (!u->error)
+        {
+            continue;
+        }
+        nerrors++;
+        if (!u->error[0])
+        {
+            WARN("%s:%ld: syntax error\n", file, u->lineno);
+        }
+        for (char *msg = u->error; *msg; )
+        {
+            char *nl = strchr(msg, '\n');
+            int len = nl ? nl - msg : (int) strlen(msg);
+            WARN("%s:%ld: %.*s\n", file, u->lineno, len, msg);
+            msg += len + (nl != NULL);
+        }
+    }
+
+    int status = nerrors ? 2 : 0;
+    if (run && nerrors == 0)
+    {
+        status = run_script(c.units, c.nunits);
+    }
+
+    for (long i = 0; i < c.nunits; i++)
+    {
+        if (c.units[i].tree)
+        {
+            freeCMD(c.units[i].tree);
+        }
+        free(c.units[i].error);
+    }
+    free(c.units);
+    free(text);
+    return status;
+}
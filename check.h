@@ -0,0 +1,18 @@
+// check.h
+//
+// Syntax check of a script without running it (-n).  The script is split
+// into command lines, each with the bodies of its here documents, and the
+// lines are tokenized and parsed by a pool of threads ($BSH_PARSE_THREADS,
+// default one per CPU).  Every error is reported with its line number.
+
+#ifndef CHECK_INCLUDED
+#define CHECK_INCLUDED
+
+// Check the syntax of script FILE ("-" for stdin) and report each error on
+// stderr as FILE:LINE: MESSAGE.  If RUN and there are no errors, execute
+// the script, using the trees already parsed for lines that contain nothing
+// to expand.  Return 2 if there were errors, otherwise 0 (or the status of
+// the script if RUN).
+int check_script(const char *file, bool run);
+
+#endif
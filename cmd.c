@@ -0,0 +1,132 @@
+// cmd.c                                         Stan Eisenstat (11/11/17)
+//
+// Allocating and freeing token lists and CMD trees; shared by the shell and
+// the library (see bsh.h).
+
+#include "process.h"
+
+
+// Free list of tokens LIST
+void freeList (token *list)
+{
+    token *p, *pnext;
+    for (p = list;  p;  p = pnext)  {
+	pnext = p->next;  p->next = NULL;       // Zap p->next and p->text
+	free(p->text);    p->text = NULL;       //   to stop accidental reuse
+	free(p);
+    }
+}
+
+
+// Allocate, initialize, and return a pointer to an empty command structure
+CMD *mallocCMD (void)
+{
+    CMD *new = malloc(sizeof(*new));
+
+    new->type     = NONE;
+    new->argc     = 0;
+    new->argv     = malloc (sizeof(char *));
+    new->argv[0]  = NULL;
+    new->nLocal   = 0;
+    new->locVar   = NULL;
+    new->locVal   = NULL;
+    new->fromType = NONE;
+    new->fromFile = NULL;
+    new->toType   = NONE;
+    new->toFile   = NULL;
+    new->errType  = NONE;
+    new->errFile  = NULL;
+    new->left     = NULL;
+    new->right    = NULL;
+
+    return new;
+}
+
+
+// Free tree of commands rooted at *C
+void freeCMD (CMD *c)
+{
+    if (!c)
+	return;
+
+    for (int i = 0; i < c->nLocal; i++) {
+	free (c->locVar[i]);
+	free (c->locVal[i]);
+    }
+    free (c->locVar);
+    free (c->locVal);
+
+    for (char **p = c->argv;  *p;  p++)
+	free (*p);
+    free (c->argv);
+
+    free (c->fromFile);
+    free (c->toFile);
+    free (c->errFile);
+
+    freeCMD (c->left);
+    freeCMD (c->right);
+
+    free (c);
+}
+
+
+// Return a copy of string S (NULL if S is NULL), setting *FAIL if out of
+// memory
+static char *copyString (const char *s, bool *fail)
+{
+    char *new = s ? strdup (s) : NULL;
+    if (s && !new)
+	*fail = true;
+    return new;
+}
+
+
+// Return a copy of the tree of commands rooted at *C
+CMD *copyCMD (const CMD *c)
+{
+    bool fail = false;
+    CMD *new;
+
+    if (!c || !(new = malloc (sizeof(*new))))
+	return NULL;
+    *new = *c;                                  // Types and counts
+    new->argv = calloc (c->argc + 1, sizeof(char *));
+    if (!new->argv) {
+	free (new);
+	return NULL;
+    }
+    new->nLocal = 0;                            // Safe to freeCMD() from
+    new->locVar = new->locVal = NULL;           //   here on
+    new->fromFile = new->toFile = new->errFile = NULL;
+    new->left = new->right = NULL;
+
+    for (int i = 0; i < c->argc && !fail; i++)  // freeCMD() stops at a NULL
+	new->argv[i] = copyString (c->argv[i], &fail);
+    if (c->nLocal > 0) {
+	new->locVar = calloc (c->nLocal, sizeof(char *));
+	new->locVal = calloc (c->nLocal, sizeof(char *));
+	if (new->locVar && new->locVal) {
+	    new->nLocal = c->nLocal;
+	    for (int i = 0; i < c->nLocal; i++) {
+		new->locVar[i] = copyString (c->locVar[i], &fail);
+		new->locVal[i] = copyString (c->locVal[i], &fail);
+	    }
+	} else
+	    fail = true;
+    }
+    new->fromFile = copyString (c->fromFile, &fail);
+    new->toFile   = copyString (c->toFile, &fail);
+    new->errFile  = copyString (c->errFile, &fail);
+
+    if (c->left && !(new->left = copyCMD (c->left)))
+	fail = true;
+    if (c->right && !(new->right = copyCMD (c->right)))
+	fail = true;
+
+    if (fail) {
+	freeCMD (new);
+	return NULL;
+    }
+    return new;
+}
@@ -0,0 +1,488 @@
+// dirstack.c
+//
+// The directory stack is a contiguous array whose last element is the
+// current directory, so that pushd and popd are O(1) and rotations and
+// removals from the middle are a single memmove().  Each entry caches a
+// file descriptor open on its directory, so returning to it is an fchdir()
+// rather than a path lookup.  Paths are logical:  .. removes the previous
+// component of $PWD instead of following symbolic links back up.
+#include "process.h"
+#include "dirstack.h"
+#include "test.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef O_PATH
+#define DIR_OPEN_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define DIR_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+
+// Structure for one entry in the directory stack
+typedef struct DirEntry {
+    char *path;         // Logical path
+    int fd;             // Open on the directory, or -1
+} DirEntry;
+
+static DirEntry *dir_stack = NULL;      // dir_stack[dir_count-1] is $PWD
+static int dir_count = 0;
+static int dir_cap = 0;
+
+// Structure for a directory stack that is not the shell's (see
+// dirstack_swap())
+struct DirStack {
+    DirEntry *entries;
+    int count;
+    int cap;
+};
+
+// Function to return the logical form of absolute path PATH:  repeated
+// slashes, . and .. components are removed without consulting the filesystem
+static char *canon_path(const char *path)
+{
+    size_t len = strlen(path);
+    char *out = malloc(len + 2);
+    size_t n = 0;
+
+    if (!out)
+    {
+        perror("malloc");
+        exit(errno);
+    }
+
+    for (const char *p = path; *p; )
+    {
+        while (*p == '/')
+        {
+            p++;
+        }
+        const char *end = p + strcspn(p, "/");
+        size_t clen = end - p;
+
+        if (clen == 0 || (clen == 1 && p[0] == '.'))
+        {
+            ;
+        }
+        else if (clen == 2 && p[0] == '.' && p[1] == '.')
+        {
+            while (n > 0 && out[n - 1] != '/')
+            {
+                n--;
+            }
+            if (n > 0)
+            {
+                n--;
+            }
+        }
+        else
+        {
+            out[n++] = '/';
+            memcpy(out + n, p, clen);
+            n += clen;
+        }
+        p = end;
+    }
+
+    if (n == 0)
+    {
+        out[n++] = '/';
+    }
+    out[n] = '\0';
+    return out;
+}
+
+// Function to set $PWD (and $OLDPWD to its previous value)
+static void export_pwd(const char *path)
+{
+    const char *old = getenv("PWD");
+    if (old && strcmp(old, path) != 0)
+    {
+        setenv("OLDPWD", old, 1);
+    }
+    setenv("PWD", path, 1);
+}
+
+// Function to create the stack on first use, with the current directory
+// taken from $PWD if that names it, and from getcwd() otherwise
+static void dir_stack_init(void)
+{
+    if (dir_count > 0)
+    {
+        return;
+    }
+
+    dir_cap = 8;
+    dir_stack = malloc(dir_cap * sizeof(*dir_stack));
+    if (!dir_stack)
+    {
+        perror("malloc");
+        exit(errno);
+    }
+
+    const char *pwd = getenv("PWD");
+    struct stat sp, sd;
+    char *path = NULL;
+    if (pwd && pwd[0] == '/' && stat(pwd, &sp) == 0 && stat(".", &sd) == 0
+        && sp.st_dev == sd.st_dev && sp.st_ino == sd.st_ino)
+    {
+        path = canon_path(pwd);
+    }
+    else
+    {
+        char cwd[PATH_MAX];
+        path = strdup(getcwd(cwd, sizeof(cwd)) ? cwd : ".");
+    }
+
+    dir_stack[0].path = path;
+    dir_stack[0].fd = open(".", DIR_OPEN_FLAGS);
+    dir_count = 1;
+    setenv("PWD", path, 1);
+}
+
+// Function to change to directory ARG (relative to the logical $PWD) and
+// return its logical path, or NULL after a diagnostic naming builtin NAME
+static char *change_dir(const char *name, const char *arg)
+{
+    char *logical;
+    if (arg[0] == '/')
+    {
+        logical = canon_path(arg);
+    }
+    else
+    {
+        const char *pwd = dir_stack[dir_count - 1].path;
+        char *joined = malloc(strlen(pwd) + strlen(arg) + 2);
+        if (!joined)
+        {
+            perror("malloc");
+            exit(errno);
+        }
+        sprintf(joined, "%s/%s", pwd, arg);
+        logical = canon_path(joined);
+        free(joined);
+    }
+
+    // Relative paths in the stat cache mean something else afterwards
+    stat_cache_invalidate();
+
+    if (chdir(logical) == 0)
+    {
+        return logical;
+    }
+    free(logical);
+
+    // The logical path may not exist (e.g. .. out of a removed directory)
+    // even though the physical one does
+    if (chdir(arg) != 0)
+    {
+        WARN("%s: %s: %s\n", name, arg, strerror(errno));
+        return NULL;
+    }
+    char cwd[PATH_MAX];
+    return strdup(getcwd(cwd, sizeof(cwd)) ? cwd : arg);
+}
+
+// Function to make PATH the current (top) entry, replacing the old one
+static void set_top(char *path)
+{
+    DirEntry *top = &dir_stack[dir_count - 1];
+    free(top->path);
+    if (top->fd >= 0)
+    {
+        close(top->fd);
+    }
+    top->path = path;
+    top->fd = open(".", DIR_OPEN_FLAGS);
+    export_pwd(path);
+}
+
+// Function to change to the directory of stack entry E
+static int enter_entry(const char *name, const DirEntry *e)
+{
+    stat_cache_invalidate();
+    if ((e->fd >= 0 ? fchdir(e->fd) : chdir(e->path)) != 0)
+    {
+        WARN("%s: %s: %s\n", name, e->path, strerror(errno));
+        return 1;
+    }
+    export_pwd(e->path);
+    return 0;
+}
+
+// Function to print the stack, current directory first (VERBOSE numbers the
+// entries one per line as dirs -v does)
+static void print_dir_stack(bool verbose)
+{
+    for (int i = 0; i < dir_count; i++)
+    {
+        const char *path = dir_stack[dir_count - 1 - i].path;
+        if (verbose)
+        {
+            fprintf(BSTDOUT, "%2d  %s\n", i, path);
+        }
+        else
+        {
+            fprintf(BSTDOUT, i ? " %s" : "%s", path);
+        }
+    }
+    if (!verbose)
+    {
+        fputc('\n', BSTDOUT);
+    }
+    fflush(BSTDOUT);
+}
+
+// Function to convert stack position ARG (+N counts from the current
+// directory, -N from the bottom) into an index in dir_stack; returns -1
+// after a diagnostic naming builtin NAME if it is out of range
+static int stack_index(const char *name, const char *arg)
+{
+    char *end;
+    long n = strtol(arg + 1, &end, 10);
+    if (arg[1] == '\0' || *end != '\0' || n < 0 || n >= dir_count)
+    {
+        WARN("%s: %s: directory stack index out of range\n", name, arg);
+        return -1;
+    }
+    return (arg[0] == '+') ? dir_count - 1 - (int) n : (int) n;
+}
+
+// Function to rotate the stack so that index I becomes the top
+static void rotate_to(int i)
+{
+    int above = dir_count - 1 - i;      // Entries above I move to the bottom
+    if (above == 0)
+    {
+        return;
+    }
+    DirEntry *tmp = malloc(above * sizeof(*tmp));
+    if (!tmp)
+    {
+        perror("malloc");
+        exit(errno);
+    }
+    memcpy(tmp, dir_stack + i + 1, above * sizeof(*tmp));
+    memmove(dir_stack + above, dir_stack, (i + 1) * sizeof(*tmp));
+    memcpy(dir_stack, tmp, above * sizeof(*tmp));
+    free(tmp);
+}
+
+// Function to handle cd
+int builtin_cd(int argc, char **argv)
+{
+    dir_stack_init();
+
+    const char *arg;
+    if (argc == 1)
+    {
+        arg = getenv("HOME");
+        if (!arg)
+        {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        }
+    }
+    else if (argc == 2)
+    {
+        arg = argv[1];
+        if (strcmp(arg, "-") == 0)
+        {
+            arg = getenv("OLDPWD");
+            if (!arg)
+            {
+                fprintf(stderr, "cd: OLDPWD not set\n");
+                return 1;
+            }
+        }
+    }
+    else
+    {
+        fprintf(stderr, "cd: too many arguments\n");
+        return 1;
+    }
+
+    char *path = change_dir("cd", arg);
+    if (!path)
+    {
+        return 1;
+    }
+    set_top(path);
+    if (argc == 2 && strcmp(argv[1], "-") == 0)
+    {
+        fprintf(BSTDOUT, "%s\n", path);
+        fflush(BSTDOUT);
+    }
+    return 0;
+}
+
+// Function to handle pushd
+int builtin_pushd(int argc, char **argv)
+{
+    dir_stack_init();
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "pushd: wrong number of arguments\n");
+        return 1;
+    }
+
+    if (argc == 1 || argv[1][0] == '+' || argv[1][0] == '-')
+    {
+        // Rotate:  with no argument, exchange the top two entries
+        int i;
+        if (argc == 1)
+        {
+            if (dir_count < 2)
+            {
+                fprintf(stderr, "pushd: no other directory\n");
+                return 1;
+            }
+            DirEntry swap = dir_stack[dir_count - 1];
+            dir_stack[dir_count - 1] = dir_stack[dir_count - 2];
+            dir_stack[dir_count - 2] = swap;
+            i = dir_count - 1;
+        }
+        else if ((i = stack_index("pushd", argv[1])) < 0)
+        {
+            return 1;
+        }
+        else
+        {
+            rotate_to(i);
+        }
+        if (enter_entry("pushd", &dir_stack[dir_count - 1]) != 0)
+        {
+            return 1;
+        }
+        print_dir_stack(false);
+        return 0;
+    }
+
+    // Keep the old top (and its cached fd) and push a new entry above it
+    if (dir_count == dir_cap)
+    {
+        dir_cap *= 2;
+        REALLOC(dir_stack, dir_cap);
+        if (!dir_stack)
+        {
+            perror("realloc");
+            exit(errno);
+        }
+    }
+    char *path = change_dir("pushd", argv[1]);
+    if (!path)
+    {
+        return 1;
+    }
+    dir_stack[dir_count].path = NULL;
+    dir_stack[dir_count].fd = -1;
+    dir_count++;
+    set_top(path);
+    print_dir_stack(false);
+    return 0;
+}
+
+// Function to handle popd
+int builtin_popd(int argc, char **argv)
+{
+    dir_stack_init();
+
+    if (argc > 2 || (argc == 2 && argv[1][0] != '+' && argv[1][0] != '-'))
+    {
+        fprintf(stderr, "popd: wrong number of arguments\n");
+        return 1;
+    }
+    if (dir_count < 2)
+    {
+        fprintf(stderr, "popd: directory stack empty\n");
+        return 1;
+    }
+
+    int i = dir_count - 1;
+    if (argc == 2 && (i = stack_index("popd", argv[1])) < 0)
+    {
+        return 1;
+    }
+
+    if (i == dir_count - 1 && enter_entry("popd", &dir_stack[i - 1]) != 0)
+    {
+        return 1;
+    }
+
+    free(dir_stack[i].path);
+    if (dir_stack[i].fd >= 0)
+    {
+        close(dir_stack[i].fd);
+    }
+    memmove(dir_stack + i, dir_stack + i + 1,
+            (dir_count - 1 - i) * sizeof(*dir_stack));
+    dir_count--;
+    print_dir_stack(false);
+    return 0;
+}
+
+// Function to handle dirs
+int builtin_dirs(int argc, char **argv)
+{
+    dir_stack_init();
+
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-v") != 0))
+    {
+        fprintf(stderr, "dirs: usage: dirs [-v]\n");
+        return 1;
+    }
+    print_dir_stack(argc == 2);
+    return 0;
+}
+
+// Function to return the logical current directory
+const char *shell_pwd(void)
+{
+    dir_stack_init();
+    return dir_stack[dir_count - 1].path;
+}
+
+// Function to make STACK the shell's directory stack
+DirStack *dirstack_swap(DirStack *stack)
+{
+    DirStack *old = malloc(sizeof(*old));
+    if (!old)
+    {
+        perror("malloc");
+        exit(errno);
+    }
+    *old = (DirStack) { dir_stack, dir_count, dir_cap };
+
+    if (stack)
+    {
+        dir_stack = stack->entries;
+        dir_count = stack->count;
+        dir_cap = stack->cap;
+        free(stack);
+    }
+    else
+    {
+        dir_stack = NULL;
+        dir_count = dir_cap = 0;
+    }
+    return old;
+}
+
+// Function to free a directory stack that is not in use
+void dirstack_free(DirStack *stack)
+{
+    if (!stack)
+    {
+        return;
+    }
+    for (int i = 0; i < stack->count; i++)
+    {
+        free(stack->entries[i].path);
+        if (stack->entries[i].fd >= 0)
+        {
+            close(stack->entries[i].fd);
+        }
+    }
+    free(stack->entries);
+    free(stack);
+}
@@ -0,0 +1,34 @@
+// dirstack.h
+//
+// Logical working directory ($PWD) and the directory stack used by the cd,
+// pushd, popd and dirs builtins.
+
+#ifndef DIRSTACK_INCLUDED
+#define DIRSTACK_INCLUDED
+
+// Handle the cd builtin:  cd [DIR | -]
+int builtin_cd(int argc, char **argv);
+
+// Handle the pushd builtin:  pushd [DIR | +N | -N]
+int builtin_pushd(int argc, char **argv);
+
+// Handle the popd builtin:  popd [+N | -N]
+int builtin_popd(int argc, char **argv);
+
+// Handle the dirs builtin:  dirs [-v]
+int builtin_dirs(int argc, char **argv);
+
+// Return the logical current directory
+const char *shell_pwd(void);
+
+// A directory stack set aside, such as that of a context in bsh.h
+typedef struct DirStack DirStack;
+
+// Make STACK the shell's directory stack (NULL for an empty one, which is set
+// up from $PWD on first use) and return the one it replaces
+DirStack *dirstack_swap(DirStack *stack);
+
+// Free STACK (from dirstack_swap()), closing its directories
+void dirstack_free(DirStack *stack);
+
+#endif
@@ -0,0 +1,364 @@
+// enable.c
+//
+// Loading builtins from shared objects, and running them.
+#include "process.h"
+#include "enable.h"
+#include "plugin.h"
+#include "capture.h"
+#include <dlfcn.h>
+#include <fcntl.h>
+
+// Number of buckets in the table of loaded builtins
+#define LOADABLE_BUCKETS 64
+
+// Structure for a shared object that builtins were loaded from
+typedef struct Library {
+    char *path;                 // As given to enable -f
+    void *handle;               // From dlopen()
+    int refs;                   // Number of its builtins that are loaded
+    struct Library *next;
+} Library;
+
+// Structure for a loaded builtin
+typedef struct Loadable {
+    const BshBuiltin *builtin;  // Its definition in the library
+    Library *lib;               // The library
+    struct Loadable *next;      // Next in its bucket
+} Loadable;
+
+static Loadable *loadables[LOADABLE_BUCKETS];
+static Library *libraries = NULL;
+static int nloadables = 0;
+
+// Function to hash NAME into a bucket
+static unsigned loadable_hash(const char *name)
+{
+    unsigned long h = 5381;
+    while (*name)
+    {
+        h = h * 33 + (unsigned char) *name++;
+    }
+    return h % LOADABLE_BUCKETS;
+}
+
+// Function to find loaded builtin NAME (NULL if none)
+static Loadable *loadable_find(const char *name)
+{
+    if (nloadables == 0)
+    {
+        return NULL;
+    }
+    for (Loadable *l = loadables[loadable_hash(name)]; l; l = l->next)
+    {
+        if (strcmp(l->builtin->name, name) == 0)
+        {
+            return l;
+        }
+    }
+    return NULL;
+}
+
+// Function to open shared object PATH, or find it if it is open already
+static Library *library_open(const char *path)
+{
+    for (Library *lib = libraries; lib; lib = lib->next)
+    {
+        if (strcmp(lib->path, path) == 0)
+        {
+            return lib;
+        }
+    }
+
+    // A name without a '/' is looked up by dlopen() in the library path
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+    {
+        WARN("enable: %s\n", dlerror());
+        return NULL;
+    }
+    Library *lib = malloc(sizeof(*lib));
+    *lib = (Library) { strdup(path), handle, 0, libraries };
+    libraries = lib;
+    return lib;
+}
+
+// Function to close LIB if none of its builtins is loaded
+static void library_release(Library *lib)
+{
+    if (lib->refs > 0)
+    {
+        return;
+    }
+    for (Library **p = &libraries; *p; p = &(*p)->next)
+    {
+        if (*p == lib)
+        {
+            *p = lib->next;
+            break;
+        }
+    }
+    dlclose(lib->handle);
+    free(lib->path);
+    free(lib);
+}
+
+// Function to load builtin NAME from LIB
+static int loadable_add(Library *lib, const char *name)
+{
+    char symbol[PATH_MAX];
+    snprintf(symbol, sizeof(symbol), "bsh_builtin_%s", name);
+    for (char *s = symbol; *s; s++)
+    {
+        if (*s == '-')
+        {
+            *s = '_';
+        }
+    }
+
+    const BshBuiltin *b = dlsym(lib->handle, symbol);
+    if (!b)
+    {
+        WARN("enable: %s: %s not found in %s\n", name, symbol, lib->path);
+        return 1;
+    }
+    if (b->abi != BSH_BUILTIN_ABI || !b->run || !b->name || strcmp(b->name, name) != 0)
+    {
+        WARN("enable: %s: not a builtin for this shell (ABI %d)\n", name, b->abi);
+        return 1;
+    }
+
+    // Loading a builtin again replaces it
+    unsigned h = loadable_hash(name);
+    Loadable *l = loadable_find(name);
+    if (l)
+    {
+        Library *old = l->lib;
+        l->builtin = b;
+        l->lib = lib;
+        lib->refs++;
+        old->refs--;
+        library_release(old);
+        return 0;
+    }
+    l = malloc(sizeof(*l));
+    *l = (Loadable) { b, lib, loadables[h] };
+    loadables[h] = l;
+    lib->refs++;
+    nloadables++;
+    return 0;
+}
+
+// Function to unload builtin NAME
+static int loadable_remove(const char *name)
+{
+    for (Loadable **p = &loadables[loadable_hash(name)]; *p; p = &(*p)->next)
+    {
+        Loadable *l = *p;
+        if (strcmp(l->builtin->name, name) == 0)
+        {
+            *p = l->next;
+            nloadables--;
+            l->lib->refs--;
+            library_release(l->lib);
+            free(l);
+            return 0;
+        }
+    }
+    WARN("enable: %s: not a loaded builtin\n", name);
+    return 1;
+}
+
+// Function to list the loaded builtins
+static int loadable_list(void)
+{
+    for (int i = 0; i < LOADABLE_BUCKETS; i++)
+    {
+        for (Loadable *l = loadables[i]; l; l = l->next)
+        {
+            fprintf(BSTDOUT, "enable -f %s %s\n", l->lib->path, l->builtin->name);
+        }
+    }
+    fflush(BSTDOUT);
+    return 0;
+}
+
+// Function to handle enable
+int builtin_enable(int argc, char **argv)
+{
+    if (argc == 1)
+    {
+        return loadable_list();
+    }
+
+    int status = 0;
+    if (argc > 3 && strcmp(argv[1], "-f") == 0)
+    {
+        Library *lib = library_open(argv[2]);
+        if (!lib)
+        {
+            return 1;
+        }
+        for (int i = 3; i < argc; i++)
+        {
+            status |= loadable_add(lib, argv[i]);
+        }
+        library_release(lib);
+        return status;
+    }
+    if (argc > 2 && strcmp(argv[1], "-d") == 0)
+    {
+        for (int i = 2; i < argc; i++)
+        {
+            status |= loadable_remove(argv[i]);
+        }
+        return status;
+    }
+
+    WARN("%s\n", "enable: usage: enable [-f LIB NAME... | -d NAME...]");
+    return 2;
+}
+
+// Function to return shell variable NAME (for builtins)
+static const char *shell_get_var(const char *name)
+{
+    return getenv(name);
+}
+
+// Function to set shell variable NAME (for builtins)
+static int shell_set_var(const char *name, const char *value)
+{
+    if (builtin_isolated)
+    {
+        return 0;
+    }
+    if ((value ? setenv(name, value, 1) : unsetenv(name)) < 0)
+    {
+        return errno;
+    }
+    return 0;
+}
+
+// Function to call builtin L with the descriptors IN, OUT and ERR
+static int loadable_call(const Loadable *l, const CMD *cmd, int in, int out, int err)
+{
+    BshShell sh = { BSH_BUILTIN_ABI, in, out, err, shell_get_var, shell_set_var };
+    return l->builtin->run(&sh, cmd->argc, cmd->argv);
+}
+
+// Function to open the output redirection of CMD; returns the descriptor
+// (STDOUT_FILENO if there is none) or -1 on error
+static int loadable_output(const CMD *cmd)
+{
+    int flags = O_WRONLY | O_CREAT;
+    if (cmd->toType == RED_OUT || cmd->toType == RED_OUT_ERR)
+    {
+        flags |= O_TRUNC;
+    }
+    else if (cmd->toType == RED_OUT_APP)
+    {
+        flags |= O_APPEND;
+    }
+    else
+    {
+        return STDOUT_FILENO;
+    }
+    int fd = open(cmd->toFile, flags, 0644);
+    if (fd < 0)
+    {
+        perror("open");
+    }
+    return fd;
+}
+
+// Function to run CMD if it is a loaded builtin
+int loadable_run(const CMD *cmd)
+{
+    Loadable *l = loadable_find(cmd->argv[0]);
+    if (!l)
+    {
+        return -1;
+    }
+
+    int in = builtin_input(cmd);
+    if (in < 0)
+    {
+        return errno;
+    }
+    int out = loadable_output(cmd);
+    if (out < 0)
+    {
+        int saved = errno;
+        if (in != STDIN_FILENO)
+        {
+            close(in);
+        }
+        return saved;
+    }
+    // Without a redirection, the builtin writes where the thread's output
+    // goes (see capture.h)
+    int cap_out, cap_err;
+    capture_fds(&cap_out, &cap_err);
+    int to = (out == STDOUT_FILENO && cap_out >= 0) ? cap_out : out;
+    int err = (cmd->toType == RED_OUT_ERR) ? out
+            : (cap_err >= 0) ? cap_err : STDERR_FILENO;
+
+    // Local variables are visible to the builtin only
+    char **saved = calloc(cmd->nLocal + 1, sizeof(*saved));
+    for (int i = 0; i < cmd->nLocal; i++)
+    {
+        char *old = getenv(cmd->locVar[i]);
+        saved[i] = old ? strdup(old) : NULL;
+        setenv(cmd->locVar[i], cmd->locVal[i], 1);
+    }
+
+    // Whatever the shell has buffered comes first
+    fflush(stdout);
+    fflush(stderr);
+    int status = loadable_call(l, cmd, in, to, err);
+
+    for (int i = cmd->nLocal - 1; i >= 0; i--)
+    {
+        if (saved[i])
+        {
+            setenv(cmd->locVar[i], saved[i], 1);
+        }
+        else
+        {
+            unsetenv(cmd->locVar[i]);
+        }
+        free(saved[i]);
+    }
+    free(saved);
+
+    if (in != STDIN_FILENO)
+    {
+        close(in);
+    }
+    if (out != STDOUT_FILENO)
+    {
+        close(out);
+    }
+    return status;
+}
+
+// Function to check whether NAME is a loaded builtin
+bool loadable_loaded(const char *name)
+{
+    return loadable_find(name) != NULL;
+}
+
+// Function to check whether CMD is a loaded builtin that may run in a thread
+bool loadable_threadable(const CMD *cmd)
+{
+    Loadable *l = loadable_find(cmd->argv[0]);
+    return l && (l->builtin->flags & BSH_BUILTIN_THREADSAFE);
+}
+
+// Function to run loaded builtin CMD as a pipeline stage
+int loadable_stage(const CMD *cmd, int in, int out)
+{
+    int cap_out, cap_err;
+    capture_fds(&cap_out, &cap_err);
+    return loadable_call(loadable_find(cmd->argv[0]), cmd, in, out,
+                         (cap_err >= 0) ? cap_err : STDERR_FILENO);
+}
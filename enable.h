@@ -0,0 +1,30 @@
+// enable.h
+//
+// Builtins loaded from shared objects (see plugin.h).  Loaded builtins are
+// kept in a hash table that handle_builtin() consults after the shell's own
+// builtins.
+
+#ifndef ENABLE_INCLUDED
+#define ENABLE_INCLUDED
+
+// Handle the enable builtin:
+//   enable                List the loaded builtins
+//   enable -f LIB NAME... Load builtins NAME... from shared object LIB
+//   enable -d NAME...     Unload builtins NAME...
+int builtin_enable(int argc, char **argv);
+
+// Run CMD if it is a loaded builtin, with its redirections and local
+// variables, and return its status; return -1 if it is not
+int loadable_run(const CMD *cmd);
+
+// Return true if NAME is a loaded builtin
+bool loadable_loaded(const char *name);
+
+// Return true if CMD is a loaded builtin that may run in a thread
+bool loadable_threadable(const CMD *cmd);
+
+// Run loaded builtin CMD (for which loadable_threadable() is true) in a
+// pipeline stage thread, reading IN and writing OUT; return its status
+int loadable_stage(const CMD *cmd, int in, int out);
+
+#endif
@@ -0,0 +1,38 @@
+// eval.c
+//
+// Evaluation of one command line.
+#include "process.h"
+#include "eval.h"
+#include "expand.h"
+#include "test.h"
+#include "read.h"
+
+// Function to evaluate command line LINE
+int eval_line(const char *line)
+{
+    char *text = expand(line);
+    if (!text)
+    {
+        update_status(1);
+        return 1;
+    }
+    token *list = tokenize(text);
+    free(text);
+    if (!list)
+    {
+        return 0;
+    }
+    CMD *cmd = parse(list);
+    freeList(list);
+    if (!cmd)
+    {
+        update_status(2);
+        return 2;
+    }
+
+    int status = process(cmd);
+    freeCMD(cmd);
+    stat_cache_invalidate();
+    read_buffer_release();
+    return status;
+}
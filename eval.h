@@ -0,0 +1,13 @@
+// eval.h
+//
+// Evaluation of one command line outside the interactive loop in main().
+
+#ifndef EVAL_INCLUDED
+#define EVAL_INCLUDED
+
+// Expand, tokenize, parse and execute command line LINE, then do the
+// housekeeping that main() does after each line; returns the status of the
+// line (1 if expansion failed and 2 if it did not parse)
+int eval_line(const char *line);
+
+#endif
@@ -0,0 +1,232 @@
+// events.c
+//
+// JSONL job events on $BSH_EVENTS_FD.  Events are built in a buffer on the
+// stack and written with one write(), so that they can be sent from the
+// SIGCHLD handler.
+#include "process.h"
+#include "events.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// Largest event, so that a write to a pipe is atomic
+#define EVENT_MAX PIPE_BUF
+
+// Room kept for the fields after a command
+#define EVENT_RESERVE 1024
+
+// Structure for an event being built
+typedef struct Event {
+    char buf[EVENT_MAX];
+    size_t len;
+} Event;
+
+static int events_fd = -1;
+static _Atomic unsigned long events_dropped = 0;
+static unsigned long events_reported = 0;
+
+// Function to start writing events
+void events_init(void)
+{
+    const char *s = getenv("BSH_EVENTS_FD");
+    if (!s || !*s)
+    {
+        return;
+    }
+    char *end;
+    long fd = strtol(s, &end, 10);
+    int flags;
+    if (*end != '\0' || fd < 0 || fd > INT_MAX || (flags = fcntl(fd, F_GETFL)) < 0)
+    {
+        WARN("BSH_EVENTS_FD: %s: not an open descriptor\n", s);
+        return;
+    }
+
+    // The descriptor is ours:  commands do not inherit it, and a consumer
+    // that falls behind costs events, not time
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    events_fd = fd;
+}
+
+// Function to check whether events are being written
+bool events_enabled(void)
+{
+    return events_fd >= 0;
+}
+
+// Function to return the time in seconds since the epoch
+double events_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to append to E as printf() would, if it fits
+static void ev_printf(Event *e, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(e->buf + e->len, sizeof(e->buf) - e->len, format, ap);
+    va_end(ap);
+    if (n > 0 && e->len + n < sizeof(e->buf))
+    {
+        e->len += n;
+    }
+}
+
+// Function to start event TYPE in E
+static void ev_begin(Event *e, const char *type)
+{
+    e->len = 0;
+    ev_printf(e, "{\"event\":\"%s\",\"ts\":%.6f", type, events_now());
+}
+
+// Function to append member KEY with string value S to E; S is cut short
+// to leave EVENT_RESERVE bytes for what follows
+static void ev_string(Event *e, const char *key, const char *s)
+{
+    ev_printf(e, ",\"%s\":\"", key);
+    size_t limit = sizeof(e->buf) - EVENT_RESERVE;
+    for ( ; s && *s && e->len + 8 < limit; s++)
+    {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+        {
+            e->buf[e->len++] = '\\';
+            e->buf[e->len++] = c;
+        }
+        else if (c == '\n')
+        {
+            e->buf[e->len++] = '\\';
+            e->buf[e->len++] = 'n';
+        }
+        else if (c < 0x20 || c == 0x7F)
+        {
+            ev_printf(e, "\\u%04x", c);
+        }
+        else
+        {
+            e->buf[e->len++] = c;
+        }
+    }
+    ev_printf(e, "\"");
+}
+
+// Function to append resource usage RU to E
+static void ev_rusage(Event *e, const struct rusage *ru)
+{
+    ev_printf(e, ",\"rusage\":{\"utime\":%.6f,\"stime\":%.6f,\"maxrss\":%ld,"
+              "\"minflt\":%ld,\"majflt\":%ld,\"inblock\":%ld,\"oublock\":%ld,"
+              "\"nvcsw\":%ld,\"nivcsw\":%ld}",
+              ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6,
+              ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6,
+              ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt, ru->ru_inblock,
+              ru->ru_oublock, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+// Function to finish E and write it
+static void ev_end(Event *e)
+{
+    int saved = errno;
+    unsigned long dropped = atomic_load(&events_dropped);
+    if (dropped != events_reported)
+    {
+        ev_printf(e, ",\"dropped\":%lu", dropped);
+    }
+    ev_printf(e, "}\n");
+
+    if (write(events_fd, e->buf, e->len) == (ssize_t) e->len)
+    {
+        events_reported = dropped;
+    }
+    else
+    {
+        atomic_fetch_add(&events_dropped, 1);
+    }
+    errno = saved;
+}
+
+// Function to report a fork
+void events_spawn(pid_t pid, pid_t pgid, const char *text)
+{
+    if (events_fd < 0)
+    {
+        return;
+    }
+    Event e;
+    ev_begin(&e, "spawn");
+    ev_printf(&e, ",\"pid\":%d,\"pgid\":%d", (int) pid, (int) pgid);
+    ev_string(&e, "cmd", text);
+    ev_end(&e);
+}
+
+// Function to report a change of state of a process
+void events_exit(pid_t pid, pid_t pgid, int status, const struct rusage *ru)
+{
+    if (events_fd < 0)
+    {
+        return;
+    }
+    Event e;
+    if (WIFSTOPPED(status))
+    {
+        ev_begin(&e, "stop");
+        ev_printf(&e, ",\"pid\":%d,\"pgid\":%d,\"signal\":%d",
+                  (int) pid, (int) pgid, WSTOPSIG(status));
+    }
+    else if (WIFSIGNALED(status))
+    {
+        ev_begin(&e, "signal");
+        ev_printf(&e, ",\"pid\":%d,\"pgid\":%d,\"signal\":%d,\"core\":%s,\"status\":%d",
+                  (int) pid, (int) pgid, WTERMSIG(status),
+                  WCOREDUMP(status) ? "true" : "false", STATUS(status));
+        ev_rusage(&e, ru);
+    }
+    else if (WIFEXITED(status))
+    {
+        ev_begin(&e, "exit");
+        ev_printf(&e, ",\"pid\":%d,\"pgid\":%d,\"status\":%d",
+                  (int) pid, (int) pgid, WEXITSTATUS(status));
+        ev_rusage(&e, ru);
+    }
+    else
+    {
+        return;
+    }
+    ev_end(&e);
+}
+
+// Function to report a new job
+void events_job_start(int job, pid_t pgid, const char *text, bool stopped)
+{
+    if (events_fd < 0)
+    {
+        return;
+    }
+    Event e;
+    ev_begin(&e, "job_start");
+    ev_printf(&e, ",\"job\":%d,\"pgid\":%d,\"state\":\"%s\"",
+              job, (int) pgid, stopped ? "stopped" : "running");
+    ev_string(&e, "cmd", text);
+    ev_end(&e);
+}
+
+// Function to report a finished job
+void events_job_finish(int job, pid_t pgid, const char *text, int status,
+                       double start, const struct rusage *ru)
+{
+    if (events_fd < 0)
+    {
+        return;
+    }
+    Event e;
+    ev_begin(&e, "job_finish");
+    ev_printf(&e, ",\"job\":%d,\"pgid\":%d,\"status\":%d,\"start\":%.6f,\"elapsed\":%.6f",
+              job, (int) pgid, status, start, events_now() - start);
+    ev_string(&e, "cmd", text);
+    ev_rusage(&e, ru);
+    ev_end(&e);
+}
@@ -0,0 +1,56 @@
+// events.h
+//
+// Structured job events.  When $BSH_EVENTS_FD names an open descriptor, the
+// shell writes one JSON object per line to it for each event:
+//
+//   spawn       a process was forked:  pid, pgid, cmd
+//   exit        a process exited:  pid, pgid, status, rusage
+//   signal      a process was killed:  pid, pgid, signal, core, status,
+//               rusage
+//   stop        a process was stopped:  pid, pgid, signal
+//   job_start   a job entered the table:  job, pgid, cmd, state
+//   job_finish  a job left it:  job, pgid, cmd, status, start, elapsed, and
+//               the rusage of all of its processes
+//
+// Every event also has "event" and "ts" (seconds since the epoch), and the
+// first event written after some were dropped has "dropped" (how many so
+// far).  Writes never block:  the descriptor is made nonblocking, and an
+// event that does not fit in the pipe or socket is dropped and counted.
+// An event is at most PIPE_BUF bytes, so it is written whole or not at all
+// (commands are truncated to fit).  Forked subshells report their own
+// children on the same descriptor, which commands that they run do not
+// inherit.
+
+#ifndef EVENTS_INCLUDED
+#define EVENTS_INCLUDED
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Start writing events if $BSH_EVENTS_FD is set
+void events_init(void);
+
+// Return true if events are being written
+bool events_enabled(void);
+
+// Report that process PID was forked into process group PGID to run TEXT
+void events_spawn(pid_t pid, pid_t pgid, const char *text);
+
+// Report that process PID in group PGID changed state to STATUS (from
+// wait4(), with its resource usage RU)
+void events_exit(pid_t pid, pid_t pgid, int status, const struct rusage *ru);
+
+// Report that job JOB (process group PGID) running TEXT entered the table,
+// running or STOPPED
+void events_job_start(int job, pid_t pgid, const char *text, bool stopped);
+
+// Report that job JOB left the table with status STATUS after running TEXT
+// from time START (seconds since the epoch); RU is the total usage of its
+// processes
+void events_job_finish(int job, pid_t pgid, const char *text, int status,
+                       double start, const struct rusage *ru);
+
+// Return the current time in seconds since the epoch
+double events_now(void);
+
+#endif
@@ -0,0 +1,237 @@
+// every.c
+//
+// Scheduler jobs for the every builtin.
+#include "process.h"
+#include "watch.h"
+#include "every.h"
+#include <math.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+
+// Structure for the settings of a schedule
+typedef struct Every {
+    Watch *w;                   // Its watcher
+    int64_t interval_ns;        // Time between ticks
+    int64_t jitter_ns;          // Largest random delay of a run
+} Every;
+
+// Function to parse a duration such as 5, 2.5s, 250ms, 10m or 1h into
+// nanoseconds; returns -1 if invalid
+static int64_t parse_duration(const char *s)
+{
+    char *end;
+    errno = 0;
+    double value = strtod(s, &end);
+    if (end == s || errno == ERANGE || !isfinite(value) || value < 0)
+    {
+        return -1;
+    }
+
+    double scale;
+    if (strcmp(end, "") == 0 || strcmp(end, "s") == 0)
+    {
+        scale = 1e9;
+    }
+    else if (strcmp(end, "ms") == 0)
+    {
+        scale = 1e6;
+    }
+    else if (strcmp(end, "m") == 0)
+    {
+        scale = 60e9;
+    }
+    else if (strcmp(end, "h") == 0)
+    {
+        scale = 3600e9;
+    }
+    else
+    {
+        return -1;
+    }
+
+    value *= scale;
+    return (value >= (double) INT64_MAX) ? -1 : (int64_t) value;
+}
+
+// Function to format duration NS into BUF (of size N) in the largest unit
+// that gives a whole number, or in seconds
+static void format_duration(int64_t ns, char *buf, size_t n)
+{
+    if (ns % 3600000000000LL == 0)
+    {
+        snprintf(buf, n, "%lldh", (long long) (ns / 3600000000000LL));
+    }
+    else if (ns % 60000000000LL == 0)
+    {
+        snprintf(buf, n, "%lldm", (long long) (ns / 60000000000LL));
+    }
+    else if (ns % 1000000000 == 0)
+    {
+        snprintf(buf, n, "%llds", (long long) (ns / 1000000000));
+    }
+    else if (ns % 1000000 == 0)
+    {
+        snprintf(buf, n, "%lldms", (long long) (ns / 1000000));
+    }
+    else
+    {
+        snprintf(buf, n, "%gs", ns / 1e9);
+    }
+}
+
+// Function to arm timerfd FD to expire after FIRST ns and then every PERIOD ns
+// (never again if PERIOD is 0)
+static void arm_timer(int fd, int64_t first, int64_t period)
+{
+    struct itimerspec its;
+    if (first <= 0)
+    {
+        first = 1;                          // 0 would disarm the timer
+    }
+    its.it_value.tv_sec = first / 1000000000;
+    its.it_value.tv_nsec = first % 1000000000;
+    its.it_interval.tv_sec = period / 1000000000;
+    its.it_interval.tv_nsec = period % 1000000000;
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+// Function to run the scheduler of schedule E (in the background job); only
+// returns if the timers cannot be set up
+static int every_scheduler(const void *arg)
+{
+    const Every *e = arg;
+    Watch *w = e->w;
+    WatchStats *stats = w->stats;
+
+    int chld_fd = watch_init();
+    int tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int jitter_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tick_fd < 0 || jitter_fd < 0 || chld_fd < 0)
+    {
+        perror("every");
+        return errno;
+    }
+
+    // The first tick is immediate; the later ones are at multiples of the
+    // interval from it, however long the runs take
+    arm_timer(tick_fd, 0, e->interval_ns);
+
+    uint64_t seed = (uint64_t) watch_now() ^ ((uint64_t) getpid() << 32);
+    bool pending = false;                   // Waiting out the jitter
+
+    for (;;)
+    {
+        struct pollfd pfd[3] = {
+            { tick_fd, POLLIN, 0 }, { jitter_fd, POLLIN, 0 }, { chld_fd, POLLIN, 0 }
+        };
+        if (poll(pfd, 3, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            return errno;
+        }
+
+        if (pfd[2].revents & POLLIN)
+        {
+            watch_reap(w, chld_fd);
+        }
+
+        bool start = false;
+        if (pfd[0].revents & POLLIN)
+        {
+            // More than one expiration means ticks passed unserved
+            uint64_t ticks = 0;
+            if (read(tick_fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+            {
+                ticks = 0;
+            }
+            stats->events += ticks;
+            if (ticks > 0)
+            {
+                if (w->run > 0 || pending)
+                {
+                    stats->skipped += ticks;
+                }
+                else
+                {
+                    stats->skipped += ticks - 1;
+                    if (e->jitter_ns > 0)
+                    {
+                        seed ^= seed << 13;
+                        seed ^= seed >> 7;
+                        seed ^= seed << 17;
+                        arm_timer(jitter_fd, seed % (uint64_t) (e->jitter_ns + 1), 0);
+                        pending = true;
+                    }
+                    else
+                    {
+                        start = true;
+                    }
+                }
+            }
+        }
+        if (pfd[1].revents & POLLIN)
+        {
+            uint64_t ticks;
+            if (read(jitter_fd, &ticks, sizeof(ticks)) == sizeof(ticks) && pending)
+            {
+                pending = false;
+                start = true;
+            }
+        }
+
+        if (start)
+        {
+            watch_run(w);
+        }
+    }
+}
+
+// Function to handle the every builtin
+int builtin_every(int argc, char **argv)
+{
+    if (argc == 1)
+    {
+        return watch_list("every");
+    }
+
+    int64_t interval = parse_duration(argv[1]);
+    int64_t jitter = 0;
+    int i = 2;
+    if (i + 1 < argc && strcmp(argv[i], "--max-jitter") == 0)
+    {
+        jitter = parse_duration(argv[i + 1]);
+        if (jitter < 0)
+        {
+            WARN("every: %s: invalid jitter\n", argv[i + 1]);
+            return 1;
+        }
+        i += 2;
+    }
+    if (interval < 1000000)
+    {
+        WARN("every: %s: invalid interval (at least 1ms)\n", argv[1]);
+        return 1;
+    }
+    if (i >= argc || strcmp(argv[i], "--") != 0 || i + 1 >= argc)
+    {
+        WARN("%s\n", "usage: every INTERVAL [--max-jitter J] -- COMMAND-LINE");
+        return 1;
+    }
+
+    int status;
+    Watch *w = watch_new("every", argc, argv, i + 1, &status);
+    if (!w)
+    {
+        return status;
+    }
+    char interval_text[32];
+    format_duration(interval, interval_text, sizeof(interval_text));
+    snprintf(w->desc, sizeof(w->desc), "every %s", interval_text);
+
+    Every e = { w, interval, jitter };
+    return watch_start(w, every_scheduler, &e, argc, argv);
+}
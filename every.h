@@ -0,0 +1,21 @@
+// every.h
+//
+// Periodic commands.  every INTERVAL -- COMMAND-LINE starts a background job
+// that runs COMMAND-LINE on the ticks of a periodic timerfd, so the schedule
+// does not drift the way a loop with sleep does.  The line is parsed once,
+// when the schedule is created.  A tick that arrives while the previous run
+// is still going is skipped rather than queued, and the latency of each run
+// (fork to exit) is recorded where the shell can report it.
+
+#ifndef EVERY_INCLUDED
+#define EVERY_INCLUDED
+
+// Handle the every builtin:
+//   every INTERVAL [--max-jitter J] -- COMMAND-LINE
+//                       Run COMMAND-LINE every INTERVAL (a number with an
+//                       optional ms, s, m or h suffix; seconds by default),
+//                       delaying each run by a random 0 .. J
+//   every               List the schedules that are running with their stats
+int builtin_every(int argc, char **argv);
+
+#endif
@@ -0,0 +1,1111 @@
+// expand.c
+//
+// Expansion of variables and arithmetic in a command line.
+#include "process.h"
+#include "expand.h"
+#include "arith.h"
+#include <ctype.h>
+
+// Growable output string
+typedef struct Buf {
+    char *s;            // Contents (always null-terminated)
+    size_t len;         // Length of contents
+    size_t cap;         // Allocated size
+} Buf;
+
+// How expanded text is written to the output
+enum {
+    EMIT_RAW,           // As is (inside $(( ... )))
+    EMIT_WORD,          // Outside quotes:  metacharacters are escaped
+    EMIT_QUOTED         // Inside double quotes:  " and \ are escaped
+};
+
+static int expand_into(Buf *out, const char *s, size_t n, int mode);
+
+// Function to make room for N more characters in B
+static void buf_reserve(Buf *b, size_t n)
+{
+    if (b->len + n + 1 <= b->cap)
+    {
+        return;
+    }
+    size_t cap = b->cap ? b->cap : 64;
+    while (cap < b->len + n + 1)
+    {
+        cap *= 2;
+    }
+    REALLOC(b->s, cap);
+    if (!b->s)
+    {
+        perror("realloc");
+        exit(errno);
+    }
+    b->cap = cap;
+}
+
+// Function to append the N characters at S to B
+static void buf_putn(Buf *b, const char *s, size_t n)
+{
+    buf_reserve(b, n);
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+}
+
+// Function to append the N characters at S to B, escaped according to MODE
+static void buf_emitn(Buf *b, const char *s, size_t n, int mode)
+{
+    for (const char *end = s + n; s < end; s++)
+    {
+        bool escape = (mode == EMIT_WORD)
+                    ? (strchr(METACHAR "\"'\\", *s) != NULL)
+                    : (mode == EMIT_QUOTED && (*s == '"' || *s == '\\'));
+        if (escape)
+        {
+            buf_putn(b, "\\", 1);
+        }
+        buf_putn(b, s, 1);
+    }
+}
+
+// Function to append string S to B, escaped according to MODE
+static void buf_emit(Buf *b, const char *s, int mode)
+{
+    buf_emitn(b, s, strlen(s), mode);
+}
+
+// Function to find the end of the $(( ... )) whose expression starts at S;
+// returns the length of the expression or -1 if the )) is missing
+static long arith_length(const char *s, const char *end)
+{
+    int depth = 0;
+    for (const char *p = s; p < end; p++)
+    {
+        if (*p == '(')
+        {
+            depth++;
+        }
+        else if (*p == ')' && depth > 0)
+        {
+            depth--;
+        }
+        else if (*p == ')')
+        {
+            return (p + 1 < end && p[1] == ')') ? p - s : -1;
+        }
+    }
+    return -1;
+}
+
+// Function to look up the variable whose name is the LEN characters at NAME
+// without copying the name; returns its value or NULL if it is unset
+static const char *env_lookup(const char *name, size_t len)
+{
+    for (char **e = environ; *e; e++)
+    {
+        if (strncmp(*e, name, len) == 0 && (*e)[len] == '=')
+        {
+            return *e + len + 1;
+        }
+    }
+    return NULL;
+}
+
+// Function to find the first of the characters in STOPS that occurs at the
+// top level of the N characters at S, i.e., outside quotes, backslash escapes
+// and nested { ... } or ( ... ); QUOTED text starts inside double quotes.
+// Returns its offset, or N if there is none.
+static size_t word_span(const char *s, size_t n, const char *stops,
+                        bool quoted)
+{
+    bool in_single = false, in_double = quoted;
+    int depth = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        char c = s[i];
+        if (in_single)
+        {
+            in_single = (c != '\'');
+        }
+        else if (c == '\\')
+        {
+            i++;
+        }
+        else if (c == '\'' && !in_double)
+        {
+            in_single = true;
+        }
+        else if (c == '"')
+        {
+            in_double = !in_double;
+        }
+        else if (c == '$' && i + 1 < n && (s[i+1] == '{' || s[i+1] == '('))
+        {
+            depth++;
+            i++;
+        }
+        else if (c == '{' || (c == '(' && depth > 0))
+        {
+            depth++;
+        }
+        else if ((c == '}' || c == ')') && depth > 0)
+        {
+            depth--;
+        }
+        else if (in_double == quoted && depth == 0 && strchr(stops, c))
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+// Function to remove the quotes and backslash escapes from the N characters
+// at S in place (QUOTED text starts inside double quotes); returns the new
+// length
+static size_t unquote(char *s, size_t n, bool quoted)
+{
+    bool in_single = false, in_double = quoted;
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        char c = s[i];
+        if (in_single && c == '\'')
+        {
+            in_single = false;
+            continue;
+        }
+        if (!in_single)
+        {
+            if (c == '\'' && !in_double)
+            {
+                in_single = true;
+                continue;
+            }
+            if (c == '"')
+            {
+                in_double = !in_double;
+                continue;
+            }
+            if (c == '\\' && i + 1 < n
+                && (!in_double || strchr("\"\\$", s[i+1])))
+            {
+                c = s[++i];
+            }
+        }
+        s[len++] = c;
+    }
+    s[len] = '\0';
+    return len;
+}
+
+// Function to expand the N characters at S onto the end of OUT using MODE;
+// returns the offset at which the expansion starts, or -1 after a diagnostic
+static long expand_scratch(Buf *out, const char *s, size_t n, int mode)
+{
+    size_t start = out->len;
+    if (expand_into(out, s, n, mode) != 0)
+    {
+        return -1;
+    }
+    return start;
+}
+
+// Function to expand the word in the N characters at S onto the end of OUT as
+// text for escape mode MODE; returns the offset at which it starts, or -1
+// after a diagnostic.  Quotes cannot nest, so inside double quotes the word's
+// own quotes are removed and its value escaped instead.
+static long word_scratch(Buf *out, const char *s, size_t n, int mode)
+{
+    long start = expand_scratch(out, s, n, mode);
+    if (start < 0 || mode != EMIT_QUOTED)
+    {
+        return start;
+    }
+
+    size_t len = unquote(out->s + start, out->len - start, true);
+    out->len = start + len;
+    buf_reserve(out, 2 * len);
+    size_t at = out->len;
+    buf_emitn(out, out->s + start, len, EMIT_QUOTED);
+    memmove(out->s + start, out->s + at, out->len - at);
+    out->len = start + (out->len - at);
+    out->s[out->len] = '\0';
+    return start;
+}
+
+// Function to expand the pattern in the N characters at S onto the end of OUT,
+// rewriting its quotes so that only backslashes mark literal characters;
+// returns the offset at which the pattern starts, or -1 after a diagnostic.
+// Enclosing double quotes do not quote the pattern.
+static long pattern_scratch(Buf *out, const char *s, size_t n, int mode)
+{
+    long start = expand_scratch(out, s, n, mode == EMIT_RAW
+                                              ? EMIT_RAW : EMIT_WORD);
+    if (start < 0)
+    {
+        return -1;
+    }
+
+    // Rewrite after the expanded text (at most doubling it), then move down
+    size_t len = out->len - start;
+    buf_reserve(out, 2 * len);
+    const char *p = out->s + start, *end = p + len;
+    char *q = out->s + out->len;
+    bool in_single = false, in_double = false;
+
+    for ( ; p < end; p++)
+    {
+        bool literal = in_single || in_double;
+        if (in_single && *p == '\'')
+        {
+            in_single = false;
+            continue;
+        }
+        if (!in_single)
+        {
+            if (*p == '\'' && !in_double)
+            {
+                in_single = true;
+                continue;
+            }
+            if (*p == '"')
+            {
+                in_double = !in_double;
+                continue;
+            }
+            if (*p == '\\' && p + 1 < end)
+            {
+                p++;
+                literal = true;
+            }
+        }
+        if (literal && strchr("*?[]\\", *p))
+        {
+            *q++ = '\\';
+        }
+        *q++ = *p;
+    }
+
+    size_t plen = q - (out->s + out->len);
+    memmove(out->s + start, out->s + out->len, plen);
+    out->len = start + plen;
+    out->s[out->len] = '\0';
+    return start;
+}
+
+// Function to match the pattern element at *P (not a '*') against character
+// C and advance *P past it; a backslash makes the next character literal
+static bool glob_one(const char **p, const char *pend, unsigned char c)
+{
+    const char *q = *p;
+
+    if (*q == '?')
+    {
+        *p = q + 1;
+        return true;
+    }
+    if (*q == '[')
+    {
+        const char *r = q + 1;
+        bool negate = (r < pend && (*r == '!' || *r == '^'));
+        bool match = false;
+        if (negate)
+        {
+            r++;
+        }
+        for (const char *first = r; r < pend && (*r != ']' || r == first); )
+        {
+            unsigned char lo, hi;
+            if (*r == '\\' && r + 1 < pend)
+            {
+                r++;
+            }
+            lo = hi = *r++;
+            if (r + 1 < pend && *r == '-' && r[1] != ']')
+            {
+                r++;
+                if (*r == '\\' && r + 1 < pend)
+                {
+                    r++;
+                }
+                hi = *r++;
+            }
+            match = match || (lo <= c && c <= hi);
+        }
+        if (r < pend)
+        {
+            *p = r + 1;
+            return match != negate;
+        }
+        // Without a closing ] the [ is an ordinary character
+    }
+    if (*q == '\\' && q + 1 < pend)
+    {
+        q++;
+    }
+    *p = q + 1;
+    return (unsigned char) *q == c;
+}
+
+// Function to check whether the characters from S to SEND match the glob
+// pattern from P to PEND
+static bool glob_match(const char *p, const char *pend,
+                       const char *s, const char *send)
+{
+    const char *star = NULL, *retry = NULL;
+
+    while (s < send)
+    {
+        if (p < pend && *p == '*')
+        {
+            star = ++p;
+            retry = s;
+            continue;
+        }
+        const char *next = p;
+        if (p < pend && glob_one(&next, pend, *s))
+        {
+            p = next;
+            s++;
+            continue;
+        }
+        if (!star)
+        {
+            return false;
+        }
+        // Let the last * absorb one more character and try again
+        p = star;
+        s = ++retry;
+    }
+    while (p < pend && *p == '*')
+    {
+        p++;
+    }
+    return p == pend;
+}
+
+// Function to evaluate the arithmetic expression in the N characters at S
+// (empty means 0), using the end of OUT as scratch space; returns 0 or -1
+// after a diagnostic
+static int param_number(Buf *out, const char *s, size_t n, long long *value)
+{
+    size_t len = out->len;
+    long start = expand_scratch(out, s, n, EMIT_RAW);
+    int rc = -1;
+
+    if (start >= 0)
+    {
+        *value = 0;
+        rc = (strspn(out->s + start, " \t") == out->len - start)
+           ? 0 : arith_eval(out->s + start, value);
+    }
+    out->len = len;
+    out->s[len] = '\0';
+    return rc;
+}
+
+// Function to expand the ${ ... } whose contents are the N characters at S
+// into OUT using escape mode MODE; returns 0, -1 after a diagnostic, or 1 if
+// the contents are not a valid substitution.  Patterns, replacements and
+// offsets are expanded onto the end of OUT and discarded afterwards, so
+// nothing but OUT itself is ever allocated.
+static int expand_param(Buf *out, const char *s, size_t n, int mode)
+{
+    const char *end = s + n;
+    bool length = (n > 1 && *s == '#');
+    if (length)
+    {
+        s++;
+    }
+
+    size_t len = (s < end && *s == '?') ? 1 : strspn(s, VARCHR);
+    if (len > (size_t) (end - s))
+    {
+        len = end - s;
+    }
+    const char *op = s + len;
+    if (len == 0 || (*s >= '0' && *s <= '9') || (length && op != end))
+    {
+        return 1;
+    }
+
+    char status[12];
+    const char *value = env_lookup(s, len);
+    if (*s == '?')
+    {
+        snprintf(status, sizeof(status), "%d", last_status());
+        value = status;
+    }
+
+    if (length)
+    {
+        char num[24];
+        snprintf(num, sizeof(num), "%zu", value ? strlen(value) : 0);
+        buf_emit(out, num, mode);
+        return 0;
+    }
+    if (op == end)
+    {
+        buf_emit(out, value ? value : "", mode);
+        return 0;
+    }
+
+    // ${NAME-WORD}, ${NAME=WORD}, ${NAME+WORD} and ${NAME?WORD}; with a colon
+    // an empty value counts as unset
+    bool colon = (*op == ':' && op + 1 < end && strchr("-=+?", op[1]));
+    if (colon || strchr("-=+?", *op))
+    {
+        op += colon;
+        const char *word = op + 1;
+        bool unset = !value || (colon && *value == '\0');
+
+        if ((*op == '-' && unset) || (*op == '+' && !unset))
+        {
+            return word_scratch(out, word, end - word, mode) < 0 ? -1 : 0;
+        }
+        if (*op == '+' || !unset)
+        {
+            buf_emit(out, *op == '+' ? "" : value, mode);
+            return 0;
+        }
+
+        long start = expand_scratch(out, word, end - word, mode);
+        if (start < 0)
+        {
+            return -1;
+        }
+        if (mode != EMIT_RAW)
+        {
+            out->len = start + unquote(out->s + start, out->len - start,
+                                       mode == EMIT_QUOTED);
+        }
+        char name[len + 1];
+        memcpy(name, s, len);
+        name[len] = '\0';
+
+        if (*op == '?')
+        {
+            WARN("%s: %s\n", name, out->s[start] ? out->s + start
+                                 : "parameter null or not set");
+            return -1;
+        }
+        if (*s == '?')
+        {
+            WARN("%s: cannot assign in this way\n", name);
+            return -1;
+        }
+        setenv(name, out->s + start, 1);
+        out->len = start;
+        out->s[start] = '\0';
+        buf_emit(out, getenv(name), mode);
+        return 0;
+    }
+
+    if (!value)
+    {
+        value = "";
+    }
+    size_t vlen = strlen(value);
+
+    // ${NAME:OFFSET} and ${NAME:OFFSET:LENGTH}; negative numbers count from
+    // the end of the value
+    if (*op == ':')
+    {
+        op++;
+        size_t split = word_span(op, end - op, ":", false);
+        long long off, count = vlen;
+        if (param_number(out, op, split, &off) != 0
+            || (op + split < end
+                && param_number(out, op + split + 1, end - (op + split + 1),
+                                &count) != 0))
+        {
+            return -1;
+        }
+        if (off < 0)
+        {
+            off = (-off > (long long) vlen) ? 0 : off + (long long) vlen;
+        }
+        off = (off > (long long) vlen) ? (long long) vlen : off;
+        if (count < 0)
+        {
+            count += vlen - off;
+            if (count < 0)
+            {
+                WARN("%.*s: substring expression < 0\n",
+                     (int) (end - op), op);
+                return -1;
+            }
+        }
+        if (count > (long long) vlen - off)
+        {
+            count = vlen - off;
+        }
+        buf_emitn(out, value + off, count, mode);
+        return 0;
+    }
+
+    // ${NAME#PAT}, ${NAME##PAT}, ${NAME%PAT}, ${NAME%%PAT}, ${NAME/PAT/REP}
+    // and ${NAME//PAT/REP}
+    if (!strchr("#%/", *op))
+    {
+        return 1;
+    }
+    char kind = *op++;
+    bool longest = (op < end && *op == kind);
+    op += longest;
+
+    size_t split = (kind == '/') ? word_span(op, end - op, "/", false)
+                                 : (size_t) (end - op);
+    long start = pattern_scratch(out, op, split, mode);
+    if (start < 0)
+    {
+        return -1;
+    }
+    size_t plen = out->len - start;
+    const char *pat = out->s + start;
+
+    if (kind != '/')
+    {
+        // The shortest match is found first by scanning the value from its
+        // end or its start, the longest by scanning from the other end
+        size_t from = 0, to = vlen;
+        for (size_t i = 0; i <= vlen; i++)
+        {
+            size_t k = (longest == (kind == '#')) ? vlen - i : i;
+            if (kind == '#' ? glob_match(pat, pat + plen, value, value + k)
+                            : glob_match(pat, pat + plen, value + k,
+                                         value + vlen))
+            {
+                *(kind == '#' ? &from : &to) = k;
+                break;
+            }
+        }
+        out->len = start;
+        out->s[start] = '\0';
+        buf_emitn(out, value + from, to - from, mode);
+        return 0;
+    }
+
+    // The replacement follows the pattern in the scratch space, and the
+    // result follows both until it is moved down over them
+    const char *rep = op + split + (op + split < end);
+    if (word_scratch(out, rep, end - rep, mode) < 0)
+    {
+        return -1;
+    }
+    size_t rlen = out->len - (start + plen);
+    size_t result = out->len;
+    bool done = (plen == 0);
+
+    for (size_t i = 0; i < vlen; )
+    {
+        size_t j = vlen;
+        pat = out->s + start;
+        while (!done && j > i && !glob_match(pat, pat + plen, value + i,
+                                             value + j))
+        {
+            j--;
+        }
+        if (done || j == i)
+        {
+            buf_emitn(out, value + i++, 1, mode);
+            continue;
+        }
+        buf_reserve(out, rlen);
+        buf_putn(out, out->s + start + plen, rlen);
+        i = j;
+        done = !longest;
+    }
+    memmove(out->s + start, out->s + result, out->len - result);
+    out->len = start + (out->len - result);
+    out->s[out->len] = '\0';
+    return 0;
+}
+
+// Function to expand the $-expression at S (S[0] is '$') into OUT using
+// escape mode MODE; stores the number of characters consumed in *USED and
+// returns 0, or returns -1 after a diagnostic
+static int expand_dollar(Buf *out, const char *s, const char *end, int mode,
+                         size_t *used)
+{
+    if (s + 2 < end && s[1] == '(' && s[2] == '(')
+    {
+        long len = arith_length(s + 3, end);
+        if (len < 0)
+        {
+            WARN("%s\n", "$((: missing `))'");
+            return -1;
+        }
+
+        // Variables and nested $(( )) in the expression are expanded first
+        Buf expr = { NULL, 0, 0 };
+        buf_reserve(&expr, 0);
+        expr.s[0] = '\0';
+        if (expand_into(&expr, s + 3, len, EMIT_RAW) != 0)
+        {
+            free(expr.s);
+            return -1;
+        }
+
+        long long value;
+        int rc = arith_eval(expr.s, &value);
+        free(expr.s);
+        if (rc != 0)
+        {
+            return -1;
+        }
+
+        char num[24];
+        snprintf(num, sizeof(num), "%lld", value);
+        buf_emit(out, num, mode);
+        *used = len + 5;
+        return 0;
+    }
+
+    if (s + 1 < end && s[1] == '?')
+    {
+        char value[12];
+        snprintf(value, sizeof(value), "%d", last_status());
+        buf_emit(out, value, mode);
+        *used = 2;
+        return 0;
+    }
+
+    if (s + 1 < end && s[1] == '{')
+    {
+        size_t len = word_span(s + 2, end - (s + 2), "}", mode == EMIT_QUOTED);
+        int rc = (s + 2 + len < end) ? expand_param(out, s + 2, len, mode) : 1;
+        if (rc > 0)
+        {
+            WARN("%.*s: bad substitution\n",
+                 (int) (s + 2 + len < end ? len + 3 : (size_t) (end - s)), s);
+            return -1;
+        }
+        *used = len + 3;
+        return rc;
+    }
+
+    size_t len = strspn(s + 1, VARCHR);
+    if (len > (size_t) (end - (s + 1)))
+    {
+        len = end - (s + 1);
+    }
+    if (len == 0 || (s[1] >= '0' && s[1] <= '9'))
+    {
+        // Not an expansion:  keep the $ itself
+        buf_putn(out, s, 1);
+        *used = 1;
+        return 0;
+    }
+
+    const char *value = env_lookup(s + 1, len);
+    buf_emit(out, value ? value : "", mode);
+    *used = len + 1;
+    return 0;
+}
+
+// Function to expand the N characters at S into OUT; EMIT_RAW text (the inside
+// of $(( ... ))) has no quoting and its expansions are not escaped, and
+// EMIT_QUOTED text starts inside double quotes
+static int expand_into(Buf *out, const char *s, size_t n, int mode)
+{
+    const char *end = s + n;
+    bool raw = (mode == EMIT_RAW);
+    bool in_single = false, in_double = (mode == EMIT_QUOTED);
+
+    while (s < end)
+    {
+        if (!raw)
+        {
+            if (in_single)
+            {
+                in_single = (*s != '\'');
+                buf_putn(out, s++, 1);
+                continue;
+            }
+            if (*s == '\'' && !in_double)
+            {
+                in_single = true;
+                buf_putn(out, s++, 1);
+                continue;
+            }
+            if (*s == '"')
+            {
+                in_double = !in_double;
+                buf_putn(out, s++, 1);
+                continue;
+            }
+            if (*s == '\\')
+            {
+                size_t len = (s + 1 < end) ? 2 : 1;
+                buf_putn(out, s, len);
+                s += len;
+                continue;
+            }
+        }
+
+        if (*s != '$')
+        {
+            buf_putn(out, s++, 1);
+            continue;
+        }
+
+        size_t used;
+        mode = raw ? EMIT_RAW : in_double ? EMIT_QUOTED : EMIT_WORD;
+        if (expand_dollar(out, s, end, mode, &used) != 0)
+        {
+            return -1;
+        }
+        s += used;
+    }
+    return 0;
+}
+
+// A sequence brace expression {FROM..TO} or {FROM..TO..STEP}
+typedef struct BraceRange {
+    long long from, to; // First and last values (characters if CHARS)
+    long long step;     // Distance between values (always positive)
+    int width;          // Width of the longer number endpoint
+    bool pad;           // Numbers are zero-padded to WIDTH
+    bool chars;         // Values are characters rather than numbers
+} BraceRange;
+
+// Function to return the offset of the first unmatched '}' (or of the first
+// ',' too if COMMA) in the N characters at S, skipping quotes, backslash
+// escapes and nested braces; returns N if there is none
+static size_t brace_span(const char *s, size_t n, bool comma)
+{
+    bool in_single = false, in_double = false;
+    int depth = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        char c = s[i];
+        if (in_single)
+        {
+            in_single = (c != '\'');
+        }
+        else if (c == '\\')
+        {
+            i++;
+        }
+        else if (c == '\'' && !in_double)
+        {
+            in_single = true;
+        }
+        else if (c == '"')
+        {
+            in_double = !in_double;
+        }
+        else if (in_double)
+        {
+            continue;
+        }
+        else if (c == '{')
+        {
+            depth++;
+        }
+        else if (c == '}' && depth-- == 0)
+        {
+            return i;
+        }
+        else if (c == ',' && comma && depth == 0)
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+// Function to parse one endpoint or step of a sequence in R at *S (before
+// END), advancing *S past it; a character endpoint is accepted if CHR is set
+static bool brace_value(const char **s, const char *end, bool chr,
+                        long long *value, BraceRange *r)
+{
+    const char *p = *s;
+    if (chr && p < end && isalpha((unsigned char) *p)
+        && (p + 1 == end || p[1] == '.'))
+    {
+        *value = (unsigned char) *p;
+        *s = p + 1;
+        return true;
+    }
+
+    const char *digits = p + (p < end && (*p == '-' || *p == '+'));
+    const char *q = digits;
+    while (q < end && isdigit((unsigned char) *q))
+    {
+        q++;
+    }
+    if (q == digits || q - p > 18 || (q < end && *q != '.'))
+    {
+        return false;
+    }
+    *value = strtoll(p, NULL, 10);
+    r->pad = r->pad || (*digits == '0' && q - digits > 1);
+    r->width = (q - p > r->width) ? q - p : r->width;
+    *s = q;
+    return true;
+}
+
+// Function to parse the N characters between the braces at S as a sequence
+static bool brace_range(const char *s, size_t n, BraceRange *r)
+{
+    const char *end = s + n;
+    r->width = 0;
+    r->pad = false;
+    r->chars = (n >= 4 && isalpha((unsigned char) *s));
+    if (!brace_value(&s, end, r->chars, &r->from, r)
+        || end - s < 3 || s[0] != '.' || s[1] != '.')
+    {
+        return false;
+    }
+    s += 2;
+    if (!brace_value(&s, end, r->chars, &r->to, r))
+    {
+        return false;
+    }
+    r->width = r->pad ? r->width : 0;
+    r->step = 1;
+    if (s < end)
+    {
+        BraceRange step = { 0, 0, 0, 0, false, false };
+        if (end - s < 3 || s[0] != '.' || s[1] != '.')
+        {
+            return false;
+        }
+        s += 2;
+        if (!brace_value(&s, end, false, &r->step, &step) || s != end)
+        {
+            return false;
+        }
+        r->step = (r->step < 0) ? -r->step : (r->step == 0) ? 1 : r->step;
+    }
+    return !r->chars || isalpha((unsigned char) r->to);
+}
+
+// Function to find the first brace expression in the N characters at S that
+// is outside quotes and not part of a ${ ... }; stores the offsets of its
+// { and } in *OPEN and *CLOSE and returns true, or returns false
+static bool brace_find(const char *s, size_t n, size_t *open, size_t *close)
+{
+    bool in_single = false, in_double = false;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        char c = s[i];
+        if (in_single)
+        {
+            in_single = (c != '\'');
+            continue;
+        }
+        if (c == '\\')
+        {
+            i++;
+            continue;
+        }
+        if (c == '\'' && !in_double)
+        {
+            in_single = true;
+            continue;
+        }
+        if (c == '"')
+        {
+            in_double = !in_double;
+            continue;
+        }
+        if (c != '{' || in_double)
+        {
+            continue;
+        }
+
+        const char *inner = s + i + 1;
+        size_t m = brace_span(inner, n - i - 1, false);
+        if (m == n - i - 1)
+        {
+            return false;
+        }
+        BraceRange r;
+        if (i == 0 || s[i-1] != '$')
+        {
+            if (brace_span(inner, m, true) < m || brace_range(inner, m, &r))
+            {
+                *open = i;
+                *close = i + 1 + m;
+                return true;
+            }
+            continue;
+        }
+        i += m + 1;
+    }
+    return false;
+}
+
+// Function to append to OUT the words that the brace expressions in the N
+// characters at S expand to, separated by spaces; *FIRST is cleared once a
+// word has been written
+static void brace_word(Buf *out, const char *s, size_t n, bool *first)
+{
+    size_t open, close;
+    if (!brace_find(s, n, &open, &close))
+    {
+        if (!*first)
+        {
+            buf_putn(out, " ", 1);
+        }
+        buf_putn(out, s, n);
+        *first = false;
+        return;
+    }
+
+    // Each alternative is spliced between the preamble and the rest of the
+    // word, which may hold further brace expressions, in a buffer reused for
+    // every alternative
+    const char *inner = s + open + 1, *tail = s + close + 1;
+    size_t m = close - open - 1, tn = n - close - 1;
+    Buf word = { NULL, 0, 0 };
+    BraceRange r;
+
+    if (brace_span(inner, m, true) == m && brace_range(inner, m, &r))
+    {
+        unsigned long long count = (r.from <= r.to)
+            ? (unsigned long long) (r.to - r.from) / r.step
+            : (unsigned long long) (r.from - r.to) / r.step;
+        long long dir = (r.from <= r.to) ? r.step : -r.step;
+        long long v = r.from;
+        for (unsigned long long k = 0; k <= count; k++, v += dir)
+        {
+            char item[32];
+            int len = r.chars
+                    ? snprintf(item, sizeof(item), "%s%c",
+                               isalnum((int) v) ? "" : "\\", (int) v)
+                    : snprintf(item, sizeof(item), "%0*lld", r.width, v);
+            word.len = 0;
+            buf_putn(&word, s, open);
+            buf_putn(&word, item, len);
+            buf_putn(&word, tail, tn);
+            brace_word(out, word.s, word.len, first);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i <= m; )
+        {
+            size_t k = brace_span(inner + i, m - i, true);
+            word.len = 0;
+            buf_putn(&word, s, open);
+            buf_putn(&word, inner + i, k);
+            buf_putn(&word, tail, tn);
+            brace_word(out, word.s, word.len, first);
+            i += k + 1;
+        }
+    }
+    free(word.s);
+}
+
+// Function to return the length of the word at S, which ends at whitespace or
+// a metacharacter outside quotes and ${ ... }
+static size_t word_length(const char *s)
+{
+    bool in_single = false, in_double = false;
+    size_t i;
+
+    for (i = 0; s[i]; i++)
+    {
+        char c = s[i];
+        if (in_single)
+        {
+            in_single = (c != '\'');
+        }
+        else if (c == '\\')
+        {
+            i += (s[i+1] != '\0');
+        }
+        else if (c == '\'' && !in_double)
+        {
+            in_single = true;
+        }
+        else if (c == '"')
+        {
+            in_double = !in_double;
+        }
+        else if (c == '$' && s[i+1] == '{')
+        {
+            size_t rest = strlen(s + i + 2);
+            size_t m = brace_span(s + i + 2, rest, false);
+            if (m == rest)
+            {
+                return i + 2 + rest;
+            }
+            i += 2 + m;
+        }
+        else if (!in_double && strchr(" \t\n" METACHAR, c))
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+// Function to append LINE to OUT with the brace expressions in each word
+// replaced by the words they expand to
+static void brace_line(Buf *out, const char *line)
+{
+    while (*line)
+    {
+        if (strchr(" \t\n" METACHAR, *line))
+        {
+            buf_putn(out, line++, 1);
+            continue;
+        }
+        if (*line == '#')
+        {
+            // A comment is copied as is
+            buf_putn(out, line, strlen(line));
+            break;
+        }
+
+        size_t n = word_length(line);
+        bool first = true;
+        brace_word(out, line, n, &first);
+        line += n;
+    }
+}
+
+// Function to expand command line LINE
+char *expand(const char *line)
+{
+    Buf out = { NULL, 0, 0 };
+    Buf braced = { NULL, 0, 0 };
+
+    // Brace expansion comes first, so that {$A,$B} expands both variables;
+    // its words are tokenized again with the rest of the line
+    if (strchr(line, '{'))
+    {
+        buf_reserve(&braced, strlen(line));
+        braced.s[0] = '\0';
+        brace_line(&braced, line);
+        line = braced.s;
+    }
+
+    size_t n = strlen(line);
+    buf_reserve(&out, n);
+    out.s[0] = '\0';
+    int rc = expand_into(&out, line, n, EMIT_WORD);
+    free(braced.s);
+    if (rc != 0)
+    {
+        free(out.s);
+        return NULL;
+    }
+    return out.s;
+}
+
+// Function to check whether LINE expands to itself
+bool expand_static(const char *line)
+{
+    return strpbrk(line, "${") == NULL;
+}
@@ -0,0 +1,53 @@
+// expand.h
+//
+// Expansion phase applied to each command line before it is tokenized.
+// Brace expressions outside quotes are expanded first, each word containing
+// one being replaced by the words it generates:
+//
+//   {A,B,...}          One word per alternative (at least one comma)
+//   {X..Y}  {X..Y..STEP}
+//                      Integers or letters from X to Y, up or down;
+//                      integers with a leading zero are zero-padded
+//
+// Brace expressions nest and combine, e.g., a{b,c{1..3}}d.  The words they
+// generate are written into the expanded line, which is then tokenized like
+// any other, so the cost of a long expansion is dominated by the tokenizer,
+// whose time grows with the square of the line's length:  {1..100000} takes
+// about a second and a half.  Then
+// $NAME, ${NAME} and $? are replaced by the values of environment variables
+// and $(( EXPR )) by the value of an arithmetic expression.  Nothing inside
+// single quotes or after a backslash is expanded.
+//
+// ${NAME...} also takes the usual parameter operators:
+//
+//   ${NAME:-WORD}  ${NAME:=WORD}  ${NAME:+WORD}  ${NAME:?WORD}
+//                      WORD if NAME is unset or empty (:= also assigns it,
+//                      :? fails with WORD as the message); without the
+//                      colon only an unset NAME counts
+//   ${#NAME}           Length of the value
+//   ${NAME#PAT}  ${NAME##PAT}  ${NAME%PAT}  ${NAME%%PAT}
+//                      Value less its shortest / longest prefix / suffix
+//                      matching glob pattern PAT (*, ?, [...])
+//   ${NAME/PAT/REP}  ${NAME//PAT/REP}
+//                      Value with the first / every longest match of PAT
+//                      replaced by REP
+//   ${NAME:OFF}  ${NAME:OFF:LEN}
+//                      Substring; OFF and LEN are arithmetic expressions and
+//                      count from the end of the value when negative
+//
+// WORD, PAT and REP are themselves expanded.
+
+#ifndef EXPAND_INCLUDED
+#define EXPAND_INCLUDED
+
+// Return a newly allocated copy of LINE with all expansions performed, or
+// NULL (after writing a diagnostic to stderr) if an expansion failed.
+// Expanded text is escaped so that the tokenizer does not treat it as
+// metacharacters or quotes.
+char *expand(const char *line);
+
+// Return true if LINE contains nothing to expand, so that expand() would
+// return it unchanged whatever the state of the shell
+bool expand_static(const char *line);
+
+#endif
@@ -0,0 +1,368 @@
+// history.c
+//
+// Append-only history file with a trigram index for substring search.
+#include "process.h"
+#include "history.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Marks the start of every record, so that a reader can resynchronize after
+// a record that was torn by a crash
+#define HIST_MAGIC 0x48534231u          // "1BSH"
+
+// Number of buckets in the trigram index
+#define HIST_BUCKETS 65536
+
+// Records are padded to a multiple of this size
+#define HIST_ALIGN 8
+
+// Structure at the start of each record; the text follows it and is not
+// null-terminated
+typedef struct HistHeader {
+    uint32_t magic;     // HIST_MAGIC
+    uint32_t len;       // Length of the text
+    int64_t time;       // When the line was entered (seconds since epoch)
+} HistHeader;
+
+// Structure for the list of records that contain trigrams in one bucket
+typedef struct Posting {
+    uint32_t *ids;      // Record numbers in increasing order
+    uint32_t n, cap;
+} Posting;
+
+static int hist_fd = -2;                // -2 until opened, -1 if disabled
+static const char *hist_map = NULL;     // Mapping of the whole file
+static size_t hist_mapped = 0;          // Size of the mapping
+
+static uint64_t *hist_offsets = NULL;   // Offset of each record found so far
+static uint32_t hist_count = 0;         // Number of records found so far
+static uint32_t hist_offsets_cap = 0;
+static size_t hist_scanned = 0;         // Bytes of the file already scanned
+
+static Posting *hist_index = NULL;      // Trigram index (built on demand)
+static uint32_t hist_indexed = 0;       // Number of records indexed
+
+// Function to open the history file on first use; returns false if history
+// is disabled
+static bool history_open(void)
+{
+    if (hist_fd != -2)
+    {
+        return hist_fd >= 0;
+    }
+    hist_fd = -1;
+
+    const char *file = getenv("HISTFILE");
+    char path[PATH_MAX];
+    if (!file)
+    {
+        const char *home = getenv("HOME");
+        if (!home || !isatty(STDIN_FILENO))
+        {
+            return false;
+        }
+        snprintf(path, sizeof(path), "%s/.bsh_history", home);
+        file = path;
+    }
+    if (!*file)
+    {
+        return false;
+    }
+
+    hist_fd = open(file, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (hist_fd < 0)
+    {
+        WARN("history: %s: %s\n", file, strerror(errno));
+    }
+    return hist_fd >= 0;
+}
+
+// Function to append a record for LINE
+void history_add(const char *line)
+{
+    size_t len = strcspn(line, "\n");
+    if (len == 0 || !history_open())
+    {
+        return;
+    }
+
+    size_t size = (sizeof(HistHeader) + len + HIST_ALIGN - 1)
+                & ~(size_t)(HIST_ALIGN - 1);
+    char *rec = calloc(1, size);
+    if (!rec)
+    {
+        perror("calloc");
+        exit(errno);
+    }
+    HistHeader h = { HIST_MAGIC, (uint32_t) len, (int64_t) time(NULL) };
+    memcpy(rec, &h, sizeof(h));
+    memcpy(rec + sizeof(h), line, len);
+
+    // One write() of the whole record under an exclusive lock keeps records
+    // from concurrent shells whole and in one piece; a write that fails
+    // partway is cut off again, so that no header is left without its text
+    flock(hist_fd, LOCK_EX);
+    struct stat st;
+    ssize_t n = fstat(hist_fd, &st) == 0 ? write(hist_fd, rec, size) : -1;
+    if (n != (ssize_t) size)
+    {
+        perror("history: write");
+        if (n > 0 && ftruncate(hist_fd, st.st_size) != 0)
+        {
+            perror("history: ftruncate");
+        }
+    }
+    flock(hist_fd, LOCK_UN);
+    free(rec);
+}
+
+// Function to forget the mapping, the records found and the index
+static void history_forget(void)
+{
+    if (hist_map)
+    {
+        munmap((void *) hist_map, hist_mapped);
+    }
+    hist_map = NULL;
+    hist_mapped = 0;
+    hist_count = 0;
+    hist_scanned = 0;
+
+    if (hist_index)
+    {
+        for (uint32_t i = 0; i < HIST_BUCKETS; i++)
+        {
+            free(hist_index[i].ids);
+        }
+        free(hist_index);
+        hist_index = NULL;
+    }
+    hist_indexed = 0;
+}
+
+// Function to check whether the file, now SIZE bytes, has been truncated
+// (and maybe appended to since) so that it no longer holds the records found
+// so far
+static bool history_stale(size_t size)
+{
+    if (size < hist_mapped)
+    {
+        return true;
+    }
+    if (hist_count == 0)
+    {
+        return false;
+    }
+    HistHeader h;
+    memcpy(&h, hist_map + hist_offsets[hist_count - 1], sizeof(h));
+    return h.magic != HIST_MAGIC;
+}
+
+// Function to map any part of the file appended since the last call and
+// find the records in it, scanning it again from the start if it has been
+// truncated
+static void history_refresh(void)
+{
+    struct stat st;
+    if (fstat(hist_fd, &st) != 0)
+    {
+        return;
+    }
+
+    size_t size = st.st_size;
+    if (history_stale(size))
+    {
+        history_forget();
+    }
+    if (size == hist_mapped)
+    {
+        return;
+    }
+
+    void *map = hist_map
+              ? mremap((void *) hist_map, hist_mapped, size, MREMAP_MAYMOVE)
+              : mmap(NULL, size, PROT_READ, MAP_SHARED, hist_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("history: mmap");
+        return;
+    }
+    hist_map = map;
+    hist_mapped = size;
+
+    size_t off = hist_scanned;
+    while (off + sizeof(HistHeader) <= size)
+    {
+        HistHeader h;
+        memcpy(&h, hist_map + off, sizeof(h));
+        if (h.magic != HIST_MAGIC)
+        {
+            off += HIST_ALIGN;          // Skip debris from a torn record
+            continue;
+        }
+        if (off + sizeof(h) + h.len > size)
+        {
+            break;                      // Record still being written
+        }
+
+        if (hist_count == hist_offsets_cap)
+        {
+            hist_offsets_cap = hist_offsets_cap ? 2 * hist_offsets_cap : 1024;
+            REALLOC(hist_offsets, hist_offsets_cap);
+            if (!hist_offsets)
+            {
+                perror("realloc");
+                exit(errno);
+            }
+        }
+        hist_offsets[hist_count++] = off;
+        off += (sizeof(h) + h.len + HIST_ALIGN - 1) & ~(size_t)(HIST_ALIGN - 1);
+    }
+    hist_scanned = off;
+}
+
+// Function to return the text and length of record I
+static const char *history_text(uint32_t i, uint32_t *len)
+{
+    HistHeader h;
+    memcpy(&h, hist_map + hist_offsets[i], sizeof(h));
+    *len = h.len;
+    return hist_map + hist_offsets[i] + sizeof(h);
+}
+
+// Function to map trigram S[0..2] to a bucket of the index
+static uint32_t trigram_bucket(const char *s)
+{
+    uint32_t t = ((uint32_t) (unsigned char) s[0] << 16)
+               | ((uint32_t) (unsigned char) s[1] << 8)
+               | (uint32_t) (unsigned char) s[2];
+    return (t * 2654435761u) >> 16;
+}
+
+// Function to add every record not yet indexed to the trigram index
+static void history_index(void)
+{
+    if (!hist_index)
+    {
+        hist_index = calloc(HIST_BUCKETS, sizeof(*hist_index));
+        if (!hist_index)
+        {
+            perror("calloc");
+            exit(errno);
+        }
+    }
+
+    for ( ; hist_indexed < hist_count; hist_indexed++)
+    {
+        uint32_t len;
+        const char *text = history_text(hist_indexed, &len);
+        for (uint32_t j = 0; j + 3 <= len; j++)
+        {
+            Posting *p = &hist_index[trigram_bucket(text + j)];
+            if (p->n > 0 && p->ids[p->n - 1] == hist_indexed)
+            {
+                continue;               // Bucket already lists this record
+            }
+            if (p->n == p->cap)
+            {
+                p->cap = p->cap ? 2 * p->cap : 4;
+                REALLOC(p->ids, p->cap);
+                if (!p->ids)
+                {
+                    perror("realloc");
+                    exit(errno);
+                }
+            }
+            p->ids[p->n++] = hist_indexed;
+        }
+    }
+}
+
+// Function to print record I
+static void history_print(uint32_t i)
+{
+    uint32_t len;
+    const char *text = history_text(i, &len);
+    fprintf(BSTDOUT, "%5u  %.*s\n", i + 1, (int) len, text);
+}
+
+// Function to list the records that contain PATTERN
+static void history_search(const char *pattern)
+{
+    size_t plen = strlen(pattern);
+
+    if (plen < 3)
+    {
+        for (uint32_t i = 0; i < hist_count; i++)
+        {
+            uint32_t len;
+            const char *text = history_text(i, &len);
+            if (memmem(text, len, pattern, plen))
+            {
+                history_print(i);
+            }
+        }
+        return;
+    }
+
+    history_index();
+
+    // Every match is in the posting list of each trigram of the pattern, so
+    // it suffices to check the records in the shortest one
+    const Posting *best = NULL;
+    for (size_t j = 0; j + 3 <= plen; j++)
+    {
+        const Posting *p = &hist_index[trigram_bucket(pattern + j)];
+        if (!best || p->n < best->n)
+        {
+            best = p;
+        }
+    }
+
+    for (uint32_t k = 0; k < best->n; k++)
+    {
+        uint32_t len;
+        const char *text = history_text(best->ids[k], &len);
+        if (memmem(text, len, pattern, plen))
+        {
+            history_print(best->ids[k]);
+        }
+    }
+}
+
+// Function to handle the history builtin
+int builtin_history(int argc, char **argv)
+{
+    if (argc > 3 || (argc == 3 && strcmp(argv[1], "-s") != 0)
+        || (argc == 2 && strspn(argv[1], "0123456789") != strlen(argv[1])))
+    {
+        fprintf(stderr, "history: usage: history [N] | history -s TEXT\n");
+        return 1;
+    }
+    if (!history_open())
+    {
+        return 0;
+    }
+
+    history_refresh();
+
+    if (argc == 3)
+    {
+        history_search(argv[2]);
+    }
+    else
+    {
+        uint32_t n = (argc == 2) ? (uint32_t) strtoul(argv[1], NULL, 10)
+                                 : hist_count;
+        for (uint32_t i = (n < hist_count) ? hist_count - n : 0;
+             i < hist_count; i++)
+        {
+            history_print(i);
+        }
+    }
+    fflush(BSTDOUT);
+    return 0;
+}
@@ -0,0 +1,23 @@
+// history.h
+//
+// Persistent command history.  Lines are appended to $HISTFILE (default
+// ~/.bsh_history) as length-prefixed records, so several shells can append
+// to the same file at once and a reader can mmap() it and walk the records
+// without parsing text.  Substring search uses a trigram index that is
+// built on the first search, extended as the file grows and rebuilt if the
+// file is truncated.
+
+#ifndef HISTORY_INCLUDED
+#define HISTORY_INCLUDED
+
+// Append command line LINE (without its trailing newline) to the history.
+// History is only kept for interactive shells unless $HISTFILE is set, and
+// not at all if $HISTFILE is set but empty.
+void history_add(const char *line);
+
+// Handle the history builtin:
+//   history [N]          List the last N entries (all if N is omitted)
+//   history -s TEXT      List the entries that contain TEXT
+int builtin_history(int argc, char **argv);
+
+#endif
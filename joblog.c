@@ -0,0 +1,356 @@
+// joblog.c
+//
+// Ring buffers for the output of background jobs, filled by a drainer
+// thread so that a job never blocks on a full pipe while the shell waits
+// for something else.
+#include "process.h"
+#include "joblog.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+// Number of job logs (job numbers 1 .. JOBLOG_MAX)
+#define JOBLOG_MAX 1024
+
+// Default number of rings that fit into the total limit
+#define JOBLOG_DEFAULT_RINGS 16
+
+// Structure for the log of one job
+typedef struct JobLog {
+    pid_t pid;          // Process ID of the job (0 if slot unused)
+    int fd;             // Read end of its output pipe (-1 once at EOF)
+    char *ring;         // Ring buffer (NULL if output is being discarded)
+    size_t size;        // Size of the ring
+    size_t written;     // Total bytes of output; ring holds the last ones
+    unsigned long seq;  // When the job was started (for eviction)
+} JobLog;
+
+static JobLog joblogs[JOBLOG_MAX];
+static size_t total_limit = 0;          // Limit on all rings together
+static size_t total_used = 0;           // Bytes allocated to rings
+static unsigned long joblog_seq = 0;
+
+static pthread_mutex_t joblog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t drainer;
+static bool drainer_running = false;
+static int wake_pipe[2] = { -1, -1 };   // Tells the drainer to rescan
+
+// Function to parse a size such as 65536, 64K or 1M; returns 0 if invalid
+static size_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (*end == 'k' || *end == 'K')
+    {
+        n <<= 10;
+        end++;
+    }
+    else if (*end == 'm' || *end == 'M')
+    {
+        n <<= 20;
+        end++;
+    }
+    return (*end == '\0') ? (size_t) n : 0;
+}
+
+// Function to read $BSH_JOBLOG and $BSH_JOBLOG_TOTAL into *SIZE and *TOTAL;
+// returns false if job logs are disabled
+static bool joblog_config(size_t *size, size_t *total)
+{
+    const char *env = getenv("BSH_JOBLOG");
+    *size = env ? parse_size(env) : 0;
+    if (*size == 0)
+    {
+        return false;
+    }
+    env = getenv("BSH_JOBLOG_TOTAL");
+    *total = env ? parse_size(env) : 0;
+    if (*total == 0)
+    {
+        *total = JOBLOG_DEFAULT_RINGS * *size;
+    }
+    return true;
+}
+
+// Function to free the ring of log L (joblog_lock held)
+static void free_ring(JobLog *l)
+{
+    if (l->ring)
+    {
+        free(l->ring);
+        l->ring = NULL;
+        total_used -= l->size;
+    }
+}
+
+// Function to append the N bytes at BUF to the ring of log L (joblog_lock
+// held)
+static void ring_put(JobLog *l, const char *buf, size_t n)
+{
+    if (l->ring)
+    {
+        // Only the last l->size bytes can survive
+        size_t skip = (n > l->size) ? n - l->size : 0;
+        for (size_t i = skip; i < n; )
+        {
+            size_t at = (l->written + i) % l->size;
+            size_t chunk = l->size - at;
+            if (chunk > n - i)
+            {
+                chunk = n - i;
+            }
+            memcpy(l->ring + at, buf + i, chunk);
+            i += chunk;
+        }
+    }
+    l->written += n;
+}
+
+// Function run by the drainer thread:  copy output from every open job pipe
+// into its ring
+static void *drain_logs(void *arg)
+{
+    (void) arg;
+    struct pollfd fds[JOBLOG_MAX + 1];
+    int slot[JOBLOG_MAX + 1];
+    char buf[16384];
+
+    // The shell handles signals; this thread only moves bytes
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    for ( ; ; )
+    {
+        int nfds = 0;
+        fds[nfds].fd = wake_pipe[0];
+        fds[nfds++].events = POLLIN;
+        pthread_mutex_lock(&joblog_lock);
+        for (int i = 0; i < JOBLOG_MAX; i++)
+        {
+            if (joblogs[i].pid && joblogs[i].fd >= 0)
+            {
+                fds[nfds].fd = joblogs[i].fd;
+                fds[nfds].events = POLLIN;
+                slot[nfds++] = i;
+            }
+        }
+        pthread_mutex_unlock(&joblog_lock);
+
+        if (poll(fds, nfds, -1) < 0)
+        {
+            continue;
+        }
+        if (fds[0].revents)
+        {
+            while (read(wake_pipe[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+
+        for (int k = 1; k < nfds; k++)
+        {
+            if (!fds[k].revents)
+            {
+                continue;
+            }
+            ssize_t n = read(fds[k].fd, buf, sizeof(buf));
+            if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            {
+                continue;
+            }
+
+            pthread_mutex_lock(&joblog_lock);
+            JobLog *l = &joblogs[slot[k]];
+            if (l->fd == fds[k].fd)     // Not replaced in the meantime
+            {
+                if (n > 0)
+                {
+                    ring_put(l, buf, n);
+                }
+                else
+                {
+                    close(l->fd);
+                    l->fd = -1;
+                }
+            }
+            pthread_mutex_unlock(&joblog_lock);
+        }
+    }
+    return NULL;
+}
+
+// Function to start the drainer thread on first use; returns false on error
+static bool start_drainer(void)
+{
+    if (drainer_running)
+    {
+        return true;
+    }
+    for (int i = 0; i < JOBLOG_MAX; i++)
+    {
+        joblogs[i].fd = -1;
+    }
+    if (pipe(wake_pipe) != 0)
+    {
+        perror("joblog: pipe");
+        return false;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(wake_pipe[i], F_SETFL, O_NONBLOCK);
+    }
+    if (pthread_create(&drainer, NULL, drain_logs, NULL) != 0)
+    {
+        perror("joblog: pthread_create");
+        return false;
+    }
+    drainer_running = true;
+    return true;
+}
+
+// Function to make room for one more ring of SIZE bytes by discarding the
+// logs of finished jobs, oldest first (joblog_lock held); returns false if
+// there is no room
+static bool make_room(size_t size)
+{
+    while (total_used + size > total_limit)
+    {
+        JobLog *oldest = NULL;
+        for (int i = 0; i < JOBLOG_MAX; i++)
+        {
+            JobLog *l = &joblogs[i];
+            if (l->ring && l->fd < 0 && (!oldest || l->seq < oldest->seq))
+            {
+                oldest = l;
+            }
+        }
+        if (!oldest)
+        {
+            return false;
+        }
+        free_ring(oldest);
+    }
+    return true;
+}
+
+// Function to set up the log of job JOB
+int joblog_pipe(int job)
+{
+    size_t size, total;
+    if (job < 1 || job > JOBLOG_MAX || !joblog_config(&size, &total)
+        || !start_drainer())
+    {
+        return -1;
+    }
+
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        perror("joblog: pipe");
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+    // The settings may have changed since the last job, but each ring keeps
+    // the size it was allocated with
+    pthread_mutex_lock(&joblog_lock);
+    total_limit = total;
+    JobLog *l = &joblogs[job - 1];
+    if (l->fd >= 0)
+    {
+        close(l->fd);                   // Left open by an earlier job N
+    }
+    free_ring(l);
+    l->pid = 0;
+    l->fd = fds[0];
+    l->written = 0;
+    l->seq = ++joblog_seq;
+    if (make_room(size))
+    {
+        l->ring = malloc(size);
+        if (l->ring)
+        {
+            l->size = size;
+            total_used += size;
+        }
+    }
+    if (!l->ring)
+    {
+        WARN("joblog: %%%d: memory limit reached; output discarded\n", job);
+    }
+    pthread_mutex_unlock(&joblog_lock);
+    return fds[1];
+}
+
+// Function to record that job JOB has been forked
+void joblog_started(int job, pid_t pid, int wfd)
+{
+    close(wfd);
+
+    pthread_mutex_lock(&joblog_lock);
+    joblogs[job - 1].pid = pid;
+    pthread_mutex_unlock(&joblog_lock);
+
+    if (write(wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+    {
+        perror("joblog: write");
+    }
+}
+
+// Function to handle the joblog builtin
+int builtin_joblog(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "joblog: usage: joblog %%N\n");
+        return 1;
+    }
+
+    const char *arg = argv[1] + (argv[1][0] == '%');
+    char *end;
+    long job = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || job < 1 || job > JOBLOG_MAX)
+    {
+        fprintf(stderr, "joblog: %s: no such job\n", argv[1]);
+        return 1;
+    }
+
+    pthread_mutex_lock(&joblog_lock);
+    JobLog *l = &joblogs[job - 1];
+    if (!l->pid)
+    {
+        pthread_mutex_unlock(&joblog_lock);
+        fprintf(stderr, "joblog: %s: no log for job\n", argv[1]);
+        return 1;
+    }
+
+    // Copy the ring out in order so that the lock is not held while writing
+    size_t n = (l->ring && l->written > l->size) ? l->size : l->written;
+    size_t lost = l->written - (l->ring ? n : 0);
+    char *copy = malloc(n ? n : 1);
+    if (l->ring && copy)
+    {
+        size_t start = (l->written - n) % l->size;
+        size_t first = (l->size - start < n) ? l->size - start : n;
+        memcpy(copy, l->ring + start, first);
+        memcpy(copy + first, l->ring, n - first);
+    }
+    else
+    {
+        n = 0;
+    }
+    pthread_mutex_unlock(&joblog_lock);
+
+    if (lost)
+    {
+        fprintf(stderr, "joblog: %%%ld: %zu earlier bytes discarded\n", job, lost);
+    }
+    fflush(BSTDOUT);
+    if (n && write(fileno(BSTDOUT), copy, n) != (ssize_t) n)
+    {
+        perror("joblog: write");
+    }
+    free(copy);
+    return 0;
+}
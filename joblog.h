@@ -0,0 +1,30 @@
+// joblog.h
+//
+// Bounded in-memory logs of the output of background jobs.
+//
+// When $BSH_JOBLOG is set to a size in bytes (with an optional K or M
+// suffix), the stdout and stderr of each background job go to a pipe that a
+// thread in the shell drains into a ring buffer of that size, which keeps
+// the most recent output.  The rings of all jobs together never exceed
+// $BSH_JOBLOG_TOTAL bytes (default 16 rings); the logs of finished jobs are
+// discarded, oldest first, to make room, and a job that still finds no room
+// has its output discarded.  joblog %N prints the log of job N.
+
+#ifndef JOBLOG_INCLUDED
+#define JOBLOG_INCLUDED
+
+#include <sys/types.h>
+
+// Set up the log of background job JOB (numbered from 1) before it is
+// forked; returns the file descriptor that the child should make its stdout
+// and stderr, or -1 if logging is disabled
+int joblog_pipe(int job);
+
+// Record that job JOB, whose output goes to WFD (from joblog_pipe()), has
+// been forked as PID; closes the shell's copy of WFD
+void joblog_started(int job, pid_t pid, int wfd);
+
+// Handle the joblog builtin:  joblog %N
+int builtin_joblog(int argc, char **argv);
+
+#endif
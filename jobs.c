@@ -0,0 +1,851 @@
+// jobs.c
+//
+// Job table, process groups and the job control builtins.
+#include "process.h"
+#include "jobs.h"
+#include "admit.h"
+#include "events.h"
+#include "capture.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/time.h>
+
+// Number of jobs (job numbers 1 .. MAX_JOBS)
+#define MAX_JOBS 1024
+
+// States of a job
+enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_FOREGROUND      // Resumed by fg:  the shell waits for it itself
+};
+
+// Structure for a job
+typedef struct Job {
+    pid_t pgid;         // Its process group (0 if slot unused)
+    pid_t last;         // Process whose status is the job's
+    int status;         // Status of LAST once it has exited (-1 before)
+    int state;          // JOB_RUNNING, JOB_STOPPED or JOB_FOREGROUND
+    unsigned long seq;  // When it was last started or stopped (for %%)
+    char *text;         // What it runs
+    double started;     // When it entered the table (for events)
+    struct rusage usage;        // Of its processes that have exited
+} Job;
+
+static Job jobs[MAX_JOBS];
+static unsigned long job_seq = 0;
+
+// Structure for the report of a process that a background job forked
+typedef struct JobReport {
+    pid_t pgid;                 // Process group of the job
+    pid_t pid;                  // The process
+    int wstatus;                // Its status from waitpid()
+    struct rusage usage;        // Its resource usage
+} JobReport;
+
+// Pipe from background jobs to the shell for JobReports (-1 if none)
+static int report_fd[2] = { -1, -1 };
+
+static bool job_control = false;        // Foreground jobs get process groups
+static bool in_subshell = false;        // Running in a child of the shell
+static pid_t shell_pgid = 0;            // Process group of the shell
+
+// The foreground job being started (in the shell)
+static pid_t fg_pgid = 0;               // Its process group (0 if none yet)
+static pid_t fg_last = 0;               // Its last process
+static int fg_stop = 0;                 // Signal that stopped it (0 if none)
+
+// Signals that job control leaves to the jobs
+static const int job_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU };
+
+// Signal names known to kill
+static const struct {
+    const char *name;
+    int sig;
+} signal_names[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT },
+    { "ILL", SIGILL }, { "ABRT", SIGABRT }, { "FPE", SIGFPE },
+    { "KILL", SIGKILL }, { "SEGV", SIGSEGV }, { "PIPE", SIGPIPE },
+    { "ALRM", SIGALRM }, { "TERM", SIGTERM }, { "USR1", SIGUSR1 },
+    { "USR2", SIGUSR2 }, { "CHLD", SIGCHLD }, { "CONT", SIGCONT },
+    { "STOP", SIGSTOP }, { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN },
+    { "TTOU", SIGTTOU }, { "WINCH", SIGWINCH }, { NULL, 0 }
+};
+
+// Function to block SIGCHLD, saving the old mask in OLD_MASK
+static void block_sigchld(sigset_t *old_mask)
+{
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, old_mask);
+}
+
+// Function to turn on job control
+void job_control_init(void)
+{
+    if (!isatty(STDIN_FILENO))
+    {
+        return;
+    }
+
+    // A shell started in the background waits to be brought forward
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+    {
+        kill(-shell_pgid, SIGTTIN);
+    }
+
+    for (size_t i = 0; i < sizeof(job_signals) / sizeof(job_signals[0]); i++)
+    {
+        signal(job_signals[i], SIG_IGN);
+    }
+
+    shell_pgid = getpid();
+    if (setpgid(0, 0) < 0 && errno != EPERM)
+    {
+        perror("setpgid");
+        return;
+    }
+    shell_pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job_control = true;
+}
+
+// Function to reserve a job number
+int job_reserve(void)
+{
+    for (int i = 0; i < MAX_JOBS; i++)
+    {
+        if (jobs[i].pgid == 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Function to enter a job into the table
+void job_start(int job, pid_t pgid, pid_t last, const char *text, bool stopped)
+{
+    Job *j = &jobs[job - 1];
+    free(j->text);
+    j->text = strdup(text ? text : "");
+    j->last = last;
+    j->status = -1;
+    j->state = stopped ? JOB_STOPPED : JOB_RUNNING;
+    j->seq = ++job_seq;
+    j->started = events_now();
+    memset(&j->usage, 0, sizeof(j->usage));
+    j->pgid = pgid;
+    events_job_start(job, pgid, j->text, stopped);
+}
+
+// Function to add resource usage RU to SUM
+static void rusage_add(struct rusage *sum, const struct rusage *ru)
+{
+    timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+    if (ru->ru_maxrss > sum->ru_maxrss)
+    {
+        sum->ru_maxrss = ru->ru_maxrss;
+    }
+    sum->ru_minflt += ru->ru_minflt;
+    sum->ru_majflt += ru->ru_majflt;
+    sum->ru_inblock += ru->ru_inblock;
+    sum->ru_oublock += ru->ru_oublock;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+// Function to wait for a process in WHICH (as waitpid() does) that is in
+// process group PGID, reporting the change to the event stream and adding
+// the usage of a process that has exited to *USAGE (if not NULL)
+static pid_t job_wait4(pid_t which, pid_t pgid, int *status, int flags,
+                      struct rusage *usage)
+{
+    struct rusage ru;
+    pid_t pid = wait4(which, status, flags, &ru);
+    if (pid > 0)
+    {
+        events_exit(pid, pgid, *status, &ru);
+        if (usage && !WIFSTOPPED(*status) && !WIFCONTINUED(*status))
+        {
+            rusage_add(usage, &ru);
+        }
+    }
+    return pid;
+}
+
+// Function to wait as job_wait4() does without WNOHANG, starting queued jobs
+// (see admit.h) while it waits
+static pid_t job_wait_admit(pid_t which, pid_t pgid, int *status, int flags,
+                            struct rusage *usage)
+{
+    sigset_t chld, old_mask;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old_mask);
+
+    // With SIGCHLD blocked, a child that exits is seen by sigtimedwait(),
+    // which takes the place of the handler
+    pid_t pid;
+    int ms;
+    while ((pid = job_wait4(which, pgid, status, flags | WNOHANG, usage)) == 0
+           && (ms = admit_poll()) >= 0)
+    {
+        struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+        if (sigtimedwait(&chld, NULL, &ts) == SIGCHLD)
+        {
+            jobs_reap();
+        }
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return (pid == 0) ? job_wait4(which, pgid, status, flags, usage) : pid;
+}
+
+// Function to remove job J (number JOB) from the table
+static void job_finish(Job *j, int job)
+{
+    events_job_finish(job, j->pgid, j->text, j->status < 0 ? 0 : j->status,
+                      j->started, &j->usage);
+    j->pgid = 0;
+}
+
+// Function to collect the status changes of job J; FLAGS may add WUNTRACED
+// and WCONTINUED to WNOHANG.  Returns true if all of its processes have
+// exited.
+static bool job_update(Job *j, int flags)
+{
+    int status;
+    pid_t pid;
+    while ((pid = job_wait4(-j->pgid, j->pgid, &status, WNOHANG | flags, &j->usage)) > 0)
+    {
+        if (WIFSTOPPED(status))
+        {
+            j->state = JOB_STOPPED;
+            j->seq = ++job_seq;
+        }
+        else if (WIFCONTINUED(status))
+        {
+            j->state = JOB_RUNNING;
+        }
+        else if (pid == j->last)
+        {
+            j->status = STATUS(status);
+        }
+    }
+    return pid < 0 && errno == ECHILD;
+}
+
+// Function to announce the processes that background jobs have reported
+static void jobs_reports(void)
+{
+    JobReport r;
+    while (read(report_fd[0], &r, sizeof(r)) == sizeof(r))
+    {
+        for (int i = 0; i < MAX_JOBS; i++)
+        {
+            if (jobs[i].pgid == r.pgid)
+            {
+                events_exit(r.pid, r.pgid, r.wstatus, &r.usage);
+                rusage_add(&jobs[i].usage, &r.usage);
+                WARN("Completed: %d (%d)\n", r.pid, STATUS(r.wstatus));
+            }
+        }
+    }
+}
+
+// Function to reap background jobs
+void jobs_reap(void)
+{
+    int saved = errno;
+    if (report_fd[0] >= 0 && !in_subshell)
+    {
+        jobs_reports();
+    }
+    for (int i = 0; i < MAX_JOBS; i++)
+    {
+        Job *j = &jobs[i];
+        if (j->pgid != 0 && j->state != JOB_FOREGROUND && job_update(j, 0))
+        {
+            WARN("Completed: %d (%d)\n", j->pgid, j->status < 0 ? 0 : j->status);
+            job_finish(j, i + 1);
+        }
+    }
+    errno = saved;
+}
+
+// Function to open the pipe for job_report()
+void job_report_init(void)
+{
+    if (report_fd[0] < 0 && pipe2(report_fd, O_CLOEXEC | O_NONBLOCK) < 0)
+    {
+        perror("pipe");
+        report_fd[0] = report_fd[1] = -1;
+    }
+}
+
+// Function to report process PID to the shell
+void job_report(pid_t pid, int wstatus, const struct rusage *ru)
+{
+    // A report is smaller than PIPE_BUF, so it is written whole or not at
+    // all; one that finds the pipe full is dropped rather than wait
+    JobReport r = { getpgrp(), pid, wstatus, *ru };
+    if (report_fd[1] >= 0 && write(report_fd[1], &r, sizeof(r)) == sizeof(r))
+    {
+        kill(getppid(), SIGCHLD);           // Have the handler read it
+    }
+}
+
+// Function to return the job number of PID
+int background_job(pid_t pid)
+{
+    sigset_t old_mask;
+    block_sigchld(&old_mask);
+    int job = 0;
+    for (int i = 0; i < MAX_JOBS && job == 0; i++)
+    {
+        if (jobs[i].pgid == pid)
+        {
+            job = i + 1;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return job;
+}
+
+// Function to write the redirections of CMD to FP
+static void print_redirects(FILE *fp, const CMD *cmd)
+{
+    if (cmd->fromType == RED_IN)
+    {
+        fprintf(fp, " < %s", cmd->fromFile);
+    }
+    else if (cmd->fromType == RED_IN_HERE)
+    {
+        fprintf(fp, " << ...");
+    }
+    if (cmd->toType == RED_OUT)
+    {
+        fprintf(fp, " > %s", cmd->toFile);
+    }
+    else if (cmd->toType == RED_OUT_APP)
+    {
+        fprintf(fp, " >> %s", cmd->toFile);
+    }
+    else if (cmd->toType == RED_OUT_ERR)
+    {
+        fprintf(fp, " &> %s", cmd->toFile);
+    }
+}
+
+// Function to write a description of CMD to FP
+static void print_cmd(FILE *fp, const CMD *cmd)
+{
+    static const char *ops[] = {
+        [PIPE] = " | ", [SEP_AND] = " && ", [SEP_OR] = " || ",
+        [SEP_END] = "; ", [SEP_BG] = " & "
+    };
+
+    if (!cmd)
+    {
+        return;
+    }
+    switch (cmd->type)
+    {
+        case SIMPLE:
+            for (int i = 0; i < cmd->nLocal; i++)
+            {
+                fprintf(fp, "%s=%s ", cmd->locVar[i], cmd->locVal[i]);
+            }
+            for (int i = 0; i < cmd->argc; i++)
+            {
+                fprintf(fp, i ? " %s" : "%s", cmd->argv[i]);
+            }
+            print_redirects(fp, cmd);
+            break;
+
+        case SUBCMD:
+            fprintf(fp, "(");
+            print_cmd(fp, cmd->left);
+            fprintf(fp, ")");
+            print_redirects(fp, cmd);
+            break;
+
+        case PIPE:
+        case SEP_AND:
+        case SEP_OR:
+        case SEP_END:
+        case SEP_BG:
+            print_cmd(fp, cmd->left);
+            if (cmd->right)
+            {
+                fputs(ops[cmd->type], fp);
+                print_cmd(fp, cmd->right);
+            }
+            else if (cmd->type == SEP_BG)
+            {
+                fputs(" &", fp);
+            }
+            else if (cmd->type == SEP_END)
+            {
+                fputs(";", fp);
+            }
+            break;
+    }
+}
+
+// Function to describe CMD
+char *job_text(const CMD *cmd)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&text, &size);
+    if (!fp)
+    {
+        return strdup("");
+    }
+    print_cmd(fp, cmd);
+    fclose(fp);
+    return text;
+}
+
+// Function to describe the builtin command ARGV
+char *job_words(int argc, char **argv)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&text, &size);
+    if (!fp)
+    {
+        return strdup("");
+    }
+    for (int i = 0; i < argc; i++)
+    {
+        fprintf(fp, i ? " %s" : "%s", argv[i]);
+    }
+    fclose(fp);
+    return text;
+}
+
+// Function to set up a child of the shell
+void job_child(bool background)
+{
+    capture_child(background);              // Output the thread captured
+    admit_child();                          // Queued jobs are the shell's
+
+    // The shell's jobs are not the child's to reap
+    if (!in_subshell)
+    {
+        for (int i = 0; i < MAX_JOBS; i++)
+        {
+            jobs[i].pgid = 0;
+        }
+    }
+
+    if (background)
+    {
+        setpgid(0, 0);
+    }
+    else if (job_control && !in_subshell)
+    {
+        setpgid(0, fg_pgid);
+    }
+    if (job_control && !in_subshell)
+    {
+        for (size_t i = 0; i < sizeof(job_signals) / sizeof(job_signals[0]); i++)
+        {
+            signal(job_signals[i], SIG_DFL);
+        }
+    }
+    in_subshell = true;
+}
+
+// Function to report the fork of PID, in group PGID, to run CMD
+static void job_spawned(pid_t pid, pid_t pgid, const CMD *cmd)
+{
+    if (events_enabled() && cmd)
+    {
+        char *text = job_text(cmd);
+        events_spawn(pid, pgid, text);
+        free(text);
+    }
+}
+
+// Function to place child PID in its process group
+void job_parent(pid_t pid, bool background, const CMD *cmd)
+{
+    if (background)
+    {
+        setpgid(pid, pid);
+        job_spawned(pid, pid, cmd);
+        return;
+    }
+    if (!job_control || in_subshell)
+    {
+        job_spawned(pid, getpgrp(), cmd);
+        return;
+    }
+
+    // Both the shell and the child set the group, so that it is set
+    // whichever of them runs first
+    if (fg_pgid == 0)
+    {
+        fg_pgid = pid;
+        setpgid(pid, pid);
+        tcsetpgrp(STDIN_FILENO, pid);
+    }
+    else
+    {
+        setpgid(pid, fg_pgid);
+    }
+    fg_last = pid;
+    job_spawned(pid, fg_pgid, cmd);
+}
+
+// Function to wait for process PID of the foreground job
+int job_wait(pid_t pid)
+{
+    bool control = job_control && !in_subshell;
+    if (control && fg_stop)
+    {
+        // The job was stopped; its other processes are reaped with it
+        return 128 + fg_stop;
+    }
+
+    int status;
+    pid_t pgid = (control && fg_pgid) ? fg_pgid : getpgrp();
+    while (job_wait_admit(pid, pgid, &status, control ? WUNTRACED : 0, NULL) == -1)
+    {
+        if (errno != EINTR)
+        {
+            perror("waitpid");
+            return errno;
+        }
+    }
+    if (WIFSTOPPED(status))
+    {
+        fg_stop = WSTOPSIG(status);
+        return 128 + fg_stop;
+    }
+    return STATUS(status);
+}
+
+// Function to finish the foreground job CMD
+void job_done(const CMD *cmd)
+{
+    if (!job_control || in_subshell || fg_pgid == 0)
+    {
+        return;
+    }
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+    if (fg_stop)
+    {
+        sigset_t old_mask;
+        block_sigchld(&old_mask);
+        int job = job_reserve();
+        if (job > 0)
+        {
+            char *text = job_text(cmd);
+            job_start(job, fg_pgid, fg_last, text, true);
+            WARN("\n[%d]+  Stopped                 %s\n", job, text);
+            free(text);
+        }
+        else
+        {
+            // No room to keep it:  it would be stopped for good
+            kill(-fg_pgid, SIGCONT);
+        }
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    }
+    fg_pgid = fg_last = 0;
+    fg_stop = 0;
+}
+
+// Function to find the job named by SPEC (%N, %%, %+, or NULL for the
+// current job); returns its index or -1 (after a diagnostic from WHO)
+static int job_find(const char *who, const char *spec)
+{
+    if (!spec || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
+    {
+        int best = -1;
+        for (int i = 0; i < MAX_JOBS; i++)
+        {
+            if (jobs[i].pgid != 0 && (best < 0 || jobs[i].seq > jobs[best].seq))
+            {
+                best = i;
+            }
+        }
+        if (best < 0)
+        {
+            WARN("%s: %s\n", who, "no current job");
+        }
+        return best;
+    }
+
+    char *end;
+    long n = (spec[0] == '%') ? strtol(spec + 1, &end, 10) : 0;
+    if (spec[0] != '%' || end == spec + 1 || *end != '\0' || n < 1
+        || n > MAX_JOBS || jobs[n - 1].pgid == 0)
+    {
+        WARN("%s: %s: no such job\n", who, spec);
+        return -1;
+    }
+    return n - 1;
+}
+
+// Function to return the marker of job I in listings:  + for the current
+// job, - for the previous one
+static char job_mark(int i)
+{
+    int newer = 0;
+    for (int k = 0; k < MAX_JOBS; k++)
+    {
+        if (jobs[k].pgid != 0 && jobs[k].seq > jobs[i].seq)
+        {
+            newer++;
+        }
+    }
+    return newer == 0 ? '+' : newer == 1 ? '-' : ' ';
+}
+
+// Function to handle jobs
+int builtin_jobs(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        WARN("%s\n", "jobs: usage: jobs");
+        return 1;
+    }
+
+    sigset_t old_mask;
+    block_sigchld(&old_mask);
+    for (int i = 0; i < MAX_JOBS; i++)
+    {
+        Job *j = &jobs[i];
+        if (j->pgid == 0)
+        {
+            continue;
+        }
+        bool done = job_update(j, WUNTRACED | WCONTINUED);
+        char state[32];
+        if (done)
+        {
+            snprintf(state, sizeof(state), "Done(%d)", j->status < 0 ? 0 : j->status);
+        }
+        else
+        {
+            snprintf(state, sizeof(state), "%s",
+                     j->state == JOB_STOPPED ? "Stopped" : "Running");
+        }
+        fprintf(BSTDOUT, "[%d]%c  %-22s  %s\n", i + 1, job_mark(i), state, j->text);
+        if (done)
+        {
+            job_finish(j, i + 1);
+        }
+    }
+    admit_list();
+    fflush(BSTDOUT);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return 0;
+}
+
+// Function to handle fg
+int builtin_fg(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        WARN("%s\n", "fg: usage: fg [%N]");
+        return 1;
+    }
+
+    sigset_t old_mask;
+    block_sigchld(&old_mask);
+    int i = job_find("fg", argc == 2 ? argv[1] : NULL);
+    if (i < 0)
+    {
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        return 1;
+    }
+    Job *j = &jobs[i];
+    fprintf(BSTDOUT, "%s\n", j->text);
+    fflush(BSTDOUT);
+
+    // The handler leaves a job in the foreground alone
+    j->state = JOB_FOREGROUND;
+    if (job_control)
+    {
+        tcsetpgrp(STDIN_FILENO, j->pgid);
+    }
+    kill(-j->pgid, SIGCONT);
+
+    int status = 0;
+    for (;;)
+    {
+        int wstatus;
+        pid_t pid = job_wait_admit(-j->pgid, j->pgid, &wstatus, WUNTRACED, &j->usage);
+        if (pid < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (pid < 0)
+        {
+            // All of its processes have exited
+            status = (j->status < 0) ? 0 : j->status;
+            job_finish(j, i + 1);
+            break;
+        }
+        if (WIFSTOPPED(wstatus))
+        {
+            j->state = JOB_STOPPED;
+            j->seq = ++job_seq;
+            status = 128 + WSTOPSIG(wstatus);
+            WARN("\n[%d]+  Stopped                 %s\n", i + 1, j->text);
+            break;
+        }
+        if (pid == j->last)
+        {
+            j->status = STATUS(wstatus);
+        }
+    }
+
+    if (job_control)
+    {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return status;
+}
+
+// Function to handle bg
+int builtin_bg(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        WARN("%s\n", "bg: usage: bg [%N]");
+        return 1;
+    }
+
+    sigset_t old_mask;
+    block_sigchld(&old_mask);
+    int i = job_find("bg", argc == 2 ? argv[1] : NULL);
+    if (i >= 0)
+    {
+        jobs[i].state = JOB_RUNNING;
+        kill(-jobs[i].pgid, SIGCONT);
+        fprintf(BSTDOUT, "[%d]%c %s &\n", i + 1, job_mark(i), jobs[i].text);
+        fflush(BSTDOUT);
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return i < 0;
+}
+
+// Function to convert signal name or number S to a signal; returns -1 if
+// it is not one
+static int signal_number(const char *s)
+{
+    if (isdigit((unsigned char) s[0]))
+    {
+        char *end;
+        long n = strtol(s, &end, 10);
+        return (*end == '\0' && n >= 0 && n < NSIG) ? (int) n : -1;
+    }
+    if (strncasecmp(s, "SIG", 3) == 0)
+    {
+        s += 3;
+    }
+    for (int i = 0; signal_names[i].name; i++)
+    {
+        if (strcasecmp(s, signal_names[i].name) == 0)
+        {
+            return signal_names[i].sig;
+        }
+    }
+    return -1;
+}
+
+// Function to handle kill
+int builtin_kill(int argc, char **argv)
+{
+    int sig = SIGTERM;
+    int i = 1;
+
+    if (argc == 2 && strcmp(argv[1], "-l") == 0)
+    {
+        for (int k = 0; signal_names[k].name; k++)
+        {
+            fprintf(BSTDOUT, "%2d) SIG%s\n", signal_names[k].sig, signal_names[k].name);
+        }
+        fflush(BSTDOUT);
+        return 0;
+    }
+    if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+    {
+        sig = signal_number(argv[i + 1]);
+        if (sig < 0)
+        {
+            WARN("kill: %s: invalid signal specification\n", argv[i + 1]);
+            return 1;
+        }
+        i += 2;
+    }
+    else if (i < argc && argv[i][0] == '-' && argv[i][1] != '\0')
+    {
+        sig = signal_number(argv[i] + 1);
+        if (sig < 0)
+        {
+            WARN("kill: %s: invalid signal specification\n", argv[i] + 1);
+            return 1;
+        }
+        i++;
+    }
+    if (i >= argc)
+    {
+        WARN("%s\n", "kill: usage: kill [-s SIG | -SIG] %N|PID ... or kill -l");
+        return 1;
+    }
+
+    int status = 0;
+    for ( ; i < argc; i++)
+    {
+        if (argv[i][0] == '%')
+        {
+            sigset_t old_mask;
+            block_sigchld(&old_mask);
+            int k = job_find("kill", argv[i]);
+            if (k < 0)
+            {
+                status = 1;
+            }
+            else if (kill(-jobs[k].pgid, sig) < 0)
+            {
+                WARN("kill: %s: %s\n", argv[i], strerror(errno));
+                status = 1;
+            }
+            else if (jobs[k].state == JOB_STOPPED && sig != SIGKILL
+                     && sig != SIGSTOP && sig != SIGCONT)
+            {
+                // A stopped job only sees the signal once it runs
+                kill(-jobs[k].pgid, SIGCONT);
+            }
+            sigprocmask(SIG_SETMASK, &old_mask, NULL);
+            continue;
+        }
+
+        char *end;
+        long pid = strtol(argv[i], &end, 10);
+        if (end == argv[i] || *end != '\0')
+        {
+            WARN("kill: %s: arguments must be process or job IDs\n", argv[i]);
+            status = 1;
+        }
+        else if (kill((pid_t) pid, sig) < 0)
+        {
+            WARN("kill: (%ld) - %s\n", pid, strerror(errno));
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,87 @@
+// jobs.h
+//
+// Job table and job control.
+//
+// Every background job runs in a process group of its own, so that one
+// signal reaches all of its processes.  When the shell reads commands from
+// a terminal, each foreground pipeline also gets its own process group,
+// which is given the terminal while it runs:  ^C and ^Z then reach that job
+// and not the shell, and a stopped job joins the table.  The builtins jobs,
+// fg, bg and kill %N act on the jobs in the table.
+
+#ifndef JOBS_INCLUDED
+#define JOBS_INCLUDED
+
+#include <sys/types.h>
+
+struct rusage;
+
+// Turn on job control if stdin is a terminal:  wait until the shell is in
+// the foreground, put it in its own process group, and ignore the job
+// control signals that are meant for the jobs
+void job_control_init(void);
+
+// Return a free job number (0 if there is none); SIGCHLD must be blocked
+// from before the call until the job has been started
+int job_reserve(void);
+
+// Enter job JOB (from job_reserve()) into the table:  its processes are in
+// process group PGID, the status of process LAST is its status, TEXT
+// describes it, and STOPPED is true if it is stopped
+void job_start(int job, pid_t pgid, pid_t last, const char *text, bool stopped);
+
+// Reap the processes of background jobs that have exited (SIGCHLD handler)
+void jobs_reap(void);
+
+// Open the pipe through which background jobs report processes of their own
+// (see job_report()); called before forking a job that will use it
+void job_report_init(void);
+
+// In a background job of the shell:  report that process PID, which the job
+// forked, has exited with waitpid() status WSTATUS and resource usage RU.
+// The shell announces it as it does a completed job, and adds it to the
+// job's events and usage as if it were one of the job's own processes.
+void job_report(pid_t pid, int wstatus, const struct rusage *ru);
+
+// Return the job number of running background job PID (0 if none)
+int background_job(pid_t pid);
+
+// Return a newly allocated description of command CMD, such as "a | b &"
+char *job_text(const CMD *cmd);
+
+// Return a newly allocated description of the builtin command ARGV
+char *job_words(int argc, char **argv);
+
+// In a child just forked by process():  join the process group of the
+// foreground job (a new one if it is the first process of the job), or
+// start one for a BACKGROUND job, and take the default job control signals
+void job_child(bool background);
+
+// In the shell after forking process PID of the current foreground job (or
+// of a BACKGROUND job) to run CMD (NULL if not a command); the same process
+// group as in job_child()
+void job_parent(pid_t pid, bool background, const CMD *cmd);
+
+// Wait for process PID of the foreground job and return its status; if the
+// job is stopped, return 128 plus the number of the signal that stopped it
+int job_wait(pid_t pid);
+
+// Finish the foreground job CMD:  take the terminal back and, if it was
+// stopped, enter it into the table
+void job_done(const CMD *cmd);
+
+// Handle the job builtins:
+//   jobs                  List the jobs
+//   fg [%N]               Resume job N (default the current job) in the
+//                         foreground and wait for it
+//   bg [%N]               Resume job N in the background
+//   kill [-s SIG | -SIG] %N|PID ...
+//                         Send signal SIG (default TERM) to job N (all of
+//                         its processes) or to process PID
+//   kill -l               List the signal names
+int builtin_jobs(int argc, char **argv);
+int builtin_fg(int argc, char **argv);
+int builtin_bg(int argc, char **argv);
+int builtin_kill(int argc, char **argv);
+
+#endif
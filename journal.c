@@ -0,0 +1,286 @@
+// journal.c
+//
+// Checkpoint journal and resume.
+#include "process.h"
+#include "journal.h"
+#include "enable.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Header of a journal
+#define JOURNAL_HEADER "# bsh journal v1\n"
+
+// Structure for what the journal says about one line
+typedef struct JournalEntry {
+    bool done;          // A record was found
+    int status;         // Status in the last record
+    uint64_t hash;      // Hash of the line in the last record
+} JournalEntry;
+
+static int journal_fd = -1;                     // Journal (-1 if none)
+static JournalEntry *journal_entries = NULL;    // Indexed by line number
+static long journal_count = 0;                  // Entries allocated
+static int journal_pending = 0;                 // Records not yet synced
+static int journal_batch = 64;                  // Records per sync
+static int64_t journal_interval_ns = 1000000000; // Time between syncs
+static int64_t journal_synced_ns = 0;           // Time of the last sync
+
+// Function to return the current CLOCK_MONOTONIC time in nanoseconds
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Function to hash LINE (FNV-1a), ignoring its newline
+static uint64_t line_hash(const char *line)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *s = line; *s && *s != '\n'; s++)
+    {
+        h = (h ^ (unsigned char) *s) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Function to remember that line INDEX finished with STATUS
+static void journal_note(long index, int status, uint64_t hash)
+{
+    if (index >= journal_count)
+    {
+        long count = journal_count ? journal_count : 1024;
+        while (count <= index)
+        {
+            count *= 2;
+        }
+        REALLOC(journal_entries, count);
+        memset(journal_entries + journal_count, 0,
+               (count - journal_count) * sizeof(*journal_entries));
+        journal_count = count;
+    }
+    journal_entries[index] = (JournalEntry) { true, status, hash };
+}
+
+// Function to load the records in FILE; a torn last record is ignored
+static int journal_load(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    if (!fp && errno == ENOENT)
+    {
+        // Nothing to resume yet
+        return 0;
+    }
+    if (!fp)
+    {
+        WARN("journal: %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    char *rec = NULL;
+    size_t size = 0;
+    ssize_t len;
+    bool header = true;
+    while ((len = getline(&rec, &size, fp)) > 0)
+    {
+        long index;
+        int status;
+        uint64_t hash;
+        if (header)
+        {
+            header = false;
+            if (strcmp(rec, JOURNAL_HEADER) != 0)
+            {
+                WARN("journal: %s: %s\n", file, "not a journal");
+                free(rec);
+                fclose(fp);
+                return -1;
+            }
+        }
+        else if (rec[len - 1] == '\n'
+                 && sscanf(rec, "%ld\t%d\t%" SCNx64, &index, &status, &hash) == 3
+                 && index > 0)
+        {
+            journal_note(index, status, hash);
+        }
+    }
+    free(rec);
+    fclose(fp);
+    return 0;
+}
+
+// Function to start journaling
+int journal_open(const char *file, bool resume)
+{
+    const char *s;
+    if ((s = getenv("BSH_JOURNAL_BATCH")) && atoi(s) > 0)
+    {
+        journal_batch = atoi(s);
+    }
+    if ((s = getenv("BSH_JOURNAL_INTERVAL")) && atoi(s) >= 0)
+    {
+        journal_interval_ns = (int64_t) atoi(s) * 1000000;
+    }
+
+    if (resume && journal_load(file) < 0)
+    {
+        return -1;
+    }
+
+    // A fresh journal starts empty; a resumed one is appended to, so that
+    // records of lines skipped now are kept for the next resume
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (resume ? 0 : O_TRUNC);
+    journal_fd = open(file, flags, 0644);
+    if (journal_fd < 0)
+    {
+        WARN("journal: %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(journal_fd, &st) == 0 && st.st_size == 0)
+    {
+        if (write(journal_fd, JOURNAL_HEADER, strlen(JOURNAL_HEADER)) < 0)
+        {
+            WARN("journal: %s: %s\n", file, strerror(errno));
+        }
+    }
+    journal_synced_ns = now_ns();
+    return 0;
+}
+
+// Function to sync the journal
+static void journal_sync(void)
+{
+    if (journal_pending > 0)
+    {
+        fdatasync(journal_fd);
+        journal_pending = 0;
+    }
+    journal_synced_ns = now_ns();
+}
+
+// Function to check whether CMD changes the state of the shell itself
+static bool changes_shell(const CMD *cmd)
+{
+    static const char *builtins[] = { "cd", "pushd", "popd", "read", "enable",
+                                      "every", "on-change", "admit", NULL };
+
+    if (!cmd)
+    {
+        return false;
+    }
+    switch (cmd->type)
+    {
+        case SIMPLE:
+            // A loaded builtin may set variables (see plugin.h)
+            if (cmd->argc > 0 && loadable_loaded(cmd->argv[0]))
+            {
+                return true;
+            }
+            for (const char **b = builtins; cmd->argc > 0 && *b; b++)
+            {
+                if (strcmp(cmd->argv[0], *b) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+
+        case SEP_AND:
+        case SEP_OR:
+        case SEP_END:
+            return changes_shell(cmd->left) || changes_shell(cmd->right);
+
+        case SEP_BG:
+            // The left side runs in a child
+            return changes_shell(cmd->right);
+
+        default:
+            // Pipeline stages and subshells run in children
+            return false;
+    }
+}
+
+// Function to check whether line INDEX may be skipped
+bool journal_skip(long index, const char *line, const CMD *cmd)
+{
+    // Records older than the interval are synced before a line that may
+    // run for a long time
+    if (journal_fd >= 0 && journal_pending > 0
+        && now_ns() - journal_synced_ns >= journal_interval_ns)
+    {
+        journal_sync();
+    }
+
+    if (index >= journal_count || !journal_entries[index].done
+        || journal_entries[index].status != 0
+        || journal_entries[index].hash != line_hash(line))
+    {
+        return false;
+    }
+    const char *comment = strchr(line, '#');
+    if (comment && strstr(comment, "bsh:rerun"))
+    {
+        return false;
+    }
+    return !changes_shell(cmd);
+}
+
+// Function to check whether CMD starts a background job
+static bool has_background(const CMD *cmd)
+{
+    return cmd && (cmd->type == SEP_BG || has_background(cmd->left)
+                   || has_background(cmd->right));
+}
+
+// Function to refuse line INDEX if it cannot be journaled
+bool journal_refuse(long index, const CMD *cmd)
+{
+    if (journal_fd < 0 || !has_background(cmd))
+    {
+        return false;
+    }
+    // The line finishes before its jobs do, so its status says nothing
+    // about whether they succeeded
+    fprintf(stderr, "journal: line %ld: background jobs cannot be journaled\n",
+            index);
+    return true;
+}
+
+// Function to record a finished line
+void journal_line(long index, const char *line, int status)
+{
+    if (journal_fd < 0)
+    {
+        return;
+    }
+
+    char rec[64];
+    int n = snprintf(rec, sizeof(rec), "%ld\t%d\t%016" PRIx64 "\n",
+                     index, status, line_hash(line));
+    if (write(journal_fd, rec, n) != n)
+    {
+        perror("journal");
+        return;
+    }
+
+    if (++journal_pending >= journal_batch
+        || now_ns() - journal_synced_ns >= journal_interval_ns)
+    {
+        journal_sync();
+    }
+}
+
+// Function to sync the journal at exit
+void journal_close(void)
+{
+    if (journal_fd >= 0)
+    {
+        journal_sync();
+        close(journal_fd);
+        journal_fd = -1;
+    }
+}
@@ -0,0 +1,55 @@
+// journal.h
+//
+// Checkpoint journal for long scripts.
+//
+//   Bash --journal FILE           Run the script on stdin, journaling each
+//                                 top-level line that finishes
+//   Bash --journal FILE --resume  Run it again, skipping the lines that the
+//                                 journal shows to have succeeded
+//
+// A journal is a text file:  a header line, then one line per finished
+// command line with its index in the script (from 1), its status and a
+// hash of its text, separated by tabs.  Each record is written as soon as
+// its line finishes, so it survives the shell being killed.  To survive a
+// crash of the host, the journal is synced once $BSH_JOURNAL_BATCH records
+// (default 64) are waiting; when a record is written, or a line is about to
+// start, $BSH_JOURNAL_INTERVAL ms (default 1000) or more after the last
+// sync; and on exit.  The interval is not a timer:  a record written just
+// before a long line can stay unsynced until that line has finished.  A line
+// whose record is lost simply runs again.
+//
+// A line is skipped only if its last record has status 0 and the same hash
+// (so an edited line runs again).  A line runs every time if it has a
+// comment containing "bsh:rerun", or if it runs cd, pushd, popd, read,
+// enable, every, on-change, admit or a builtin loaded with enable -f in the
+// shell itself:  later lines depend on what those did (every and on-change
+// leave watchers running, admit sets the limits for later jobs, and a loaded
+// builtin may set variables), and a read of the script's own stdin must
+// consume the same input as before.
+//
+// A line that starts a background job (&), even inside a subshell, is
+// refused rather than run:  the line finishes before its jobs do, so its
+// status cannot say whether they succeeded.
+
+#ifndef JOURNAL_INCLUDED
+#define JOURNAL_INCLUDED
+
+// Start journaling to FILE, first loading its records if RESUME is true;
+// returns 0, or -1 after a diagnostic
+int journal_open(const char *file, bool resume);
+
+// Return true if line number INDEX, LINE, parsed as CMD, may be skipped
+bool journal_skip(long index, const char *line, const CMD *cmd);
+
+// Return true, after a diagnostic, if journaling and line number INDEX,
+// parsed as CMD, starts a background job and so must not run
+bool journal_refuse(long index, const CMD *cmd);
+
+// Record that line number INDEX, LINE, finished with status STATUS (no-op
+// unless journaling)
+void journal_line(long index, const char *line, int status);
+
+// Sync the journal (at exit)
+void journal_close(void);
+
+#endif
@@ -7,43 +7,132 @@
 // Dumps token list or CMD tree if DUMP_LIST or DUMP_TREE is set.
 
 #include "process.h"
+#include "test.h"
+#include "expand.h"
+#include "read.h"
+#include "history.h"
+#include "serve.h"
+#include "batch.h"
+#include "record.h"
+#include "check.h"
+#include "ahead.h"
+#include "jobs.h"
+#include "events.h"
+#include "journal.h"
+#include "profile.h"
+#include "admit.h"
+
+// Expand, tokenize, and parse LINE; return the command (NULL on error)
+static CMD *parseLine (const char *line)
+{
+    char *text;                     // Line after expansion
+    token *list;                    // Linked list of tokens
+    CMD *cmd;                       // Parsed command
+
+    text = expand (line);                       // Expand $VAR and $((EXPR))
+    if (text == NULL) {
+	update_status (1);                      //   failing the line on error
+	return NULL;
+    }
+
+    list = tokenize (text);                     // Lex line into tokens
+    free (text);
+    if (list == NULL)
+	return NULL;
+    else if (getenv ("DUMP_LIST"))              // Dump token list only if
+	dumpList (list);                        //   environment variable set
 
-int main()
+    cmd = parse (list);                         // Parsed command
+    freeList (list);                            // Free token list
+    return cmd;
+}
+
+
+int main (int argc, char **argv)
 {
     int nCmd = 1;                   // Command number
     char *line = NULL;              // Space for line read
-    token *list;                    // Linked list of tokens
     CMD *cmd;                       // Parsed command
-
-    setenv ("?", "0", 1);                       // Initial status
+    int status;                     // Status of command
+    long nLines = 0;                // Number of lines read
+
+    shell_init ();                              // Reap background jobs
+    events_init ();                             // Job events if requested
+    profile_init ();                            // Profile shell if requested
+    update_status (0);                          // Initial status
+
+    if (argc == 3 && !strcmp (argv[1], "--serve"))
+	return serve (argv[2]);                 // Server mode
+    else if (argc > 2 && !strcmp (argv[1], "--batch"))
+	return batch (argc-2, argv+2);          // Batch mode
+    else if (argc > 2 && !strcmp (argv[1], "--replay"))
+	return replay (argc-2, argv+2);         // Replay mode
+    else if (argc == 3 && !strcmp (argv[1], "-n"))
+	return check_script (argv[2], false);   // Syntax check only
+    else if (argc == 4 && !strcmp (argv[1], "-n") && !strcmp (argv[2], "--run"))
+	return check_script (argv[3], true);    // Check, then run
+    else if (argc == 3 && !strcmp (argv[1], "--record")) {
+	if (record_open (argv[2]) < 0)          // Record this session
+	    return EXIT_FAILURE;
+    } else if ((argc == 3 || (argc == 4 && !strcmp (argv[3], "--resume")))
+	       && !strcmp (argv[1], "--journal")) {
+	if (journal_open (argv[2], argc == 4) < 0)  // Journal this script
+	    return EXIT_FAILURE;
+    } else if (argc > 1) {
+	fprintf (stderr, "usage: %s [--serve SOCKET | --batch FILE.jsonl"
+		 " [-j N] [--completion-order] | --record FILE"
+		 " | --replay FILE [--fast] | -n [--run] SCRIPT"
+		 " | --journal FILE [--resume]]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
 
     setvbuf (stdin, NULL, _IONBF, 1);           // Disable buffering of stdin
+    job_control_init ();                        // Job control if interactive
+    bool ahead = !getenv ("DUMP_LIST")          // Parse script ahead unless
+	&& ahead_start ();                      //   dumping token lists
 
     size_t nLine = 0;                           // #chars allocated
     for ( ; ; ) {
 	printf ("(%d)$ ", nCmd);                // Prompt for command
 	fflush (stdout);
+	admit_idle (STDIN_FILENO);              // Start queued jobs meanwhile
 
-	if (getline (&line,&nLine, stdin) <= 0) // Read line
+	cmd = NULL;
+	if ((ahead ? ahead_getline (&line, &nLine, &cmd)     // Read line
+		   : getline (&line, &nLine, stdin)) <= 0)
 	    break;                              //   Break on end of file
+	record_arrival ();                      // Note arrival time
+	nLines++;
 
-	list = tokenize (line);                 // Lex line into tokens
-	if (list == NULL)
+	if (cmd == NULL                         // Unless parsed ahead,
+	      && (cmd = parseLine (line)) == NULL)  //   parse line
 	    continue;
-	else if (getenv ("DUMP_LIST"))          // Dump token list only if
-	    dumpList (list);                    //   environment variable set
 
-	cmd = parse (list);                     // Parsed command
-	freeList (list);                        // Free token list
-	if (cmd == NULL)
-	    continue;
-	else if (getenv ("DUMP_TREE")) {        // Dump command tree if
+	if (getenv ("DUMP_TREE")) {             // Dump command tree if
 	    dumpTree (cmd, 0);                  //   environment variable set
 	    printf ("\n");
 	    fflush (stdout);
 	}
 
-	process (cmd);                          // Execute command
+	if (journal_skip (nLines, line, cmd)) { // Skip line that succeeded
+	    update_status (0);                  //   before we resumed
+	    freeCMD (cmd);
+	    continue;
+	}
+
+	if (journal_refuse (nLines, cmd)) {     // Refuse line with & when
+	    update_status (1);                  //   journaling
+	    freeCMD (cmd);
+	    continue;
+	}
+
+	history_add (line);                     // Record accepted line
+
+	status = process (cmd);                 // Execute command
+	record_line (line, status);             // Log line if recording
+	journal_line (nLines, line, status);    // Journal line if journaling
+	stat_cache_invalidate ();               // Stat cache lasts one line
+	read_buffer_release ();                 // Give back unused input
 
 	if (getenv ("DUMP_TREE_AGAIN")) {       // Dump command tree again if
 	    dumpTree (cmd, 0);                  //   environment variable set
@@ -56,6 +145,8 @@ int main()
     }
 
     free (line);
+    admit_drain ();                             // Start jobs still queued
+    journal_close ();
     return EXIT_SUCCESS;
 }
 
@@ -71,71 +162,6 @@ void dumpList (struct token *list)
 }
 
 
-// Free list of tokens LIST
-void freeList (token *list)
-{
-    token *p, *pnext;
-    for (p = list;  p;  p = pnext)  {
-	pnext = p->next;  p->next = NULL;       // Zap p->next and p->text
-	free(p->text);    p->text = NULL;       //   to stop accidental reuse
-	free(p);
-    }
-}
-
-
-// Allocate, initialize, and return a pointer to an empty command structure
-CMD *mallocCMD (void)
-{
-    CMD *new = malloc(sizeof(*new));
-
-    new->type     = NONE;
-    new->argc     = 0;
-    new->argv     = malloc (sizeof(char *));
-    new->argv[0]  = NULL;
-    new->nLocal   = 0;
-    new->locVar   = NULL;
-    new->locVal   = NULL;
-    new->fromType = NONE;
-    new->fromFile = NULL;
-    new->toType   = NONE;
-    new->toFile   = NULL;
-    new->errType  = NONE;
-    new->errFile  = NULL;
-    new->left     = NULL;
-    new->right    = NULL;
-
-    return new;
-}
-
-
-// Free tree of commands rooted at *C
-void freeCMD (CMD *c)
-{
-    if (!c)
-	return;
-
-    for (int i = 0; i < c->nLocal; i++) {
-	free (c->locVar[i]);
-	free (c->locVal[i]);
-    }
-    free (c->locVar);
-    free (c->locVal);
-
-    for (char **p = c->argv;  *p;  p++)
-	free (*p);
-    free (c->argv);
-
-    free (c->fromFile);
-    free (c->toFile);
-    free (c->errFile);
-
-    freeCMD (c->left);
-    freeCMD (c->right);
-
-    free (c);
-}
-
-
 ///////////////////////////////////////////////////////////////////////////////
 // Dump CMD structure in tree format
 
@@ -0,0 +1,207 @@
+// onchange.c
+//
+// Watcher jobs for the on-change builtin.
+#include "process.h"
+#include "watch.h"
+#include "onchange.h"
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+
+// Default debounce window in milliseconds
+#define ONCHANGE_DEBOUNCE 100
+
+// Events that count as a change
+#define ONCHANGE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE \
+                         | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                         | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Structure for the settings of a trigger
+typedef struct OnChange {
+    Watch *w;                   // Its watcher
+    long debounce_ms;           // Debounce window
+    int npaths;                 // Number of paths watched
+    char **paths;               // The paths (in the shell's argv)
+} OnChange;
+
+// Function to arm one-shot timerfd FD to expire after MS milliseconds
+static void arm_timer(int fd, long ms)
+{
+    struct itimerspec its = { { 0, 0 }, { ms / 1000, (ms % 1000) * 1000000 } };
+    if (ms == 0)
+    {
+        its.it_value.tv_nsec = 1;           // 0 would disarm the timer
+    }
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+// Function to (re)add the watch of path I of trigger T to inotify instance
+// FD; WDS maps paths to watch descriptors
+static void add_watch(const OnChange *t, int fd, int *wds, int i)
+{
+    wds[i] = inotify_add_watch(fd, t->paths[i], ONCHANGE_EVENTS);
+    if (wds[i] < 0)
+    {
+        WARN("on-change: %s: %s\n", t->paths[i], strerror(errno));
+    }
+}
+
+// Function to run the watcher of trigger T (in the background job); only
+// returns if inotify cannot be set up
+static int onchange_watcher(const void *arg)
+{
+    const OnChange *t = arg;
+    Watch *w = t->w;
+    WatchStats *stats = w->stats;
+
+    int chld_fd = watch_init();
+    int in_fd = inotify_init1(IN_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int *wds = malloc(t->npaths * sizeof(*wds));
+    if (in_fd < 0 || timer_fd < 0 || chld_fd < 0 || !wds)
+    {
+        perror("on-change");
+        return errno;
+    }
+    for (int i = 0; i < t->npaths; i++)
+    {
+        add_watch(t, in_fd, wds, i);
+    }
+
+    bool armed = false;                     // Window open, run at its end
+    bool again = false;                     // Changed during the run
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;)
+    {
+        struct pollfd pfd[3] = {
+            { in_fd, POLLIN, 0 }, { timer_fd, POLLIN, 0 }, { chld_fd, POLLIN, 0 }
+        };
+        if (poll(pfd, 3, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            return errno;
+        }
+
+        if (pfd[0].revents & POLLIN)
+        {
+            ssize_t n = read(in_fd, buf, sizeof(buf));
+            unsigned long changes = 0;
+            for (char *p = buf; n > 0 && p < buf + n; )
+            {
+                const struct inotify_event *ev = (const struct inotify_event *) p;
+                p += sizeof(*ev) + ev->len;
+                if (ev->mask & IN_IGNORED)
+                {
+                    // The path was replaced (as many editors save) or
+                    // removed; watch whatever is there now
+                    for (int i = 0; i < t->npaths; i++)
+                    {
+                        if (wds[i] == ev->wd)
+                        {
+                            add_watch(t, in_fd, wds, i);
+                        }
+                    }
+                    continue;
+                }
+                changes++;
+            }
+
+            // The first event of a burst opens the window; the rest of the
+            // burst falls into it
+            stats->events += changes;
+            if (changes > 0 && w->run > 0)
+            {
+                again = true;
+                stats->skipped += changes;
+            }
+            else if (changes > 0 && !armed)
+            {
+                arm_timer(timer_fd, t->debounce_ms);
+                armed = true;
+                stats->skipped += changes - 1;
+            }
+            else
+            {
+                stats->skipped += changes;
+            }
+        }
+
+        if ((pfd[2].revents & POLLIN) && watch_reap(w, chld_fd) && again)
+        {
+            again = false;
+            arm_timer(timer_fd, t->debounce_ms);
+            armed = true;
+        }
+
+        if (pfd[1].revents & POLLIN)
+        {
+            uint64_t ticks;
+            if (read(timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks) && armed)
+            {
+                armed = false;
+                watch_run(w);
+            }
+        }
+    }
+}
+
+// Function to handle the on-change builtin
+int builtin_onchange(int argc, char **argv)
+{
+    if (argc == 1)
+    {
+        return watch_list("on-change");
+    }
+
+    long debounce = ONCHANGE_DEBOUNCE;
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "--debounce") == 0)
+    {
+        char *end;
+        errno = 0;
+        debounce = strtol(argv[i + 1], &end, 10);
+        if (end == argv[i + 1] || *end != '\0' || errno || debounce < 0
+            || debounce > INT_MAX)
+        {
+            WARN("on-change: %s: invalid debounce\n", argv[i + 1]);
+            return 1;
+        }
+        i += 2;
+    }
+
+    int first = i;
+    while (i < argc && strcmp(argv[i], "--") != 0)
+    {
+        i++;
+    }
+    if (i == first || i + 1 >= argc)
+    {
+        WARN("%s\n", "usage: on-change [--debounce MS] PATHS... -- COMMAND-LINE");
+        return 1;
+    }
+    for (int j = first; j < i; j++)
+    {
+        if (access(argv[j], F_OK) != 0)
+        {
+            WARN("on-change: %s: %s\n", argv[j], strerror(errno));
+            return 1;
+        }
+    }
+
+    int status;
+    Watch *w = watch_new("on-change", argc, argv, i + 1, &status);
+    if (!w)
+    {
+        return status;
+    }
+    snprintf(w->desc, sizeof(w->desc), "on-change %ldms", debounce);
+    w->report = true;
+
+    OnChange t = { w, debounce, i - first, argv + first };
+    return watch_start(w, onchange_watcher, &t, argc, argv);
+}
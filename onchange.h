@@ -0,0 +1,22 @@
+// onchange.h
+//
+// File-change triggers.  on-change PATHS... -- COMMAND-LINE starts a
+// background job that watches PATHS with inotify and runs COMMAND-LINE (parsed
+// once, when the trigger is created) after they change.  A burst of events,
+// such as an editor writing a file in several steps, is coalesced into one
+// run per debounce window, and a change during a run causes one more run
+// after it instead of a second concurrent one.  The shell announces each
+// run that completes and counts it in the events and usage of the job.
+
+#ifndef ONCHANGE_INCLUDED
+#define ONCHANGE_INCLUDED
+
+// Handle the on-change builtin:
+//   on-change [--debounce MS] PATHS... -- COMMAND-LINE
+//                       Run COMMAND-LINE at most once every MS milliseconds
+//                       (default 100) after a file in PATHS changes; for a
+//                       directory, its entries are watched
+//   on-change           List the triggers that are running with their stats
+int builtin_onchange(int argc, char **argv);
+
+#endif
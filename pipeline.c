@@ -0,0 +1,180 @@
+// pipeline.c
+//
+// Threads for builtin pipeline stages.
+#include "process.h"
+#include "pipeline.h"
+#include "read.h"
+#include "dirstack.h"
+#include "joblog.h"
+#include "enable.h"
+#include "capture.h"
+
+_Thread_local FILE *builtin_stdout = NULL;
+_Thread_local bool builtin_isolated = false;
+
+// Function to run read as a stage reading FD
+static int stage_read(int argc, char **argv, int fd)
+{
+    return builtin_read(argc, argv, fd);
+}
+
+// Function to run dirs as a stage
+static int stage_dirs(int argc, char **argv, int fd)
+{
+    return builtin_dirs(argc, argv);
+}
+
+// Function to run joblog as a stage
+static int stage_joblog(int argc, char **argv, int fd)
+{
+    return builtin_joblog(argc, argv);
+}
+
+// Builtins that can run as threads: they touch no state that another stage
+// could be changing at the same time, and only change the shell's state in
+// ways that builtin_isolated suppresses
+static const struct {
+    const char *name;
+    int (*run)(int argc, char **argv, int fd);
+} stage_builtins[] = {
+    { "read",   stage_read },
+    { "dirs",   stage_dirs },
+    { "joblog", stage_joblog },
+};
+
+#define NSTAGE_BUILTINS (sizeof(stage_builtins) / sizeof(stage_builtins[0]))
+
+// Index for a loaded builtin that may run in a thread (see enable.h)
+#define STAGE_LOADABLE ((int) NSTAGE_BUILTINS)
+
+// Function to return the index of CMD in stage_builtins (STAGE_LOADABLE for
+// a loaded builtin, -1 if none)
+static int stage_builtin(const CMD *cmd)
+{
+    if (cmd->type != SIMPLE || cmd->argc == 0 || cmd->nLocal != 0
+        || cmd->fromType != NONE || cmd->toType != NONE || cmd->errType != NONE)
+    {
+        return -1;
+    }
+    for (int i = 0; i < (int) NSTAGE_BUILTINS; i++)
+    {
+        if (strcmp(cmd->argv[0], stage_builtins[i].name) == 0)
+        {
+            // Input that read -B has kept belongs to the main thread; a
+            // forked read gets a copy of it
+            if (stage_builtins[i].run == stage_read && read_buffer_pending())
+            {
+                return -1;
+            }
+            return i;
+        }
+    }
+    return loadable_threadable(cmd) ? STAGE_LOADABLE : -1;
+}
+
+// Function to check whether CMD can run in a thread
+bool stage_threadable(const CMD *cmd)
+{
+    return stage_builtin(cmd) >= 0;
+}
+
+// Function to run the stage ARG (in its thread)
+static void *stage_main(void *arg)
+{
+    Stage *stage = arg;
+    const CMD *cmd = stage->cmd;
+
+    builtin_isolated = true;
+
+    // A stage writes where the thread that started it would have written
+    if ((stage->capture_out >= 0 || stage->capture_err >= 0)
+        && capture_output(stage->out < 0 ? stage->capture_out : -1,
+                          stage->capture_err) < 0)
+    {
+        perror("capture");
+    }
+    if (stage->out >= 0)
+    {
+        builtin_stdout = fdopen(stage->out, "w");
+        if (!builtin_stdout)
+        {
+            perror("fdopen");
+            close(stage->out);
+            stage->status = errno;
+        }
+    }
+
+    if (stage->out < 0 || builtin_stdout)
+    {
+        int fd = (stage->in >= 0) ? stage->in : STDIN_FILENO;
+        int i = stage_builtin(cmd);
+        if (i == STAGE_LOADABLE)
+        {
+            int out = (stage->out >= 0) ? stage->out
+                      : (stage->capture_out >= 0) ? stage->capture_out : STDOUT_FILENO;
+            stage->status = loadable_stage(cmd, fd, out);
+        }
+        else
+        {
+            stage->status = stage_builtins[i].run(cmd->argc, cmd->argv, fd);
+        }
+    }
+
+    // Closing the descriptors is what lets the neighbours see end of file
+    if (stage->out >= 0 && builtin_stdout)
+    {
+        fclose(builtin_stdout);
+        builtin_stdout = NULL;
+    }
+    if (stage->in >= 0)
+    {
+        close(stage->in);
+    }
+    capture_output(-1, -1);
+    return NULL;
+}
+
+// Function to start CMD in a thread
+int stage_start(Stage *stage, const CMD *cmd, int in, int out)
+{
+    *stage = (Stage) { 0, cmd, in, out, 0, -1, -1 };
+    capture_fds(&stage->capture_out, &stage->capture_err);
+
+    // The directory stack is set up on first use; do it here, before a
+    // second stage could race to
+    if (strcmp(cmd->argv[0], "dirs") == 0)
+    {
+        shell_pwd();
+    }
+
+    // The thread takes no signals:  SIGCHLD and SIGINT belong to the main
+    // thread, and a write to a closed pipe should fail with EPIPE rather
+    // than kill the shell
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+    int rc = pthread_create(&stage->thread, NULL, stage_main, stage);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (rc != 0)
+    {
+        WARN("pthread_create: %s\n", strerror(rc));
+        if (in >= 0)
+        {
+            close(in);
+        }
+        if (out >= 0)
+        {
+            close(out);
+        }
+        return rc;
+    }
+    return 0;
+}
+
+// Function to wait for STAGE
+int stage_wait(Stage *stage)
+{
+    pthread_join(stage->thread, NULL);
+    return stage->status;
+}
@@ -0,0 +1,38 @@
+// pipeline.h
+//
+// Builtin pipeline stages that run as threads.  A stage of a pipeline that
+// is a builtin which can be isolated from the shell's state runs in a thread
+// of the shell, connected to its neighbours by the pipe, instead of in a
+// forked child.  As in a child, it may read the shell's state but not change
+// it:  read consumes its record and sets its exit status but assigns no
+// variables.
+
+#ifndef PIPELINE_INCLUDED
+#define PIPELINE_INCLUDED
+
+#include <pthread.h>
+
+// Structure for a stage running in a thread
+typedef struct Stage {
+    pthread_t thread;
+    const CMD *cmd;     // The builtin command
+    int in;             // Descriptor for its stdin (-1 for the shell's)
+    int out;            // Descriptor for its stdout (-1 for the shell's)
+    int status;         // Its status once it has finished
+    int capture_out;    // Output of the thread that started it (see
+    int capture_err;    //   capture.h; -1 if not captured)
+} Stage;
+
+// Return true if CMD can run in a thread as a pipeline stage
+bool stage_threadable(const CMD *cmd);
+
+// Start CMD (which must be threadable) in a thread with stdin IN and stdout
+// OUT (-1 to keep the shell's); the stage owns IN and OUT and closes them
+// when it finishes.  Return 0 on success and errno on failure, in which case
+// IN and OUT have been closed.
+int stage_start(Stage *stage, const CMD *cmd, int in, int out);
+
+// Wait for STAGE to finish and return its status
+int stage_wait(Stage *stage);
+
+#endif
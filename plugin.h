@@ -0,0 +1,56 @@
+// plugin.h
+//
+// ABI for builtins loaded from shared objects with  enable -f LIB NAME.
+// This header is all that a plugin needs:  it does not include the shell's
+// headers, and a plugin links against nothing in the shell.
+//
+// A plugin for builtin NAME defines
+//
+//     const BshBuiltin bsh_builtin_NAME = {
+//         BSH_BUILTIN_ABI, "NAME", run, flags, "usage: NAME ..."
+//     };
+//
+// (with each '-' in NAME written as '_').  The shell calls RUN in its own
+// process for every command NAME, in place of forking an executable.  RUN
+// reads and writes the descriptors in its BshShell (not stdin and stdout),
+// must not exit(), and returns the command's status.  Anything it leaves
+// open or allocated stays with the shell.
+
+#ifndef PLUGIN_INCLUDED
+#define PLUGIN_INCLUDED
+
+// Version of the ABI; the shell refuses a builtin built for another one
+#define BSH_BUILTIN_ABI 1
+
+// Flags of a builtin
+#define BSH_BUILTIN_THREADSAFE 0x1      // RUN may run in a thread, at the
+					//   same time as other builtins, as
+					//   a pipeline stage (see pipeline.h)
+
+// The shell as seen by a builtin
+typedef struct BshShell {
+    int abi;            // BSH_BUILTIN_ABI
+    int in;             // Descriptor for the builtin's stdin
+    int out;            // Descriptor for its stdout
+    int err;            // Descriptor for its stderr
+
+    // Return the value of shell variable NAME (NULL if unset); the value
+    // stays valid until the builtin returns or changes NAME
+    const char *(*get_var)(const char *name);
+
+    // Set shell variable NAME to VALUE (unset it if VALUE is NULL); return 0
+    // on success and an errno value on failure.  In a pipeline stage the
+    // assignment is discarded, as it would be in a forked stage.
+    int (*set_var)(const char *name, const char *value);
+} BshShell;
+
+// A builtin
+typedef struct BshBuiltin {
+    int abi;            // BSH_BUILTIN_ABI
+    const char *name;   // Name of the command
+    int (*run)(const BshShell *sh, int argc, char **argv);
+    unsigned flags;     // BSH_BUILTIN_* flags
+    const char *usage;  // One-line usage message (may be NULL)
+} BshBuiltin;
+
+#endif
@@ -0,0 +1,392 @@
+// prefetch.c
+//
+// Page-cache prefetch of executables and their shared libraries.
+#include "process.h"
+#include "prefetch.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Number of command names that may wait to be prefetched
+#define PREFETCH_QUEUE 64
+
+// Size of the table of names and files seen (a power of 2)
+#define PREFETCH_SEEN 4096
+
+// Largest dynamic section that is read
+#define PREFETCH_DYNAMIC (1 << 20)
+
+// Directories searched for shared libraries after $LD_LIBRARY_PATH
+static const char *lib_dirs[] = {
+    "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib64",
+    "/usr/lib64", "/lib", "/usr/lib", NULL
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // Signalled when a name has been queued
+    char *queue[PREFETCH_QUEUE];
+    int head;               // Index of the oldest name
+    int count;              // Number of names queued
+    bool started;           // The thread has been started
+    char *path;             // $PATH when it was started
+    char *lib_path;         // $LD_LIBRARY_PATH when it was started
+} prefetch = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// Command names and files already prefetched (used only by the thread)
+static char *seen[PREFETCH_SEEN];
+static int nseen = 0;
+
+// Function to add S to the names seen; returns false if it was there
+static bool see(const char *s)
+{
+    unsigned long h = 5381;
+    for (const char *p = s; *p; p++)
+    {
+        h = h * 33 + (unsigned char) *p;
+    }
+    for (unsigned long i = h; ; i++)
+    {
+        char **slot = &seen[i & (PREFETCH_SEEN - 1)];
+        if (!*slot)
+        {
+            // A full table just stops remembering
+            if (nseen < PREFETCH_SEEN / 2)
+            {
+                *slot = strdup(s);
+                nseen++;
+            }
+            return true;
+        }
+        if (strcmp(*slot, s) == 0)
+        {
+            return false;
+        }
+    }
+}
+
+static void prefetch_file(const char *path, int depth);
+
+// Function to prefetch the shared library NAME needed by a program
+static void prefetch_library(const char *name, int depth)
+{
+    char path[PATH_MAX];
+    if (strchr(name, '/'))
+    {
+        prefetch_file(name, depth);
+        return;
+    }
+
+    char *dirs = strdup(prefetch.lib_path);
+    char *save;
+    for (char *dir = strtok_r(dirs, ":", &save); dir; dir = strtok_r(NULL, ":", &save))
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (access(path, R_OK) == 0)
+        {
+            free(dirs);
+            prefetch_file(path, depth);
+            return;
+        }
+    }
+    free(dirs);
+
+    for (const char **dir = lib_dirs; *dir; dir++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", *dir, name);
+        if (access(path, R_OK) == 0)
+        {
+            prefetch_file(path, depth);
+            return;
+        }
+    }
+}
+
+// Function to read LEN bytes at offset OFF of FD into BUF; returns false if
+// they cannot all be read
+static bool read_at(int fd, void *buf, size_t len, off_t off)
+{
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, buf, len, off);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        buf = (char *) buf + n;
+        len -= n;
+        off += n;
+    }
+    return true;
+}
+
+// Function to check that the LEN bytes at offset OFF lie within a file of SIZE
+// bytes (written so that nothing can overflow)
+static bool in_file(uint64_t off, uint64_t len, uint64_t size)
+{
+    return off <= size && len <= size - off;
+}
+
+// Function to convert virtual address ADDR into a file offset *OFF using the
+// NPH program headers PH; returns false if it is not in a segment
+static bool elf_offset(const Elf64_Phdr *ph, int nph, Elf64_Addr addr,
+                       uint64_t *off)
+{
+    for (int i = 0; i < nph; i++)
+    {
+        if (ph[i].p_type == PT_LOAD && addr >= ph[i].p_vaddr
+            && addr - ph[i].p_vaddr < ph[i].p_filesz
+            && ph[i].p_offset <= UINT64_MAX - (addr - ph[i].p_vaddr))
+        {
+            *off = ph[i].p_offset + (addr - ph[i].p_vaddr);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to prefetch the libraries in the NDYN entries DYN of the dynamic
+// section of ELF file FD (of SIZE bytes), whose program headers are PH
+static void prefetch_dynamic(int fd, uint64_t size, const Elf64_Phdr *ph,
+                             int nph, const Elf64_Dyn *dyn, size_t ndyn,
+                             int depth)
+{
+    uint64_t strtab = 0;
+    bool found = false;
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++)
+    {
+        if (dyn[i].d_tag == DT_STRTAB)
+        {
+            found = elf_offset(ph, nph, dyn[i].d_un.d_ptr, &strtab);
+        }
+    }
+    if (!found || strtab >= size)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++)
+    {
+        if (dyn[i].d_tag != DT_NEEDED || dyn[i].d_un.d_val >= size - strtab)
+        {
+            continue;
+        }
+
+        // A name is read whole if it is no longer than a path can be
+        uint64_t off = strtab + dyn[i].d_un.d_val;
+        char name[PATH_MAX];
+        size_t len = (size - off < sizeof(name)) ? size - off : sizeof(name);
+        if (read_at(fd, name, len, off) && memchr(name, '\0', len))
+        {
+            prefetch_library(name, depth);
+        }
+    }
+}
+
+// Function to prefetch the interpreter and libraries named in ELF file FD
+// (of SIZE bytes); the headers are read with pread(), and every offset and
+// size in them is checked against SIZE, so a truncated or corrupt file is
+// just skipped
+static void prefetch_needed(int fd, uint64_t size, int depth)
+{
+    Elf64_Ehdr eh;
+    if (!read_at(fd, &eh, sizeof(eh), 0) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0
+        || eh.e_ident[EI_CLASS] != ELFCLASS64
+        || eh.e_phentsize != sizeof(Elf64_Phdr) || eh.e_phnum == 0
+        || !in_file(eh.e_phoff, (uint64_t) eh.e_phnum * sizeof(Elf64_Phdr), size))
+    {
+        return;
+    }
+
+    Elf64_Phdr *ph = malloc(eh.e_phnum * sizeof(*ph));
+    if (!ph || !read_at(fd, ph, eh.e_phnum * sizeof(*ph), eh.e_phoff))
+    {
+        free(ph);
+        return;
+    }
+
+    Elf64_Dyn *dyn = NULL;
+    size_t ndyn = 0;
+    for (int i = 0; i < eh.e_phnum; i++)
+    {
+        if (!in_file(ph[i].p_offset, ph[i].p_filesz, size))
+        {
+            continue;
+        }
+        if (ph[i].p_type == PT_INTERP && ph[i].p_filesz > 0
+            && ph[i].p_filesz <= PATH_MAX)
+        {
+            char interp[PATH_MAX];
+            if (read_at(fd, interp, ph[i].p_filesz, ph[i].p_offset)
+                && interp[ph[i].p_filesz - 1] == '\0')
+            {
+                prefetch_file(interp, depth);
+            }
+        }
+        else if (ph[i].p_type == PT_DYNAMIC && !dyn
+                 && ph[i].p_filesz >= sizeof(*dyn) && ph[i].p_filesz <= PREFETCH_DYNAMIC)
+        {
+            ndyn = ph[i].p_filesz / sizeof(*dyn);
+            dyn = malloc(ndyn * sizeof(*dyn));
+            if (dyn && !read_at(fd, dyn, ndyn * sizeof(*dyn), ph[i].p_offset))
+            {
+                free(dyn);
+                dyn = NULL;
+            }
+        }
+    }
+
+    if (dyn)
+    {
+        prefetch_dynamic(fd, size, ph, eh.e_phnum, dyn, ndyn, depth);
+    }
+    free(dyn);
+    free(ph);
+}
+
+// Function to prefetch file PATH and, if it is an ELF program or library,
+// what it needs (to a limited depth)
+static void prefetch_file(const char *path, int depth)
+{
+    if (depth > 8 || !see(path))
+    {
+        return;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        readahead(fd, 0, st.st_size);
+        prefetch_needed(fd, st.st_size, depth + 1);
+    }
+    close(fd);
+}
+
+// Function to find command NAME in $PATH and prefetch it
+static void prefetch_program(const char *name)
+{
+    if (strchr(name, '/'))
+    {
+        prefetch_file(name, 0);
+        return;
+    }
+    if (!see(name))
+    {
+        return;
+    }
+
+    char *dirs = strdup(prefetch.path);
+    char *save;
+    for (char *dir = strtok_r(dirs, ":", &save); dir; dir = strtok_r(NULL, ":", &save))
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (access(path, X_OK) == 0)
+        {
+            prefetch_file(path, 0);
+            break;
+        }
+    }
+    free(dirs);
+}
+
+// Function to run the prefetch thread
+static void *prefetch_main(void *arg)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&prefetch.lock);
+        while (prefetch.count == 0)
+        {
+            pthread_cond_wait(&prefetch.work, &prefetch.lock);
+        }
+        char *name = prefetch.queue[prefetch.head];
+        prefetch.head = (prefetch.head + 1) % PREFETCH_QUEUE;
+        prefetch.count--;
+        pthread_mutex_unlock(&prefetch.lock);
+
+        prefetch_program(name);
+        free(name);
+    }
+    return NULL;
+}
+
+// Function to queue NAME (prefetch.lock held); names that do not fit are
+// dropped
+static void queue_name(const char *name)
+{
+    if (prefetch.count < PREFETCH_QUEUE)
+    {
+        int tail = (prefetch.head + prefetch.count) % PREFETCH_QUEUE;
+        prefetch.queue[tail] = strdup(name);
+        prefetch.count++;
+        pthread_cond_signal(&prefetch.work);
+    }
+}
+
+// Function to queue the programs of CMD (prefetch.lock held)
+static void queue_command(const CMD *cmd)
+{
+    if (!cmd)
+    {
+        return;
+    }
+    if (cmd->type == SIMPLE && cmd->argc > 0)
+    {
+        queue_name(cmd->argv[0]);
+    }
+    queue_command(cmd->left);
+    queue_command(cmd->right);
+}
+
+// Function to start the prefetch thread
+void prefetch_start(void)
+{
+    const char *env = getenv("BSH_PREFETCH");
+    if (prefetch.started || (env && strcmp(env, "0") == 0))
+    {
+        return;
+    }
+
+    // The thread must not call getenv() while the shell may be changing
+    // the environment, so it searches the paths as they are now
+    env = getenv("PATH");
+    prefetch.path = strdup(env ? env : "/usr/bin:/bin");
+    env = getenv("LD_LIBRARY_PATH");
+    prefetch.lib_path = strdup(env ? env : "");
+
+    // The thread takes no signals; they belong to the main thread
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, prefetch_main, NULL) == 0)
+    {
+        pthread_detach(thread);
+        prefetch.started = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+// Function to queue the programs in CMD for prefetching
+void prefetch_command(const CMD *cmd)
+{
+    if (!prefetch.started)
+    {
+        return;
+    }
+    pthread_mutex_lock(&prefetch.lock);
+    queue_command(cmd);
+    pthread_mutex_unlock(&prefetch.lock);
+}
@@ -0,0 +1,23 @@
+// prefetch.h
+//
+// Prefetch of the programs that a script is about to run.  The read-ahead
+// thread (see ahead.h) hands each tree it parses to prefetch_command(); a
+// second thread looks the commands up in $PATH and asks the kernel to read
+// the executables, their ELF interpreters and the shared libraries they
+// need (recursively) into the page cache with posix_fadvise(WILLNEED) and
+// readahead(), so that execvp() does not stall on a cold cache.  Each file
+// is prefetched once.  $BSH_PREFETCH=0 turns it off.
+
+#ifndef PREFETCH_INCLUDED
+#define PREFETCH_INCLUDED
+
+// Queue the programs run by the simple commands in CMD for prefetching; the
+// names are copied, so CMD may be freed at once.  Does nothing unless
+// prefetch_start() has been called.
+void prefetch_command(const CMD *cmd);
+
+// Start the prefetch thread unless $BSH_PREFETCH is 0; $PATH and
+// $LD_LIBRARY_PATH are searched as they are when it is called
+void prefetch_start(void);
+
+#endif
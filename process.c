@@ -1,6 +1,18 @@
 // process.c
 #include "process.h"
 #include "parse.h"
+#include "test.h"
+#include "read.h"
+#include "dirstack.h"
+#include "history.h"
+#include "joblog.h"
+#include "every.h"
+#include "onchange.h"
+#include "pipeline.h"
+#include "jobs.h"
+#include "enable.h"
+#include "admit.h"
+#include "events.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -12,28 +24,17 @@
 #include <limits.h>
 #include <stdbool.h>
 
-// Define global variables or structures as needed
-
-// Structure for directory stack (used by pushd and popd)
-typedef struct DirNode {
-    char *path;
-    struct DirNode *next;
-} DirNode;
-
-DirNode *dir_stack = NULL;
-
 // Function Prototypes
 int execute_simple(const CMD *cmd);
 int handle_builtin(const CMD *cmd);
-int update_status(int status);
-void reap_zombies();
 void sigchld_handler(int sig);
-void pushd_stack(const char *path);
-char* popd_stack();
-void print_dir_stack();
+void prepare_fork();
+
+// Status of the last command ($?)
+static int shell_status = 0;
 
 // Initialize signal handler for SIGCHLD to reap zombie processes
-__attribute__((constructor)) void init_signal_handler() {
+void shell_init() {
     struct sigaction sa;
     sa.sa_handler = sigchld_handler;
     sigemptyset(&sa.sa_mask);
@@ -47,7 +48,9 @@ __attribute__((constructor)) void init_signal_handler() {
 // Signal handler for SIGCHLD
 void sigchld_handler(int sig) {
     (void)sig; // Unused parameter
-    reap_zombies();
+    // Only the jobs in the table are reaped here (the shell waits for the
+    // foreground job itself)
+    jobs_reap();
 }
 
 // Function to execute simple commands
@@ -60,6 +63,8 @@ int execute_simple(const CMD *cmd)
         return builtin_status;
     }
 
+    prepare_fork();
+
     pid_t pid = fork();
     if (pid < 0) 
     {
@@ -69,6 +74,7 @@ int execute_simple(const CMD *cmd)
     else if (pid == 0) 
     {
         // Child process
+        job_child(false);
 
         // Handle I/O Redirection
         // Input Redirection
@@ -223,20 +229,8 @@ int execute_simple(const CMD *cmd)
     else 
     {
         // Parent process
-        int status;
-        if (waitpid(pid, &status, 0) == -1) 
-        {
-            perror("waitpid");
-            return errno;
-        }
-        if (WIFEXITED(status)) 
-        {
-            return WEXITSTATUS(status);
-        } 
-        else 
-        {
-            return 128 + WTERMSIG(status);
-        }
+        job_parent(pid, false, cmd);
+        return job_wait(pid);
     }
 }
 
@@ -254,10 +248,13 @@ int process(const CMD *cmd)
     {
         case SIMPLE:
             status = execute_simple(cmd);
+            job_done(cmd);
             break;
 
         case PIPE: 
         {
+            prepare_fork();
+
             int pipe_fd[2];
             if (pipe(pipe_fd) == -1) 
             {
@@ -265,80 +262,114 @@ int process(const CMD *cmd)
                 return errno;
             }
 
-            pid_t left_pid = fork();
-            if (left_pid < 0) 
-            {
-                perror("fork");
-                close(pipe_fd[0]);
-                close(pipe_fd[1]);
-                return errno;
-            }
+            // Builtin stages run as threads in the shell (see pipeline.h);
+            // the other stages are forked before any thread is started
+            bool left_thread = stage_threadable(cmd->left);
+            bool right_thread = stage_threadable(cmd->right);
+            Stage left_stage, right_stage;
+            pid_t left_pid = 0, right_pid = 0;
 
-            if (left_pid == 0) 
+            if (!left_thread) 
             {
-                // Left child process
-                // Redirect stdout to pipe write end
-                if (dup2(pipe_fd[1], STDOUT_FILENO) == -1) 
+                left_pid = fork();
+                if (left_pid < 0) 
                 {
-                    perror("dup2");
-                    exit(errno);
+                    perror("fork");
+                    close(pipe_fd[0]);
+                    close(pipe_fd[1]);
+                    return errno;
                 }
-                close(pipe_fd[0]);
-                close(pipe_fd[1]);
 
-                exit(process(cmd->left));
-            }
+                if (left_pid == 0) 
+                {
+                    // Left child process
+                    job_child(false);
+                    // Redirect stdout to pipe write end
+                    if (dup2(pipe_fd[1], STDOUT_FILENO) == -1) 
+                    {
+                        perror("dup2");
+                        exit(errno);
+                    }
+                    close(pipe_fd[0]);
+                    close(pipe_fd[1]);
 
-            pid_t right_pid = fork();
-            if (right_pid < 0) 
-            {
-                perror("fork");
-                close(pipe_fd[0]);
-                close(pipe_fd[1]);
-                return errno;
+                    exit(process(cmd->left));
+                }
+                job_parent(left_pid, false, cmd->left);
             }
 
-            if (right_pid == 0) 
+            if (!right_thread) 
             {
-                // Right child process
-                // Redirect stdin to pipe read end
-                if (dup2(pipe_fd[0], STDIN_FILENO) == -1) 
+                right_pid = fork();
+                if (right_pid < 0) 
                 {
-                    perror("dup2");
-                    exit(errno);
+                    perror("fork");
+                    close(pipe_fd[0]);
+                    close(pipe_fd[1]);
+                    return errno;
                 }
-                close(pipe_fd[0]);
-                close(pipe_fd[1]);
 
-                exit(process(cmd->right));
+                if (right_pid == 0) 
+                {
+                    // Right child process
+                    job_child(false);
+                    // Redirect stdin to pipe read end
+                    if (dup2(pipe_fd[0], STDIN_FILENO) == -1) 
+                    {
+                        perror("dup2");
+                        exit(errno);
+                    }
+                    close(pipe_fd[0]);
+                    close(pipe_fd[1]);
+
+                    exit(process(cmd->right));
+                }
+                job_parent(right_pid, false, cmd->right);
             }
 
             // Parent process
-            close(pipe_fd[0]);
-            close(pipe_fd[1]);
-
-            // Wait for both child processes
-            int left_status, right_status;
-            if (waitpid(left_pid, &left_status, 0) == -1) 
+            // Each stage thread takes over its end of the pipe
+            int left_status = 0, right_status = 0;
+            if (left_thread) 
             {
-                perror("waitpid");
-                return errno;
+                left_status = stage_start(&left_stage, cmd->left, -1, pipe_fd[1]);
+                left_thread = (left_status == 0);
+            } 
+            else 
+            {
+                close(pipe_fd[1]);
             }
-            if (waitpid(right_pid, &right_status, 0) == -1) 
+            if (right_thread) 
             {
-                perror("waitpid");
-                return errno;
+                right_status = stage_start(&right_stage, cmd->right, pipe_fd[0], -1);
+                right_thread = (right_status == 0);
+            } 
+            else 
+            {
+                close(pipe_fd[0]);
             }
 
-            // Return the status of the rightmost command in the pipeline
-            if (WIFEXITED(right_status)) 
+            // Wait for both stages
+            if (left_thread) 
             {
-                status = WEXITSTATUS(right_status);
+                left_status = stage_wait(&left_stage);
             } 
-            else 
+            else if (left_pid > 0) 
             {
-                status = 128 + WTERMSIG(right_status);
+                left_status = job_wait(left_pid);
             }
+            if (right_thread) 
+            {
+                right_status = stage_wait(&right_stage);
+            } 
+            else if (right_pid > 0) 
+            {
+                right_status = job_wait(right_pid);
+            }
+            job_done(cmd);
+
+            // Return the status of the rightmost command in the pipeline
+            status = right_status;
             break;
         }
 
@@ -381,22 +412,28 @@ int process(const CMD *cmd)
 
         case SEP_BG:
         {
-            pid_t pid = fork();
+            // Execute the left command in the background
+            // The job waits for the host to have room for it (see admit.h)
+            char *text = job_text(cmd->left);
+            admit_prepare();
+            int position = 0;
+            pid_t pid = admit_start(cmd->left, text, &position);
+            free(text);
             if (pid < 0) 
             {
-                perror("fork");
                 return errno;
             } 
-            else if (pid == 0) 
-            {
-                // Child process
-                // Execute the left command
-                exit(process(cmd->left));
-            } 
             else 
             {
                 // Parent process
-                fprintf(stderr, "Backgrounded: %d\n", pid);
+                if (pid == 0) 
+                {
+                    fprintf(stderr, "Queued: %d\n", position);
+                } 
+                else 
+                {
+                    fprintf(stderr, "Backgrounded: %d\n", pid);
+                }
                 // Do not wait for the child
                 status = 0; // As per specification, backgrounded commands return status 0
             }
@@ -411,6 +448,8 @@ int process(const CMD *cmd)
 
         case SUBCMD:
         {
+            prepare_fork();
+
             pid_t pid = fork();
             if (pid < 0) 
             {
@@ -420,6 +459,7 @@ int process(const CMD *cmd)
             else if (pid == 0) 
             {
                 // Child process (subshell)
+                job_child(false);
 
                 // Handle I/O Redirection if any
                 // Input Redirection
@@ -570,20 +610,9 @@ int process(const CMD *cmd)
             else 
             {
                 // Parent process
-                int subcmd_status;
-                if (waitpid(pid, &subcmd_status, 0) == -1) 
-                {
-                    perror("waitpid");
-                    return errno;
-                }
-                if (WIFEXITED(subcmd_status)) 
-                {
-                    status = WEXITSTATUS(subcmd_status);
-                } 
-                else 
-                {
-                    status = 128 + WTERMSIG(subcmd_status);
-                }
+                job_parent(pid, false, cmd);
+                status = job_wait(pid);
+                job_done(cmd);
             }
             break;
         }
@@ -611,162 +640,224 @@ int handle_builtin(const CMD *cmd)
         return -1; // Not a built-in command
     }
 
-    if (strcmp(cmd->argv[0], "cd") == 0) 
+    if (strcmp(cmd->argv[0], "test") == 0 || strcmp(cmd->argv[0], "[") == 0) 
     {
-        // Handle cd
-        if (cmd->argc == 1) 
-        {
-            char *home = getenv("HOME");
-            if (!home) 
-            {
-                fprintf(stderr, "cd: HOME not set\n");
-                return 1;
-            }
-            if (chdir(home) != 0) 
-            {
-                perror("cd");
-                return errno;
-            }
-        } 
-        else if (cmd->argc == 2) 
+        // Handle test and [
+        return builtin_test(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "read") == 0) 
+    {
+        // Handle read
+        int fd = builtin_input(cmd);
+        if (fd < 0) 
         {
-            if (chdir(cmd->argv[1]) != 0) 
-            {
-                perror("cd");
-                return errno;
-            }
-        } 
-        else 
+            return errno;
+        }
+        int status = builtin_read(cmd->argc, cmd->argv, fd);
+        if (fd != STDIN_FILENO) 
         {
-            fprintf(stderr, "cd: too many arguments\n");
-            return 1;
+            close(fd);
         }
-        return 0;
+        return status;
+    }
+    else if (strcmp(cmd->argv[0], "cd") == 0) 
+    {
+        // Handle cd
+        return builtin_cd(cmd->argc, cmd->argv);
     } 
     else if (strcmp(cmd->argv[0], "pushd") == 0) 
     {
         // Handle pushd
-        if (cmd->argc != 2) 
-        {
-            fprintf(stderr, "pushd: wrong number of arguments\n");
-            return 1;
-        }
-        char cwd[PATH_MAX];
-        if (!getcwd(cwd, sizeof(cwd))) 
-        {
-            perror("getcwd");
-            return errno;
-        }
-        if (chdir(cmd->argv[1]) != 0) 
-        {
-            perror("pushd");
-            return errno;
-        }
-        pushd_stack(cwd);
-        print_dir_stack();
-        return 0;
+        return builtin_pushd(cmd->argc, cmd->argv);
     } 
     else if (strcmp(cmd->argv[0], "popd") == 0) 
     {
         // Handle popd
-        if (cmd->argc != 1) 
+        return builtin_popd(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "dirs") == 0) 
+    {
+        // Handle dirs
+        return builtin_dirs(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "history") == 0) 
+    {
+        // Handle history
+        return builtin_history(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "joblog") == 0) 
+    {
+        // Handle joblog
+        return builtin_joblog(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "every") == 0) 
+    {
+        // Handle every
+        return builtin_every(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "on-change") == 0) 
+    {
+        // Handle on-change
+        return builtin_onchange(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "jobs") == 0) 
+    {
+        // Handle jobs
+        return builtin_jobs(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "fg") == 0) 
+    {
+        // Handle fg
+        return builtin_fg(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "bg") == 0) 
+    {
+        // Handle bg
+        return builtin_bg(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "kill") == 0) 
+    {
+        // Handle kill
+        return builtin_kill(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "enable") == 0) 
+    {
+        // Handle enable
+        return builtin_enable(cmd->argc, cmd->argv);
+    }
+    else if (strcmp(cmd->argv[0], "admit") == 0) 
+    {
+        // Handle admit
+        return builtin_admit(cmd->argc, cmd->argv);
+    }
+
+    // Handle builtins loaded by enable (-1 if not one)
+    return loadable_run(cmd);
+}
+
+// Function to open the input redirection of a built-in command; returns the
+// file descriptor to read (STDIN_FILENO if there is none) or -1 on error
+int builtin_input(const CMD *cmd) 
+{
+    if (cmd->fromType == RED_IN) 
+    {
+        int fd = open(cmd->fromFile, O_RDONLY);
+        if (fd < 0) 
         {
-            fprintf(stderr, "popd: wrong number of arguments\n");
-            return 1;
+            perror("open");
         }
-        char *path = popd_stack();
-        if (!path) 
+        return fd;
+    }
+    if (cmd->fromType == RED_IN_HERE) 
+    {
+        char template[] = "/tmp/heredocXXXXXX";
+        int fd = mkstemp(template);
+        if (fd < 0) 
         {
-            fprintf(stderr, "popd: directory stack empty\n");
-            return 1;
+            perror("mkstemp");
+            return -1;
         }
-        if (chdir(path) != 0) 
+        unlink(template);
+        size_t len = strlen(cmd->fromFile);
+        if (write(fd, cmd->fromFile, len) != (ssize_t)len || lseek(fd, 0, SEEK_SET) == (off_t)-1) 
         {
-            perror("popd");
-            free(path);
-            return errno;
+            perror("write");
+            close(fd);
+            return -1;
         }
-        free(path);
-        print_dir_stack();
-        return 0;
+        return fd;
     }
+    return STDIN_FILENO;
+}
 
-    return -1; // Not a built-in command
+// Function to prepare shell state before forking a child that runs commands
+void prepare_fork() 
+{
+    // The child may change the filesystem under any cached stat results
+    stat_cache_invalidate();
+    // and must see input that read -B has buffered but not used
+    read_buffer_release();
 }
 
-// Function to update the $? environment variable
-int update_status(int status) 
+// Function to run command CMD (for fork_background())
+int run_process(const void *cmd) 
 {
-    char status_str[12];
-    snprintf(status_str, sizeof(status_str), "%d", status);
-    if (setenv("?", status_str, 1) != 0) 
-    {
-        perror("setenv");
-        return errno;
-    }
-    return status;
+    return process(cmd);
 }
 
-// Function to reap zombie processes
-void reap_zombies() 
+// Function to fork a background job that exits with the value of RUN(ARG);
+// the job is numbered and reaped like any job started with &
+pid_t fork_background(int (*run)(const void *), const void *arg, const char *text) 
 {
-    int status;
-    pid_t pid;
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) 
+    prepare_fork();
+
+    // Keep the handler from missing a child that exits before it has been
+    // registered
+    sigset_t chld, old_mask;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old_mask);
+
+    // A job that could not be entered in the table would never be reaped
+    int job = job_reserve();
+    if (job == 0) 
     {
-        WARN("Completed: %d (%d)\n", pid, (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)));
+        fprintf(stderr, "Too many jobs\n");
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        errno = EAGAIN;
+        return -1;
     }
-}
+    int log_fd = joblog_pipe(job);
 
-// Function to push a directory onto the stack (used by pushd)
-void pushd_stack(const char *path) 
-{
-    DirNode *new_node = malloc(sizeof(DirNode));
-    if (!new_node) 
+    pid_t pid = fork();
+    if (pid < 0) 
     {
-        perror("malloc");
-        exit(errno);
+        perror("fork");
+        int saved = errno;
+        if (log_fd >= 0) 
+        {
+            close(log_fd);
+        }
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        errno = saved;
+        return -1;
+    } 
+    else if (pid == 0) 
+    {
+        // Child process
+        job_child(true);
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        if (log_fd >= 0) 
+        {
+            // Output goes to the job's log instead of the terminal
+            dup2(log_fd, STDOUT_FILENO);
+            dup2(log_fd, STDERR_FILENO);
+            close(log_fd);
+        }
+        exit(run(arg));
     }
-    new_node->path = strdup(path);
-    if (!new_node->path) 
+
+    // Parent process
+    job_parent(pid, true, NULL);
+    events_spawn(pid, pid, text);
+    job_start(job, pid, pid, text, false);
+    if (log_fd >= 0) 
     {
-        perror("strdup");
-        free(new_node);
-        exit(errno);
+        joblog_started(job, pid, log_fd);
     }
-    new_node->next = dir_stack;
-    dir_stack = new_node;
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return pid;
 }
 
-// Function to pop a directory from the stack (used by popd)
-char* popd_stack() 
+// Function to update $?
+int update_status(int status) 
 {
-    if (!dir_stack) 
-    {
-        return NULL;
-    }
-    DirNode *top = dir_stack;
-    dir_stack = dir_stack->next;
-    char *path = top->path;
-    free(top);
-    return path;
+    shell_status = status;
+    return status;
 }
 
-// Function to print the directory stack (used by pushd and popd)
-void print_dir_stack() 
+// Function to return $?
+int last_status() 
 {
-    char cwd[PATH_MAX];
-    if (!getcwd(cwd, sizeof(cwd))) 
-    {
-        perror("getcwd");
-        return;
-    }
-    printf("%s", cwd);
-    DirNode *current = dir_stack;
-    while (current) 
-    {
-        printf(" %s", current->path);
-        current = current->next;
-    }
-    printf("\n");
+    return shell_status;
 }
@@ -29,5 +29,42 @@
 // that is killed has nonzero status; ignores the possibility of stop/continue.
 #define STATUS(x) (WIFEXITED(x) ? WEXITSTATUS(x) : 128+WTERMSIG(x))
 
+// Stream for the standard output of builtins; a builtin that runs as a
+// pipeline stage in a thread (see pipeline.h) writes to its pipe instead
+extern _Thread_local FILE *builtin_stdout;
+#define BSTDOUT (builtin_stdout ? builtin_stdout : stdout)
+
+// Set in a pipeline stage thread, where a builtin must leave the shell's
+// state alone as it would in a forked stage
+extern _Thread_local bool builtin_isolated;
+
+// Install the SIGCHLD handler that reaps background jobs as they finish;
+// called once by main() (the library in bsh.h reaps them itself)
+void shell_init (void);
+
 // Execute command list CMDLIST and return status of last command executed
 int process (const CMD *cmdList);
+
+// Set $? to STATUS and return STATUS
+int update_status (int status);
+
+// Return $?
+int last_status (void);
+
+// Open the input redirection of builtin CMD; return the descriptor to read
+// (STDIN_FILENO if there is none) or -1 on error
+int builtin_input (const CMD *cmd);
+
+// Fork a background job that exits with the value of RUN(ARG) and return its
+// pid (-1 on error, also when the job table is full); it is numbered, logged
+// and reaped like a job started with &, and jobs lists it as TEXT
+pid_t fork_background (int (*run)(const void *), const void *arg,
+		       const char *text);
+
+// Run command CMD (a const CMD *) and return its status (for
+// fork_background())
+int run_process (const void *cmd);
+
+// Return a copy of the tree of commands rooted at *C (NULL if C is NULL or
+// if out of memory); free it with freeCMD()
+CMD *copyCMD (const CMD *c);
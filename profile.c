@@ -0,0 +1,522 @@
+// profile.c
+//
+// Sampling self-profiler.  A timer on the main thread's CPU clock sends it
+// SIGPROF, whose handler walks the frame pointer chain of the interrupted
+// code and counts the stack in a table allocated up front; addresses are
+// turned into names only when the profile is written.
+#include "process.h"
+#include "profile.h"
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ucontext.h>
+
+// Older C libraries do not name the thread of SIGEV_THREAD_ID
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define PROFILE_DEPTH  64       // Deepest stack recorded
+#define PROFILE_STACKS 4096     // Distinct stacks recorded (a power of 2)
+#define PROFILE_HZ     97       // Default samples per second of CPU time
+#define PROFILE_SCAN   2048     // Words searched for a library's caller
+
+// Structure for one distinct stack
+typedef struct Sample {
+    unsigned long count;        // Times it was sampled (0 if slot unused)
+    uint64_t hash;              // Hash of the fields below
+    int depth;                  // Number of frames
+    uintptr_t pc[PROFILE_DEPTH];    // Frame addresses, innermost first
+} Sample;
+
+// Structure for one function in the executable's symbol table
+typedef struct Symbol {
+    uintptr_t addr;             // Start address
+    size_t size;                // Length in bytes
+    const char *name;           // Name (in the mapped executable)
+} Symbol;
+
+static Sample *samples;
+static int profile_fd = -1;
+static pid_t profile_pid;               // Process that writes the profile
+static uintptr_t stack_top;             // Upper end of the main stack
+static timer_t profile_timer;
+static unsigned long profile_lost = 0;
+
+// Structure for one line of the profile
+typedef struct Folded {
+    char *stack;                // Names of its frames, outermost first
+    unsigned long count;        // Times it was sampled
+} Folded;
+
+static Symbol *symbols;
+static size_t nSymbols;
+
+// Bounds of the executable's code (defined by the linker)
+extern char __executable_start[], etext[];
+
+// Function to check whether PC is in the executable's code
+static bool in_text(uintptr_t pc)
+{
+    return pc >= (uintptr_t) __executable_start && pc < (uintptr_t) etext;
+}
+
+// Function to count the DEPTH-frame stack PC; called from the signal handler
+static void profile_record(const uintptr_t *pc, int depth)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < depth; i++)
+    {
+        hash = (hash ^ pc[i]) * 1099511628211ULL;
+    }
+
+    for (int i = 0; i < PROFILE_STACKS; i++)
+    {
+        Sample *s = &samples[(hash + i) & (PROFILE_STACKS - 1)];
+        if (s->count == 0)
+        {
+            s->hash = hash;
+            s->depth = depth;
+            memcpy(s->pc, pc, depth * sizeof(*pc));
+            s->count = 1;
+            return;
+        }
+        if (s->hash == hash && s->depth == depth
+            && memcmp(s->pc, pc, depth * sizeof(*pc)) == 0)
+        {
+            s->count++;
+            return;
+        }
+    }
+    profile_lost++;
+}
+
+// Function to check whether FP may be a frame above stack pointer SP:  a
+// word on the main stack holding the caller's frame pointer, followed by a
+// return address
+static bool is_frame(uintptr_t fp, uintptr_t sp)
+{
+    return fp >= sp && fp % sizeof(uintptr_t) == 0
+        && fp + 2 * sizeof(uintptr_t) <= stack_top
+        && ((const uintptr_t *) fp)[1] != 0;
+}
+
+// Function to check whether the word at FP, found by searching the stack
+// above SP, looks like a frame of the executable:  one whose caller's frame
+// pointer is 0 or higher up on the stack and whose return address is in the
+// executable
+static bool looks_like_frame(uintptr_t fp, uintptr_t sp)
+{
+    const uintptr_t *frame = (const uintptr_t *) fp;
+    return is_frame(fp, sp) && in_text(frame[1])
+        && (frame[0] == 0 || (frame[0] > fp && frame[0] < stack_top));
+}
+
+// Function to check whether RET is the return address of a call from the
+// executable into a shared library, i.e., through the PLT or the GOT; a
+// word on the stack that merely points into the executable may be left
+// over from an earlier call
+static bool calls_library(uintptr_t ret)
+{
+    if (!in_text(ret) || ret - 6 < (uintptr_t) __executable_start)
+    {
+        return false;
+    }
+#if defined(__x86_64__)
+    const unsigned char *code = (const unsigned char *) ret;
+    if (code[-6] == 0xff && code[-5] == 0x15)
+    {
+        return true;                    // call *GOT(%rip)
+    }
+    if (code[-5] != 0xe8)
+    {
+        return false;
+    }
+    int32_t rel;
+    memcpy(&rel, code - 4, sizeof(rel));
+    uintptr_t target = ret + rel;       // call PLT entry
+    if (!in_text(target) || target + 8 > (uintptr_t) etext)
+    {
+        return false;
+    }
+    code = (const unsigned char *) target;
+    if (code[0] == 0xf3 && code[1] == 0x0f && code[2] == 0x1e
+        && code[3] == 0xfa)
+    {
+        code += 4;                      // endbr64
+    }
+    if (code[0] == 0xf2)
+    {
+        code++;                         // bnd
+    }
+    return code[0] == 0xff && code[1] == 0x25;  // jmp *GOT(%rip)
+#else
+    return true;
+#endif
+}
+
+// Function to handle SIGPROF by sampling the interrupted stack
+static void profile_sample(int sig, siginfo_t *info, void *context)
+{
+    ucontext_t *uc = context;
+    uintptr_t pc[PROFILE_DEPTH];
+    uintptr_t fp, sp;
+    int depth = 0;
+    int saved = errno;
+    (void) sig, (void) info;
+
+#if defined(__x86_64__)
+    pc[depth++] = uc->uc_mcontext.gregs[REG_RIP];
+    fp = uc->uc_mcontext.gregs[REG_RBP];
+    sp = uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    pc[depth++] = uc->uc_mcontext.pc;
+    fp = uc->uc_mcontext.regs[29];
+    sp = uc->uc_mcontext.sp;
+#else
+    (void) uc;
+    fp = sp = 0;            // No unwinding here:  nothing is recorded
+#endif
+
+    // A function interrupted before its prologue or after its epilogue
+    // has its return address on top of the stack and the frame pointer of
+    // whatever ran before it
+    if (sp != 0 && in_text(pc[0]) && !is_frame(fp, sp)
+        && sp + sizeof(uintptr_t) <= stack_top)
+    {
+        pc[depth++] = *(const uintptr_t *) sp;
+        sp += sizeof(uintptr_t);
+    }
+
+    // Code built without frame pointers, such as the C library, may leave
+    // the frame pointer at some caller's frame or use it for data.  The
+    // executable's call into it is then found by searching up the stack
+    // for its return address, and the frame of the function that made it
+    // is the one in the register if that lies above, or else the first
+    // word above that looks like a frame returning into the executable.
+    if (sp != 0 && !in_text(pc[depth-1]))
+    {
+        const uintptr_t *p = (const uintptr_t *) sp;
+        const uintptr_t *end = p + PROFILE_SCAN;
+        while (p < end && (uintptr_t) (p + 1) <= stack_top
+               && !calls_library(*p))
+        {
+            p++;
+        }
+        if (p < end && (uintptr_t) (p + 1) <= stack_top)
+        {
+            pc[depth++] = *p;
+            sp = (uintptr_t) (p + 1);
+            for (p++; !is_frame(fp, sp) && p < end; p++)
+            {
+                if (looks_like_frame((uintptr_t) p, sp))
+                {
+                    fp = (uintptr_t) p;
+                }
+            }
+        }
+        if (!is_frame(fp, sp))
+        {
+            fp = 0;
+        }
+    }
+
+    // Each frame holds the caller's frame pointer and the return address.
+    // A frame pointer must lie above the last one and on the main stack,
+    // whose bounds are known, so a register that is not one ends the walk
+    // instead of faulting.
+    while (fp != 0 && depth < PROFILE_DEPTH && is_frame(fp, sp))
+    {
+        const uintptr_t *frame = (const uintptr_t *) fp;
+        pc[depth++] = frame[1];
+        sp = fp + 1;
+        fp = frame[0];
+    }
+
+    if (depth > 0)
+    {
+        profile_record(pc, depth);
+    }
+    errno = saved;
+}
+
+// Function to compare symbols by address for qsort()
+static int symbol_cmp(const void *a, const void *b)
+{
+    const Symbol *x = a, *y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+// Function to load the functions in the executable's symbol table, which
+// unlike the dynamic one dladdr() reads also has the static functions
+static void symbols_load(void)
+{
+    int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0
+        || (size_t) st.st_size < sizeof(Elf64_Ehdr))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+    const char *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+    {
+        return;
+    }
+
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *) image;
+    size_t size = st.st_size;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0
+        || eh->e_ident[EI_CLASS] != ELFCLASS64
+        || eh->e_shoff + (size_t) eh->e_shnum * sizeof(Elf64_Shdr) > size)
+    {
+        return;
+    }
+
+    // A position-independent executable is relocated by its load address
+    uintptr_t base = 0;
+    Dl_info info;
+    if (eh->e_type == ET_DYN && dladdr(&samples, &info))
+    {
+        base = (uintptr_t) info.dli_fbase;
+    }
+
+    const Elf64_Shdr *sh = (const Elf64_Shdr *) (image + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++)
+    {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+        {
+            continue;
+        }
+        const Elf64_Shdr *str = &sh[sh[i].sh_link];
+        if (sh[i].sh_offset + sh[i].sh_size > size
+            || str->sh_offset + str->sh_size > size)
+        {
+            continue;
+        }
+
+        const Elf64_Sym *sym = (const Elf64_Sym *) (image + sh[i].sh_offset);
+        size_t n = sh[i].sh_size / sizeof(Elf64_Sym);
+        REALLOC(symbols, nSymbols + n);
+        if (!symbols)
+        {
+            nSymbols = 0;
+            return;
+        }
+        for (size_t k = 0; k < n; k++)
+        {
+            if (ELF64_ST_TYPE(sym[k].st_info) == STT_FUNC && sym[k].st_value
+                && sym[k].st_size && sym[k].st_name < str->sh_size)
+            {
+                symbols[nSymbols++] = (Symbol) {
+                    base + sym[k].st_value, sym[k].st_size,
+                    image + str->sh_offset + sym[k].st_name
+                };
+            }
+        }
+    }
+    qsort(symbols, nSymbols, sizeof(*symbols), symbol_cmp);
+}
+
+// Function to write the name of the function containing address PC to F
+static void frame_name(FILE *f, uintptr_t pc)
+{
+    size_t lo = 0, hi = nSymbols;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (symbols[mid].addr <= pc)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo > 0 && pc < symbols[lo-1].addr + symbols[lo-1].size)
+    {
+        fputs(symbols[lo-1].name, f);
+        return;
+    }
+
+    Dl_info info;
+    if (!dladdr((void *) pc, &info))
+    {
+        fprintf(f, "0x%lx", (unsigned long) pc);
+    }
+    else if (info.dli_sname)
+    {
+        fputs(info.dli_sname, f);
+    }
+    else if (info.dli_fname)
+    {
+        const char *slash = strrchr(info.dli_fname, '/');
+        fprintf(f, "[%s]", slash ? slash + 1 : info.dli_fname);
+    }
+    else
+    {
+        fprintf(f, "0x%lx", (unsigned long) pc);
+    }
+}
+
+// Function to compare profile lines by stack for qsort()
+static int folded_cmp(const void *a, const void *b)
+{
+    return strcmp(((const Folded *) a)->stack, ((const Folded *) b)->stack);
+}
+
+// Function to stop sampling and write the folded stacks
+static void profile_write(void)
+{
+    if (getpid() != profile_pid)
+    {
+        return;                 // A forked subshell exiting
+    }
+
+    timer_delete(profile_timer);
+    signal(SIGPROF, SIG_IGN);
+
+    FILE *f = fdopen(profile_fd, "w");
+    if (!f)
+    {
+        perror("BSH_PROFILE");
+        return;
+    }
+    symbols_load();
+
+    // Different addresses in the same functions give the same line, so
+    // lines are sorted and merged
+    Folded *lines = calloc(PROFILE_STACKS, sizeof(*lines));
+    int nLines = 0;
+    for (int i = 0; lines && i < PROFILE_STACKS; i++)
+    {
+        Sample *s = &samples[i];
+        size_t len;
+        FILE *m;
+        if (s->count == 0 || !(m = open_memstream(&lines[nLines].stack, &len)))
+        {
+            continue;
+        }
+        // Outermost first; a return address is looked up one byte back,
+        // since the call may be the last instruction of its function
+        for (int k = s->depth - 1; k >= 0; k--)
+        {
+            frame_name(m, k > 0 ? s->pc[k] - 1 : s->pc[k]);
+            if (k > 0)
+            {
+                putc(';', m);
+            }
+        }
+        fclose(m);
+        lines[nLines++].count = s->count;
+    }
+
+    qsort(lines, nLines, sizeof(*lines), folded_cmp);
+    for (int i = 0; i < nLines; i++)
+    {
+        unsigned long count = lines[i].count;
+        while (i + 1 < nLines && strcmp(lines[i].stack, lines[i+1].stack) == 0)
+        {
+            free(lines[i++].stack);
+            count += lines[i].count;
+        }
+        fprintf(f, "%s %lu\n", lines[i].stack, count);
+        free(lines[i].stack);
+    }
+    free(lines);
+    if (profile_lost)
+    {
+        fprintf(f, "[lost] %lu\n", (unsigned long) profile_lost);
+    }
+    if (fclose(f) == EOF)
+    {
+        perror("BSH_PROFILE");
+    }
+}
+
+// Function to start profiling
+void profile_init(void)
+{
+    const char *path = getenv("BSH_PROFILE");
+    if (!path || !*path)
+    {
+        return;
+    }
+
+    long hz = PROFILE_HZ;
+    const char *s = getenv("BSH_PROFILE_HZ");
+    if (s && *s)
+    {
+        char *end;
+        hz = strtol(s, &end, 10);
+        if (*end != '\0' || hz < 1 || hz > 10000)
+        {
+            WARN("BSH_PROFILE_HZ: %s: not a rate from 1 to 10000\n", s);
+            return;
+        }
+    }
+
+    // The file is opened now so that a bad path is reported at once and a
+    // later cd does not move it
+    profile_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (profile_fd < 0)
+    {
+        WARN("BSH_PROFILE: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    samples = calloc(PROFILE_STACKS, sizeof(*samples));
+
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+    if (!samples || pthread_getattr_np(pthread_self(), &attr) != 0)
+    {
+        WARN("BSH_PROFILE: %s\n", "cannot start profiler");
+        close(profile_fd);
+        return;
+    }
+    pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+    stack_top = (uintptr_t) addr + size;
+
+    // The timer counts the CPU time of the main thread alone and signals
+    // only it, so the time of pipeline and helper threads, which block
+    // signals and run on stacks of their own, is not charged to it
+    clockid_t clock;
+    struct sigevent ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.sigev_notify = SIGEV_THREAD_ID;
+    ev.sigev_signo = SIGPROF;
+    ev.sigev_notify_thread_id = gettid();
+    if (pthread_getcpuclockid(pthread_self(), &clock) != 0
+        || timer_create(clock, &ev, &profile_timer) < 0)
+    {
+        WARN("BSH_PROFILE: %s\n", "cannot start profiler");
+        close(profile_fd);
+        return;
+    }
+    profile_pid = getpid();
+    atexit(profile_write);
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = profile_sample;
+    act.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGPROF, &act, NULL);
+
+    struct timespec every = { 1 / hz, (1000000000 / hz) % 1000000000 };
+    struct itimerspec tick = { every, every };
+    timer_settime(profile_timer, 0, &tick, NULL);
+}
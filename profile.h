@@ -0,0 +1,27 @@
+// profile.h
+//
+// Sampling profiler for the shell itself.  When $BSH_PROFILE names a file,
+// the shell samples its own stack $BSH_PROFILE_HZ times (default 97) per
+// second of CPU time it uses and, when it exits, writes one line per
+// distinct stack to the file in the folded format read by flamegraph.pl:
+//
+//   main;process;handle_builtin;builtin_test;cached_stat 12
+//
+// Only the main thread is sampled, and only its own CPU time counts:
+// pipeline and other helper threads block signals and run on stacks of
+// their own, so their work appears in the profile only as the main thread
+// waiting for them.  Stacks are unwound through frame pointers; where the
+// C library, built without them, is running, the stack is searched for its
+// caller.  Functions in shared libraries without a symbol of their own
+// show up as the library, e.g., [libc.so.6], and samples that do not fit in
+// the table are counted under [lost].  A sample costs a few hundred
+// instructions in the signal handler and no allocation, so the default rate
+// costs well under 0.1% of the shell's CPU time.
+
+#ifndef PROFILE_INCLUDED
+#define PROFILE_INCLUDED
+
+// Start profiling if $BSH_PROFILE is set; the profile is written at exit()
+void profile_init(void);
+
+#endif
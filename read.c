@@ -0,0 +1,401 @@
+// read.c
+//
+// The read builtin with block-buffered input.
+#include "process.h"
+#include "read.h"
+#include <sys/stat.h>
+
+// Size of the blocks read from seekable input
+#define READ_BLOCK 4096
+
+// Size of the buffer kept between calls by read -B
+#define READ_KEEP_SIZE 65536
+
+// How the input is read
+enum {
+    RS_BYTE,            // One byte at a time (pipes and terminals)
+    RS_BLOCK,           // In blocks, giving back the excess with lseek()
+    RS_KEEP             // In blocks, keeping the excess in read_keep
+};
+
+// Structure for the source of input for one call of read
+typedef struct ReadSrc {
+    int fd;             // File descriptor read
+    int mode;           // RS_BYTE, RS_BLOCK, or RS_KEEP
+    char *buf;          // Buffered input
+    size_t pos;         // Index of next unread byte in buf
+    size_t len;         // Number of bytes in buf
+} ReadSrc;
+
+// Input kept between calls by read -B; each thread has its own, so that
+// pipeline stage threads (see pipeline.h) never share it
+static _Thread_local struct {
+    int fd;             // File descriptor buffered (-1 if none)
+    bool seekable;      // Whether the excess can be given back
+    char *buf;
+    size_t pos, len;
+} read_keep = { -1, false, NULL, 0, 0 };
+
+// Identity of the stdin from which the shell reads its commands
+static struct stat shell_input;
+
+__attribute__((constructor)) static void init_read(void)
+{
+    if (fstat(STDIN_FILENO, &shell_input) != 0)
+    {
+        shell_input.st_ino = 0;
+    }
+}
+
+// Function to check whether FD is the input from which the shell reads its
+// own commands
+static bool is_shell_input(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && st.st_dev == shell_input.st_dev
+        && st.st_ino == shell_input.st_ino;
+}
+
+// Function to give back input kept by read -B
+void read_buffer_release(void)
+{
+    if (read_keep.fd < 0 || !read_keep.seekable)
+    {
+        return;
+    }
+    off_t excess = read_keep.len - read_keep.pos;
+    if (excess > 0 && lseek(read_keep.fd, -excess, SEEK_CUR) == (off_t)-1)
+    {
+        perror("read: lseek");
+    }
+    read_keep.fd = -1;
+    read_keep.pos = read_keep.len = 0;
+}
+
+// Function to check whether read -B has kept input that is not yet used
+bool read_buffer_pending(void)
+{
+    return read_keep.fd >= 0 && read_keep.pos < read_keep.len;
+}
+
+// Function to read the next byte of SRC into *C; returns 1 on success, 0 on
+// end of file, and -1 on error
+static int src_getc(ReadSrc *src, char *c)
+{
+    if (src->pos < src->len)
+    {
+        *c = src->buf[src->pos++];
+        return 1;
+    }
+
+    if (src->mode == RS_BYTE)
+    {
+        ssize_t n;
+        while ((n = read(src->fd, c, 1)) < 0 && errno == EINTR)
+            ;
+        return (int) n;
+    }
+
+    size_t size = (src->mode == RS_KEEP) ? READ_KEEP_SIZE : READ_BLOCK;
+    ssize_t n;
+    while ((n = read(src->fd, src->buf, size)) < 0 && errno == EINTR)
+        ;
+    if (n <= 0)
+    {
+        src->pos = src->len = 0;
+        return (int) n;
+    }
+    src->len = n;
+    src->pos = 1;
+    *c = src->buf[0];
+    return 1;
+}
+
+// Function to dispose of unread input in SRC once the record has been read
+static void src_finish(ReadSrc *src)
+{
+    if (src->mode == RS_KEEP)
+    {
+        read_keep.buf = src->buf;
+        read_keep.pos = src->pos;
+        read_keep.len = src->len;
+    }
+    else if (src->mode == RS_BLOCK && src->len > src->pos)
+    {
+        off_t excess = src->len - src->pos;
+        if (lseek(src->fd, -excess, SEEK_CUR) == (off_t)-1)
+        {
+            perror("read: lseek");
+        }
+    }
+}
+
+// Function to set up SRC for reading from FD (KEEP if -B was given)
+static void src_open(ReadSrc *src, int fd, bool keep, char *block)
+{
+    bool seekable = lseek(fd, 0, SEEK_CUR) != (off_t)-1;
+
+    src->fd = fd;
+    src->pos = src->len = 0;
+    src->buf = block;
+    src->mode = seekable ? RS_BLOCK : RS_BYTE;
+
+    // A stage thread runs a single read, so nothing it kept would be read
+    // again; reading as without -B consumes no more than the record
+    if (builtin_isolated)
+    {
+        return;
+    }
+
+    // Input kept by an earlier read -B comes first; once given back to a
+    // seekable fd, it is simply read again
+    if (read_keep.fd >= 0 && read_keep.fd != fd)
+    {
+        read_buffer_release();
+    }
+    if (read_keep.fd == fd && read_keep.seekable && !keep)
+    {
+        read_buffer_release();
+    }
+    if (read_keep.fd == fd)
+    {
+        keep = true;
+    }
+
+    // Only stdin outlives the call, and input that cannot be given back may
+    // only be kept if the shell does not read its own commands from it
+    if (keep && fd == STDIN_FILENO && (seekable || !is_shell_input(fd)))
+    {
+        if (!read_keep.buf)
+        {
+            read_keep.buf = malloc(READ_KEEP_SIZE);
+            if (!read_keep.buf)
+            {
+                perror("malloc");
+                exit(errno);
+            }
+        }
+        if (read_keep.fd != fd)
+        {
+            read_keep.pos = read_keep.len = 0;
+        }
+        read_keep.fd = fd;
+        read_keep.seekable = seekable;
+        src->mode = RS_KEEP;
+        src->buf = read_keep.buf;
+        src->pos = read_keep.pos;
+        src->len = read_keep.len;
+    }
+}
+
+// Function to check whether C is in IFS
+static bool is_ifs(const char *ifs, char c)
+{
+    return c != '\0' && strchr(ifs, c) != NULL;
+}
+
+// Function to check whether C is whitespace in IFS
+static bool is_ifs_space(const char *ifs, char c)
+{
+    return (c == ' ' || c == '\t' || c == '\n') && is_ifs(ifs, c);
+}
+
+// Function to assign the LEN characters of TEXT (where QUOTED[i] marks
+// characters escaped by a backslash) to the NVAR variables in VARS
+static int assign_fields(char **vars, int nvar, char *text, bool *quoted,
+                         size_t len)
+{
+    const char *ifs = getenv("IFS");
+    if (!ifs)
+    {
+        ifs = " \t\n";
+    }
+
+    size_t i = 0;
+    while (i < len && !quoted[i] && is_ifs_space(ifs, text[i]))
+    {
+        i++;
+    }
+
+    for (int v = 0; v < nvar; v++)
+    {
+        size_t start = i, end;
+
+        if (v == nvar - 1)
+        {
+            // The last variable gets the rest, less trailing IFS whitespace
+            end = len;
+            while (end > start && !quoted[end - 1]
+                   && is_ifs_space(ifs, text[end - 1]))
+            {
+                end--;
+            }
+            i = len;
+        }
+        else
+        {
+            while (i < len && (quoted[i] || !is_ifs(ifs, text[i])))
+            {
+                i++;
+            }
+            end = i;
+
+            // Skip one delimiter and the IFS whitespace around it
+            while (i < len && !quoted[i] && is_ifs_space(ifs, text[i]))
+            {
+                i++;
+            }
+            if (i < len && !quoted[i] && is_ifs(ifs, text[i]))
+            {
+                i++;
+                while (i < len && !quoted[i] && is_ifs_space(ifs, text[i]))
+                {
+                    i++;
+                }
+            }
+        }
+
+        if (builtin_isolated)
+        {
+            continue;       // As in a subshell, the values are lost
+        }
+
+        char save = text[end];
+        text[end] = '\0';
+        int rc = setenv(vars[v], text + start, 1);
+        text[end] = save;
+        if (rc != 0)
+        {
+            perror("read: setenv");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Function to handle the read builtin
+int builtin_read(int argc, char **argv, int fd)
+{
+    bool raw = false, keep = false;
+    int delim = '\n';
+    long nmax = -1;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        for (char *opt = argv[i] + 1; *opt; opt++)
+        {
+            if (*opt == 'r')
+            {
+                raw = true;
+            }
+            else if (*opt == 'B')
+            {
+                keep = true;
+            }
+            else if (*opt == 'd' || *opt == 'n')
+            {
+                char *value = opt[1] ? opt + 1 : (i + 1 < argc ? argv[++i] : NULL);
+                if (!value)
+                {
+                    WARN("read: -%c: option requires an argument\n", *opt);
+                    return 2;
+                }
+                if (*opt == 'd')
+                {
+                    delim = (unsigned char) value[0];
+                }
+                else
+                {
+                    char *end;
+                    nmax = strtol(value, &end, 10);
+                    if (*end != '\0' || nmax < 0)
+                    {
+                        WARN("read: %s: invalid number\n", value);
+                        return 2;
+                    }
+                }
+                break;
+            }
+            else
+            {
+                WARN("read: -%c: invalid option\n", *opt);
+                WARN("%s\n", "usage: read [-r] [-B] [-d delim] [-n nchars] [name ...]");
+                return 2;
+            }
+        }
+    }
+
+    char *reply[] = { "REPLY" };
+    char **vars = (i < argc) ? argv + i : reply;
+    int nvar = (i < argc) ? argc - i : 1;
+    for (int v = 0; v < nvar; v++)
+    {
+        if (vars[v][0] == '\0' || strspn(vars[v], VARCHR) != strlen(vars[v])
+            || (vars[v][0] >= '0' && vars[v][0] <= '9'))
+        {
+            WARN("read: `%s': not a valid identifier\n", vars[v]);
+            return 2;
+        }
+    }
+
+    char block[READ_BLOCK];
+    ReadSrc src;
+    src_open(&src, fd, keep, block);
+
+    size_t len = 0, cap = 128;
+    char *text = malloc(cap);
+    bool *quoted = malloc(cap * sizeof(*quoted));
+    bool eof = false;
+    char c;
+
+    while (nmax < 0 || (long) len < nmax)
+    {
+        int rc = src_getc(&src, &c);
+        bool escaped = false;
+        if (rc > 0 && !raw && c == '\\')
+        {
+            rc = src_getc(&src, &c);
+            if (rc > 0 && c == '\n')
+            {
+                continue;       // Backslash-newline continues the record
+            }
+            escaped = true;
+        }
+        if (rc <= 0)
+        {
+            if (rc < 0)
+            {
+                perror("read");
+            }
+            eof = true;
+            break;
+        }
+        if (!escaped && (unsigned char) c == delim)
+        {
+            break;
+        }
+
+        if (len + 1 >= cap)
+        {
+            cap *= 2;
+            REALLOC(text, cap);
+            REALLOC(quoted, cap);
+        }
+        text[len] = c;
+        quoted[len++] = escaped;
+    }
+    text[len] = '\0';
+
+    src_finish(&src);
+
+    int status = assign_fields(vars, nvar, text, quoted, len);
+    free(text);
+    free(quoted);
+    return (status != 0 || eof) ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+// read.h
+//
+// The read builtin:  read [-r] [-B] [-d DELIM] [-n N] [NAME ...]
+
+#ifndef READ_INCLUDED
+#define READ_INCLUDED
+
+// Read one record from file descriptor FD, split it into fields using $IFS,
+// and assign them to the variables named in ARGV (REPLY if none).  Return 0
+// on success, 1 on end of file, and 2 on a usage error.
+//
+// Seekable input is read a block at a time and the unused part is given back
+// with lseek(); other input is read one byte at a time so that nothing past
+// the delimiter is consumed.  With -B, input read past the delimiter is kept
+// in the shell's own buffer for later reads instead, except in a pipeline
+// stage thread, which reads only the one record.
+int builtin_read(int argc, char **argv, int fd);
+
+// Give back buffered input (kept by read -B) to its file descriptor so that
+// a command run by the shell sees it.  Input from a pipe cannot be given back
+// and stays in the buffer for later reads.
+void read_buffer_release(void);
+
+// Return true if the calling thread holds input kept by read -B that has not
+// been used.  A read in a pipeline stage thread does not see it, so such a
+// stage has to be forked instead.
+bool read_buffer_pending(void);
+
+#endif
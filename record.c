@@ -0,0 +1,208 @@
+// record.c
+//
+// Session recorder and timing-faithful replayer.
+#include "process.h"
+#include "record.h"
+#include "eval.h"
+#include <time.h>
+
+// Latencies closer than this to the recorded ones never diverge
+#define REPLAY_MIN_MS 5.0
+
+static FILE *record_fp = NULL;          // Recording (NULL if not recording)
+static struct timespec record_start;    // When recording started
+static struct timespec record_arrived;  // When the current line arrived
+
+// Function to return the milliseconds from A to B
+static double diff_ms(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+// Function to start recording
+int record_open(const char *file)
+{
+    record_fp = fopen(file, "w");
+    if (!record_fp)
+    {
+        WARN("record: %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    fprintf(record_fp, "# bsh recording v1\n");
+    fflush(record_fp);
+    clock_gettime(CLOCK_MONOTONIC, &record_start);
+    return 0;
+}
+
+// Function to note the arrival of a line
+void record_arrival(void)
+{
+    if (record_fp)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &record_arrived);
+    }
+}
+
+// Function to record a finished line
+void record_line(const char *line, int status)
+{
+    if (!record_fp)
+    {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(record_fp, "%.3f\t%.3f\t%d\t",
+            diff_ms(&record_start, &record_arrived),
+            diff_ms(&record_arrived, &now), status);
+
+    size_t len = strlen(line);
+    if (len > 0 && line[len - 1] == '\n')
+    {
+        len--;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        switch (line[i])
+        {
+            case '\\': fputs("\\\\", record_fp); break;
+            case '\t': fputs("\\t", record_fp);  break;
+            case '\n': fputs("\\n", record_fp);  break;
+            default:   fputc(line[i], record_fp); break;
+        }
+    }
+    fputc('\n', record_fp);
+
+    // Flush so that the recording survives the shell being killed
+    fflush(record_fp);
+}
+
+// Function to undo the escaping of a recorded command line in place
+static void unescape(char *s)
+{
+    char *out = s;
+    for ( ; *s; s++)
+    {
+        if (*s == '\\' && s[1])
+        {
+            s++;
+            *out++ = (*s == 't') ? '\t' : (*s == 'n') ? '\n' : *s;
+        }
+        else
+        {
+            *out++ = *s;
+        }
+    }
+    *out = '\0';
+}
+
+// Function to replay a recording
+int replay(int argc, char **argv)
+{
+    bool fast = (argc == 2 && strcmp(argv[1], "--fast") == 0);
+    if (argc < 1 || argc > 2 || (argc == 2 && !fast))
+    {
+        WARN("%s\n", "usage: --replay FILE [--fast]");
+        return 2;
+    }
+
+    FILE *fp = fopen(argv[0], "r");
+    if (!fp)
+    {
+        WARN("replay: %s: %s\n", argv[0], strerror(errno));
+        return 2;
+    }
+
+    double tolerance = 50;
+    const char *env = getenv("BSH_REPLAY_TOLERANCE");
+    if (env && *env)
+    {
+        tolerance = atof(env);
+    }
+
+    char *rec = NULL;
+    size_t nrec = 0;
+    long nline = 0, nstatus = 0, nlatency = 0;
+    double recorded_ms = 0, replayed_ms = 0, lag_ms = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (getline(&rec, &nrec, fp) > 0)
+    {
+        double arrival, duration;
+        int status, used = 0;
+        rec[strcspn(rec, "\n")] = '\0';
+        if (rec[0] == '#' || rec[0] == '\0')
+        {
+            continue;
+        }
+        if (sscanf(rec, "%lf\t%lf\t%d\t%n", &arrival, &duration, &status, &used) != 3
+            || used == 0)
+        {
+            WARN("replay: %s: malformed entry: %s\n", argv[0], rec);
+            continue;
+        }
+        char *line = rec + used;
+        unescape(line);
+        nline++;
+
+        struct timespec due = start;
+        if (!fast)
+        {
+            // Wait for the line's original arrival time; if earlier lines
+            // ran long, start it at once and account for the lag
+            due.tv_sec += (time_t) (arrival / 1e3);
+            due.tv_nsec += (long) ((arrival - (time_t) (arrival / 1e3) * 1e3) * 1e6);
+            if (due.tv_nsec >= 1000000000L)
+            {
+                due.tv_sec++;
+                due.tv_nsec -= 1000000000L;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+                ;
+        }
+
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        if (!fast && diff_ms(&due, &begin) > 0)
+        {
+            lag_ms += diff_ms(&due, &begin);
+        }
+        int got = eval_line(line);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double took = diff_ms(&begin, &end);
+
+        recorded_ms += duration;
+        replayed_ms += took;
+
+        if (got != status)
+        {
+            nstatus++;
+            WARN("replay: line %ld: status %d (recorded %d): %s\n",
+                 nline, got, status, line);
+        }
+        double delta = took - duration;
+        double gap = (delta < 0) ? -delta : delta;
+        if (gap > REPLAY_MIN_MS && gap > duration * tolerance / 100)
+        {
+            nlatency++;
+            WARN("replay: line %ld: %.3f ms (recorded %.3f ms, %+.0f%%): %s\n",
+                 nline, took, duration,
+                 duration > 0 ? 100 * delta / duration : 100.0, line);
+        }
+    }
+
+    free(rec);
+    fclose(fp);
+
+    fprintf(stderr, "replay: %ld lines, %ld status and %ld latency divergences;"
+            " recorded %.3f ms, replayed %.3f ms", nline, nstatus, nlatency,
+            recorded_ms, replayed_ms);
+    if (!fast)
+    {
+        fprintf(stderr, ", lag %.3f ms", lag_ms);
+    }
+    fprintf(stderr, "\n");
+    return nstatus ? 1 : 0;
+}
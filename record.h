@@ -0,0 +1,35 @@
+// record.h
+//
+// Session recording and replay.
+//
+//   Bash --record FILE      Run interactively, logging each line executed
+//                           with its arrival time, wall duration and status
+//   Bash --replay FILE [--fast]
+//                           Execute a recording at its original pacing (or
+//                           as fast as possible) and report lines whose
+//                           status or latency diverge from the recording
+//
+// A recording is a text file with one line per command:  arrival time and
+// duration in milliseconds, status, and the command line (with backslash,
+// tab and newline escaped), separated by tabs.  A latency diverges if it
+// differs from the recorded one by more than $BSH_REPLAY_TOLERANCE percent
+// (default 50) and by more than 5 ms.  Here documents are not recorded.
+
+#ifndef RECORD_INCLUDED
+#define RECORD_INCLUDED
+
+// Start recording to FILE; returns 0, or -1 after a diagnostic
+int record_open(const char *file);
+
+// Note that a line has just arrived (no-op unless recording)
+void record_arrival(void);
+
+// Record that LINE, which arrived at the last record_arrival(), has
+// finished with status STATUS (no-op unless recording)
+void record_line(const char *line, int status);
+
+// Replay the recording named in ARGV[0] (ARGC arguments in all); returns 0
+// if every status matched and 1 otherwise
+int replay(int argc, char **argv);
+
+#endif
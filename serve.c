@@ -0,0 +1,322 @@
+// serve.c
+//
+// Unix-socket server mode with a pre-forked worker pool.
+#include "process.h"
+#include "serve.h"
+#include "eval.h"
+#include "capture.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Largest command line accepted from a client
+#define SERVE_MAX_LINE (1 << 20)
+
+// Size of the chunks of output relayed to the client
+#define SERVE_CHUNK 16384
+
+// Structure for the thread that relays a command's output to the client
+typedef struct Relay {
+    int sock;           // Client connection
+    int out;            // Read end of the command's stdout pipe
+    int err;            // Read end of the command's stderr pipe
+} Relay;
+
+// Function to write all N bytes at BUF to FD; returns 0 or -1 on error
+static int write_all(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n > 0)
+    {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (w <= 0)
+        {
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+// Function to read exactly N bytes from FD into BUF; returns 0, or -1 on
+// error or end of file
+static int read_all(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    while (n > 0)
+    {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            return -1;
+        }
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+// Function to send a frame of type TYPE with the N bytes at DATA
+static int send_frame(int sock, char type, const void *data, uint32_t n)
+{
+    unsigned char head[5] = {
+        (unsigned char) type, n >> 24, n >> 16, n >> 8, n
+    };
+    if (write_all(sock, head, sizeof(head)) != 0)
+    {
+        return -1;
+    }
+    return write_all(sock, data, n);
+}
+
+// Function run by the relay thread:  forward output from both pipes until
+// every writer has closed them
+static void *relay_output(void *arg)
+{
+    Relay *r = arg;
+    struct pollfd fds[2] = { { r->out, POLLIN, 0 }, { r->err, POLLIN, 0 } };
+    char buf[SERVE_CHUNK];
+    int open_fds = 2;
+
+    while (open_fds > 0)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            if (fds[i].fd < 0 || !fds[i].revents)
+            {
+                continue;
+            }
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                fds[i].fd = -1;
+                open_fds--;
+            }
+            else
+            {
+                // A client that went away must not stop the command's output
+                // from being drained
+                send_frame(r->sock, i ? 'E' : 'O', buf, n);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Function to run LINE with stdout and stderr streamed to SOCK, then send
+// its status; returns -1 if the client has gone away
+static int serve_command(int sock, char *line)
+{
+    int out[2], err[2];
+    if (pipe2(out, O_CLOEXEC) != 0)
+    {
+        return -1;
+    }
+    if (pipe2(err, O_CLOEXEC) != 0)
+    {
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+
+    Relay r = { sock, out[0], err[0] };
+    pthread_t tid;
+    bool relaying = pthread_create(&tid, NULL, relay_output, &r) == 0;
+
+    // The pipes are the output of this thread and of its foreground
+    // children only (see capture.h); background jobs do not get them, so
+    // they cannot hold up the status
+    int status;
+    if (capture_output(out[1], err[1]) == 0)
+    {
+        status = eval_line(line);
+    }
+    else
+    {
+        perror("serve");
+        status = errno;
+    }
+
+    // Closing the write ends lets the relay finish once it has drained what
+    // the command wrote
+    capture_output(-1, -1);
+    close(out[1]);
+    close(err[1]);
+    if (relaying)
+    {
+        pthread_join(tid, NULL);
+    }
+    close(out[0]);
+    close(err[0]);
+
+    unsigned char st[4] = { status >> 24, status >> 16, status >> 8, status };
+    return send_frame(sock, 'S', st, sizeof(st));
+}
+
+// Function to serve one client session on SOCK until it disconnects
+static void serve_session(int sock)
+{
+    char *line = NULL;
+
+    for ( ; ; )
+    {
+        unsigned char head[4];
+        if (read_all(sock, head, sizeof(head)) != 0)
+        {
+            break;
+        }
+        uint32_t n = ((uint32_t) head[0] << 24) | ((uint32_t) head[1] << 16)
+                   | ((uint32_t) head[2] << 8) | head[3];
+        if (n > SERVE_MAX_LINE)
+        {
+            break;
+        }
+        REALLOC(line, n + 1);
+        if (!line || read_all(sock, line, n) != 0)
+        {
+            break;
+        }
+        line[n] = '\0';
+        if (serve_command(sock, line) != 0)
+        {
+            break;
+        }
+    }
+    free(line);
+}
+
+// Function to start a worker that serves one session from LISTENER; CHLD is
+// the SIGCHLD action that the worker's shell should use
+static pid_t spawn_worker(int listener, const struct sigaction *chld)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        if (pid < 0)
+        {
+            perror("fork");
+        }
+        return pid;
+    }
+
+    sigaction(SIGCHLD, chld, NULL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);       // Do not outlive the server
+
+    int sock;
+    while ((sock = accept(listener, NULL, NULL)) < 0 && errno == EINTR)
+        ;
+    if (sock < 0)
+    {
+        perror("accept");
+        exit(EXIT_FAILURE);
+    }
+    close(listener);
+
+    int null = open("/dev/null", O_RDONLY);
+    if (null >= 0)
+    {
+        dup2(null, STDIN_FILENO);
+        close(null);
+    }
+
+    serve_session(sock);
+    close(sock);
+    exit(EXIT_SUCCESS);
+}
+
+// Function to run the server
+int serve(const char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        WARN("serve: %s: socket path too long\n", path);
+        return EXIT_FAILURE;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(listener, SOMAXCONN) != 0)
+    {
+        WARN("serve: %s: %s\n", path, strerror(errno));
+        close(listener);
+        return EXIT_FAILURE;
+    }
+
+    long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *env = getenv("BSH_SERVE_WORKERS");
+    if (env && atol(env) > 0)
+    {
+        nworkers = atol(env);
+    }
+    if (nworkers < 1)
+    {
+        nworkers = 1;
+    }
+
+    // The server waits for its workers itself; they get the shell's usual
+    // SIGCHLD handler back.  A client that hangs up must not kill a worker.
+    struct sigaction chld, dfl;
+    memset(&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &dfl, &chld);
+    signal(SIGPIPE, SIG_IGN);
+
+    fflush(stdout);
+    fflush(stderr);
+    for (long i = 0; i < nworkers; i++)
+    {
+        spawn_worker(listener, &chld);
+    }
+
+    // Replace each worker as soon as its session has ended
+    for ( ; ; )
+    {
+        pid_t pid = wait(NULL);
+        if (pid < 0 && errno == ECHILD)
+        {
+            break;
+        }
+        if (pid > 0 && spawn_worker(listener, &chld) < 0)
+        {
+            sleep(1);
+        }
+    }
+
+    close(listener);
+    return EXIT_FAILURE;
+}
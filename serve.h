@@ -0,0 +1,26 @@
+// serve.h
+//
+// Server mode:  Bash --serve SOCKET
+//
+// Listens on Unix-domain stream socket SOCKET.  A pool of pre-forked workers
+// ($BSH_SERVE_WORKERS, default one per CPU) accepts connections; each
+// connection is a session with its own working directory and variables, and
+// when it ends its worker exits and is replaced by a fresh fork of the
+// server, so no state leaks from one client to the next.
+//
+// A client sends each command line as a 4-byte big-endian length followed
+// by that many bytes.  The server answers with frames of a 1-byte type, a
+// 4-byte big-endian length and a payload:  'O' (a chunk of standard output)
+// and 'E' (a chunk of standard error) as the command runs, then 'S' with a
+// 4-byte big-endian exit status once it has finished.  Only the foreground
+// part of a line is streamed:  its background jobs (and the watchers of
+// every and on-change) write to /dev/null, or to their job logs if
+// $BSH_JOBLOG is set, and 'S' does not wait for them.
+
+#ifndef SERVE_INCLUDED
+#define SERVE_INCLUDED
+
+// Run the server on socket PATH; returns only on error
+int serve(const char *path);
+
+#endif
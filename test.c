@@ -0,0 +1,373 @@
+// test.c
+//
+// In-process test / [ builtin covering file, string and integer tests.
+#include "process.h"
+#include "test.h"
+#include <sys/stat.h>
+
+// Number of paths remembered by the stat cache
+#define STAT_CACHE_SIZE 16
+
+// Structure for one cached stat() or lstat() result
+typedef struct StatEntry {
+    char *path;         // Path that was examined (NULL if slot unused)
+    bool follow;        // true for stat(), false for lstat()
+    int err;            // errno of the failed call, 0 on success
+    struct stat st;     // Result of the call
+} StatEntry;
+
+static StatEntry stat_cache[STAT_CACHE_SIZE];
+static int stat_cache_next = 0;     // Slot to overwrite next (round robin)
+
+// State of the expression parser
+typedef struct TestParser {
+    int n;              // Number of words in the expression
+    char **words;       // The words themselves
+    int pos;            // Index of the next unread word
+    bool error;         // Set once a syntax error has been reported
+} TestParser;
+
+static bool test_or(TestParser *p);
+
+// Function to discard every cached stat result
+void stat_cache_invalidate(void)
+{
+    for (int i = 0; i < STAT_CACHE_SIZE; i++)
+    {
+        free(stat_cache[i].path);
+        stat_cache[i].path = NULL;
+    }
+    stat_cache_next = 0;
+}
+
+// Function to stat() (FOLLOW) or lstat() PATH through the cache; returns 0 on
+// success and -1 (with errno set) on failure, exactly like the real calls
+static int cached_stat(const char *path, bool follow, struct stat *st)
+{
+    for (int i = 0; i < STAT_CACHE_SIZE; i++)
+    {
+        StatEntry *e = &stat_cache[i];
+        if (e->path && e->follow == follow && strcmp(e->path, path) == 0)
+        {
+            if (e->err)
+            {
+                errno = e->err;
+                return -1;
+            }
+            *st = e->st;
+            return 0;
+        }
+    }
+
+    int rc = follow ? stat(path, st) : lstat(path, st);
+    int err = (rc == 0) ? 0 : errno;
+
+    StatEntry *e = &stat_cache[stat_cache_next];
+    stat_cache_next = (stat_cache_next + 1) % STAT_CACHE_SIZE;
+    free(e->path);
+    e->path = strdup(path);
+    e->follow = follow;
+    e->err = err;
+    if (rc == 0)
+    {
+        e->st = *st;
+    }
+
+    errno = err;
+    return rc;
+}
+
+// Function to parse the integer operand S of an arithmetic comparison
+static bool test_integer(TestParser *p, const char *s, long long *value)
+{
+    char *end;
+    while (*s == ' ' || *s == '\t')
+    {
+        s++;
+    }
+    errno = 0;
+    *value = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t')
+    {
+        end++;
+    }
+    if (end == s || *end != '\0' || errno == ERANGE)
+    {
+        if (!p->error)
+        {
+            WARN("test: %s: integer expression expected\n", s);
+        }
+        p->error = true;
+        return false;
+    }
+    return true;
+}
+
+// Function to check whether OP is a unary test operator
+static bool is_unary_op(const char *op)
+{
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0'
+        && strchr("bcdefghknprstuwxzLSGO", op[1]) != NULL;
+}
+
+// Function to check whether OP is a binary test operator
+static bool is_binary_op(const char *op)
+{
+    static const char *ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef", NULL
+    };
+    for (const char **q = ops; *q; q++)
+    {
+        if (strcmp(op, *q) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to evaluate unary operator OP applied to ARG
+static bool test_unary(TestParser *p, const char *op, const char *arg)
+{
+    struct stat st;
+
+    switch (op[1])
+    {
+        case 'z':
+            return arg[0] == '\0';
+        case 'n':
+            return arg[0] != '\0';
+        case 't':
+        {
+            long long fd;
+            return test_integer(p, arg, &fd) && fd >= 0 && fd <= INT_MAX
+                && isatty((int) fd);
+        }
+        case 'r':
+            return access(arg, R_OK) == 0;
+        case 'w':
+            return access(arg, W_OK) == 0;
+        case 'x':
+            return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L':
+            return cached_stat(arg, false, &st) == 0 && S_ISLNK(st.st_mode);
+        default:
+            break;
+    }
+
+    if (cached_stat(arg, true, &st) != 0)
+    {
+        return false;
+    }
+
+    switch (op[1])
+    {
+        case 'e': return true;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'k': return (st.st_mode & S_ISVTX) != 0;
+        case 'O': return st.st_uid == geteuid();
+        case 'G': return st.st_gid == getegid();
+        default:  return false;
+    }
+}
+
+// Function to compare modification times of A and B for -nt and -ot; a file
+// that exists is newer than one that does not
+static int test_mtime_cmp(const char *a, const char *b)
+{
+    struct stat sa, sb;
+    bool ha = cached_stat(a, true, &sa) == 0;
+    bool hb = cached_stat(b, true, &sb) == 0;
+
+    if (!ha || !hb)
+    {
+        return (int) ha - (int) hb;
+    }
+    if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec)
+    {
+        return sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ? -1 : 1;
+    }
+    if (sa.st_mtim.tv_nsec != sb.st_mtim.tv_nsec)
+    {
+        return sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+// Function to evaluate binary operator OP applied to A and B
+static bool test_binary(TestParser *p, const char *a, const char *op,
+                        const char *b)
+{
+    if (op[0] != '-')
+    {
+        int cmp = strcmp(a, b);
+        switch (op[0])
+        {
+            case '=': return cmp == 0;
+            case '!': return cmp != 0;
+            case '<': return cmp < 0;
+            default:  return cmp > 0;
+        }
+    }
+
+    if (strcmp(op, "-nt") == 0)
+    {
+        return test_mtime_cmp(a, b) > 0;
+    }
+    if (strcmp(op, "-ot") == 0)
+    {
+        return test_mtime_cmp(a, b) < 0;
+    }
+    if (strcmp(op, "-ef") == 0)
+    {
+        struct stat sa, sb;
+        return cached_stat(a, true, &sa) == 0 && cached_stat(b, true, &sb) == 0
+            && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    }
+
+    long long x, y;
+    if (!test_integer(p, a, &x) || !test_integer(p, b, &y))
+    {
+        return false;
+    }
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x <  y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x >  y;
+    return x >= y;
+}
+
+// Function to parse and evaluate a primary:  ( expr ), a binary test, a unary
+// test, or a single string (true if nonempty)
+static bool test_primary(TestParser *p)
+{
+    if (p->pos >= p->n)
+    {
+        if (!p->error)
+        {
+            WARN("test: %s\n", "argument expected");
+        }
+        p->error = true;
+        return false;
+    }
+
+    char **w = p->words + p->pos;
+    int left = p->n - p->pos;
+
+    // A binary operator in second position takes precedence, so that
+    // [ -f = -f ] and [ ( = ( ] compare strings
+    if (left >= 3 && is_binary_op(w[1]))
+    {
+        p->pos += 3;
+        return test_binary(p, w[0], w[1], w[2]);
+    }
+
+    if (strcmp(w[0], "(") == 0 && left >= 2)
+    {
+        p->pos++;
+        bool value = test_or(p);
+        if (p->pos >= p->n || strcmp(p->words[p->pos], ")") != 0)
+        {
+            if (!p->error)
+            {
+                WARN("test: %s\n", "')' expected");
+            }
+            p->error = true;
+            return false;
+        }
+        p->pos++;
+        return value;
+    }
+
+    if (left >= 2 && is_unary_op(w[0]))
+    {
+        p->pos += 2;
+        return test_unary(p, w[0], w[1]);
+    }
+
+    p->pos++;
+    return w[0][0] != '\0';
+}
+
+// Function to parse and evaluate:  ! expr  or a primary
+static bool test_not(TestParser *p)
+{
+    if (p->pos < p->n - 1 && strcmp(p->words[p->pos], "!") == 0)
+    {
+        p->pos++;
+        return !test_not(p);
+    }
+    return test_primary(p);
+}
+
+// Function to parse and evaluate:  expr -a expr
+static bool test_and(TestParser *p)
+{
+    bool value = test_not(p);
+    while (p->pos < p->n && strcmp(p->words[p->pos], "-a") == 0)
+    {
+        p->pos++;
+        bool rhs = test_not(p);
+        value = value && rhs;
+    }
+    return value;
+}
+
+// Function to parse and evaluate:  expr -o expr
+static bool test_or(TestParser *p)
+{
+    bool value = test_and(p);
+    while (p->pos < p->n && strcmp(p->words[p->pos], "-o") == 0)
+    {
+        p->pos++;
+        bool rhs = test_and(p);
+        value = value || rhs;
+    }
+    return value;
+}
+
+// Function to handle the test and [ builtins
+int builtin_test(int argc, char **argv)
+{
+    int n = argc - 1;
+
+    if (strcmp(argv[0], "[") == 0)
+    {
+        if (n < 1 || strcmp(argv[argc - 1], "]") != 0)
+        {
+            WARN("[: %s\n", "missing ']'");
+            return 2;
+        }
+        n--;
+    }
+
+    if (n == 0)
+    {
+        return 1;
+    }
+
+    TestParser p = { n, argv + 1, 0, false };
+    bool value = test_or(&p);
+
+    if (!p.error && p.pos < p.n)
+    {
+        WARN("test: %s: unexpected operator\n", p.words[p.pos]);
+        p.error = true;
+    }
+    if (p.error)
+    {
+        return 2;
+    }
+    return value ? 0 : 1;
+}
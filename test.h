@@ -0,0 +1,17 @@
+// test.h
+//
+// In-process test / [ builtin.  Repeated stat()s of the same path within one
+// command line are served from a small cache that the shell invalidates
+// whenever it runs something that could change the filesystem.
+
+#ifndef TEST_INCLUDED
+#define TEST_INCLUDED
+
+// Evaluate the test expression in ARGV[1..ARGC-1] (ARGV[0] is "test" or "[")
+// and return 0 if it is true, 1 if it is false, and 2 on a syntax error
+int builtin_test(int argc, char **argv);
+
+// Discard all cached stat() results
+void stat_cache_invalidate(void);
+
+#endif
@@ -0,0 +1,211 @@
+// watch.c
+//
+// Table, statistics and runs of the watcher jobs of every and on-change.
+#include "process.h"
+#include "jobs.h"
+#include "watch.h"
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+
+// Number of watchers that can be listed at once
+#define WATCH_MAX 128
+
+static Watch watches[WATCH_MAX];
+
+// In the watcher:  signal mask of the shell, restored in runs
+static sigset_t run_mask;
+
+// Function to return the current CLOCK_MONOTONIC time in nanoseconds
+int64_t watch_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Function to forget watchers whose job is no longer running
+static void watch_forget(void)
+{
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        Watch *w = &watches[i];
+        if (w->pid != 0 && background_job(w->pid) == 0)
+        {
+            munmap(w->stats, sizeof(*w->stats));
+            free(w->line);
+            w->pid = 0;
+        }
+    }
+}
+
+// Function to create a watcher
+Watch *watch_new(const char *kind, int argc, char **argv, int first,
+                 int *status)
+{
+    watch_forget();
+    int slot = 0;
+    while (slot < WATCH_MAX && watches[slot].pid != 0)
+    {
+        slot++;
+    }
+    if (slot == WATCH_MAX)
+    {
+        WARN("%s: %s\n", kind, "too many watchers");
+        *status = 1;
+        return NULL;
+    }
+
+    // The words form the command line; operators such as | and ; have to
+    // be quoted to reach it, so a single word is the usual form
+    char *line = job_words(argc - first, argv + first);
+    token *list = line ? tokenize(line) : NULL;
+    CMD *tree = list ? parse(list) : NULL;
+    freeList(list);
+    if (!tree)
+    {
+        free(line);
+        *status = 2;
+        return NULL;
+    }
+
+    WatchStats *stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED)
+    {
+        perror("mmap");
+        *status = errno;
+        freeCMD(tree);
+        free(line);
+        return NULL;
+    }
+
+    Watch *w = &watches[slot];
+    *w = (Watch) { .kind = kind, .line = line, .tree = tree, .stats = stats };
+    return w;
+}
+
+// Function to start a watcher
+int watch_start(Watch *w, int (*run)(const void *), const void *arg,
+                int argc, char **argv)
+{
+    if (w->report)
+    {
+        job_report_init();
+    }
+    char *text = job_words(argc, argv);
+    pid_t pid = fork_background(run, arg, text ? text : "");
+    int status = errno;
+    free(text);
+    freeCMD(w->tree);
+    w->tree = NULL;
+    if (pid < 0)
+    {
+        munmap(w->stats, sizeof(*w->stats));
+        free(w->line);
+        return status;
+    }
+    w->pid = pid;
+    fprintf(stderr, "Backgrounded: %d\n", pid);
+    return 0;
+}
+
+// Function to list the running watchers of a builtin
+int watch_list(const char *kind)
+{
+    watch_forget();
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        Watch *w = &watches[i];
+        if (w->pid == 0 || strcmp(w->kind, kind) != 0)
+        {
+            continue;
+        }
+        WatchStats s = *w->stats;
+        fprintf(BSTDOUT, "[%d] %d %s  events %lu  skipped %lu  runs %lu"
+                "  failed %lu", background_job(w->pid), (int) w->pid,
+                w->desc, s.events, s.skipped, s.runs, s.failed);
+        if (s.runs > 0)
+        {
+            fprintf(BSTDOUT, "  last %d  latency %.3f/%.3f/%.3f ms",
+                    s.last_status, s.min_ns / 1e6,
+                    s.total_ns / 1e6 / s.runs, s.max_ns / 1e6);
+        }
+        fprintf(BSTDOUT, "  -- %s\n", w->line);
+    }
+    fflush(BSTDOUT);
+    return 0;
+}
+
+// Function to set up a watcher
+int watch_init(void)
+{
+    prctl(PR_SET_PDEATHSIG, SIGTERM);       // Do not outlive the shell
+
+    // Runs are reaped through a signalfd, so SIGCHLD must stay blocked here
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &run_mask);
+    return signalfd(-1, &chld, SFD_CLOEXEC);
+}
+
+// Function to start a run
+void watch_run(Watch *w)
+{
+    w->started = watch_now();
+    w->run = fork();
+    if (w->run < 0)
+    {
+        perror("fork");
+        w->run = 0;
+        w->stats->failed++;
+    }
+    else if (w->run == 0)
+    {
+        // Child process
+        sigprocmask(SIG_SETMASK, &run_mask, NULL);
+        exit(process(w->tree));
+    }
+}
+
+// Function to reap a run
+bool watch_reap(Watch *w, int fd)
+{
+    struct signalfd_siginfo si;
+    if (read(fd, &si, sizeof(si)) < 0 && errno != EAGAIN)
+    {
+        perror("read");
+    }
+
+    int wstatus;
+    struct rusage ru;
+    if (w->run <= 0 || wait4(w->run, &wstatus, WNOHANG, &ru) != w->run)
+    {
+        return false;
+    }
+
+    WatchStats *stats = w->stats;
+    int64_t latency = watch_now() - w->started;
+    int status = STATUS(wstatus);
+    if (stats->runs == 0 || latency < stats->min_ns)
+    {
+        stats->min_ns = latency;
+    }
+    if (latency > stats->max_ns)
+    {
+        stats->max_ns = latency;
+    }
+    stats->total_ns += latency;
+    stats->last_status = status;
+    stats->failed += (status != 0);
+    stats->runs++;
+    if (w->report)
+    {
+        job_report(w->run, wstatus, &ru);
+    }
+    w->run = 0;
+    return true;
+}
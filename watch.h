@@ -0,0 +1,70 @@
+// watch.h
+//
+// Watcher jobs, the background jobs of the every and on-change builtins.
+// A watcher runs a command line, parsed once when the watcher is created,
+// each time its trigger fires, but never two runs at once.  Its statistics
+// live in a shared mapping so that the watcher can update them and the shell
+// can list them, and the exits of its runs may be reported to the shell's
+// job table (see job_report() in jobs.h).
+
+#ifndef WATCH_INCLUDED
+#define WATCH_INCLUDED
+
+#include <stdint.h>
+
+// Structure for the statistics of a watcher
+typedef struct WatchStats {
+    unsigned long events;       // Times the trigger fired
+    unsigned long skipped;      // Of these, times that did not start a run
+    unsigned long runs;         // Runs that have finished
+    unsigned long failed;       // Runs that exited with nonzero status or
+                                // could not be started
+    int last_status;            // Status of the last run
+    int64_t min_ns;             // Shortest run (fork to exit)
+    int64_t max_ns;             // Longest run
+    int64_t total_ns;           // Sum of all runs
+} WatchStats;
+
+// Structure for a watcher
+typedef struct Watch {
+    pid_t pid;                  // Process ID of the watcher (0 if unused)
+    const char *kind;           // Name of the builtin that created it
+    char desc[64];              // Its settings (for listing)
+    char *line;                 // Command line (for listing)
+    CMD *tree;                  // Parsed command line
+    bool report;                // Report the exits of runs to the shell
+    WatchStats *stats;          // Shared statistics
+    pid_t run;                  // In the watcher:  run in progress (or 0)
+    int64_t started;            // In the watcher:  when it started
+} Watch;
+
+// Return the current CLOCK_MONOTONIC time in nanoseconds
+int64_t watch_now(void);
+
+// Create a watcher for builtin KIND that runs the command line formed by the
+// words ARGV[FIRST] ... ARGV[ARGC-1]; returns NULL after a diagnostic, with
+// the status for the builtin in *STATUS, if it cannot
+Watch *watch_new(const char *kind, int argc, char **argv, int first,
+                 int *status);
+
+// Fork watcher W as a background job that returns RUN(ARG), which jobs lists
+// as the command ARGV; returns the status for the builtin.  W is forgotten
+// if it cannot be started.
+int watch_start(Watch *w, int (*run)(const void *), const void *arg,
+                int argc, char **argv);
+
+// List the running watchers of builtin KIND with their statistics
+int watch_list(const char *kind);
+
+// In the watcher:  block SIGCHLD and return a signalfd through which the
+// exits of runs arrive (-1 on error)
+int watch_init(void);
+
+// In the watcher:  start a run of W
+void watch_run(Watch *w);
+
+// In the watcher:  read signalfd FD (from watch_init()) and reap the run of
+// W if it has exited; returns true if it has
+bool watch_reap(Watch *w, int fd);
+
+#endif